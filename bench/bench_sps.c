@@ -0,0 +1,821 @@
+/**
+ * @file bench_sps.c
+ * @brief Microbenchmarks of the sparse set hot paths
+ *
+ * Every case is run several times and reported as one line of CSV (the
+ * default) or one JSON object per line, so results can be collected and
+ * compared across commits. Hardware cache counters are read through
+ * perf_event_open on Linux and reported as empty (CSV) or null (JSON) where
+ * they are not available.
+ *
+ * Usage: bench_sps [--format csv|json] [--reps N] [--filter SUBSTRING] [--quick]
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#define BENCH_HAVE_THREADS 1
+#endif
+
+#include "sps.h"
+
+/** @brief Largest component size exercised, in bytes */
+#define BENCH_MAX_COMPONENT (256U)
+
+/** @brief Threads the parallel cases run on, the calling one included */
+#define BENCH_WORKERS (4U)
+
+/** @brief Number of repetitions of a case when none is given */
+#define BENCH_DEFAULT_REPS (5U)
+
+/** @brief Hardware counters sampled around every measured region */
+typedef enum bench_counter {
+    BENCH_CACHE_MISSES,
+    BENCH_CACHE_REFERENCES,
+    BENCH_COUNTER_COUNT,
+} bench_counter_t;
+
+/** @brief Order in which keys are laid out before a sort */
+typedef enum bench_distribution {
+    BENCH_RANDOM,
+    BENCH_NEARLY_SORTED,
+    BENCH_REVERSED,
+    BENCH_DISTRIBUTION_COUNT,
+} bench_distribution_t;
+
+static const char *const bench_distribution_names[BENCH_DISTRIBUTION_COUNT] = {
+    "random",
+    "nearly_sorted",
+    "reversed",
+};
+
+/** @brief Parameters of one benchmark case */
+typedef struct bench_case {
+    size_t component_size;             /**< Size of each component in bytes */
+    uint32_t count;                    /**< Number of entities in the set */
+    double fill;                       /**< Fraction of the index range that is present */
+    bench_distribution_t distribution; /**< Key order for sorts */
+} bench_case_t;
+
+/** @brief State handed to a benchmark body */
+typedef struct bench_run {
+    const bench_case_t *config;
+    uint32_t range;      /**< Entity indices are drawn from [0, range) */
+    uint32_t *present;   /**< count distinct indices in random order */
+    uint32_t *absent;    /**< count indices of the range not in present */
+    uint8_t *component;  /**< Scratch component of component_size bytes */
+    uint64_t elapsed_ns; /**< Time spent between bench_begin and bench_end */
+    int64_t counters[BENCH_COUNTER_COUNT];
+} bench_run_t;
+
+/** @brief Benchmark body, returns the number of operations measured */
+typedef uint64_t (*bench_fn_t)(bench_run_t *run);
+
+/** @brief Dimensions a benchmark is run over */
+typedef enum bench_axes {
+    BENCH_ACCESS, /**< Component sizes, counts and fill levels */
+    BENCH_SORT,   /**< Component sizes, counts and key distributions */
+} bench_axes_t;
+
+typedef struct bench_def {
+    const char *name;
+    bench_fn_t run;
+    bench_axes_t axes;
+} bench_def_t;
+
+/** @brief Keeps measured loops from being optimized away */
+static volatile uintptr_t bench_sink;
+
+static int bench_perf_fds[BENCH_COUNTER_COUNT] = {-1, -1};
+
+static uint64_t bench_rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t bench_rng(void) {
+    // xorshift64*
+    bench_rng_state ^= bench_rng_state >> 12;
+    bench_rng_state ^= bench_rng_state << 25;
+    bench_rng_state ^= bench_rng_state >> 27;
+    return bench_rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint32_t bench_rng_below(uint32_t bound) {
+    return (uint32_t)((bench_rng() >> 32) * bound >> 32);
+}
+
+static uint64_t bench_now_ns(void) {
+    struct timespec ts;
+#if defined(__linux__)
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void bench_perf_open(void) {
+#if defined(__linux__)
+    static const uint64_t configs[BENCH_COUNTER_COUNT] = {
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_CACHE_REFERENCES,
+    };
+
+    for (int i = 0; i < BENCH_COUNTER_COUNT; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type           = PERF_TYPE_HARDWARE;
+        attr.size           = sizeof(attr);
+        attr.config         = configs[i];
+        attr.disabled       = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        bench_perf_fds[i]   = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0UL);
+    }
+#endif
+}
+
+static void bench_perf_close(void) {
+#if defined(__linux__)
+    for (int i = 0; i < BENCH_COUNTER_COUNT; i++) {
+        if (bench_perf_fds[i] >= 0) close(bench_perf_fds[i]);
+    }
+#endif
+}
+
+/** Start the measured region of a benchmark body */
+static void bench_begin(bench_run_t *run) {
+#if defined(__linux__)
+    for (int i = 0; i < BENCH_COUNTER_COUNT; i++) {
+        if (bench_perf_fds[i] >= 0) {
+            ioctl(bench_perf_fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(bench_perf_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+    run->elapsed_ns = bench_now_ns();
+}
+
+/** End the measured region of a benchmark body */
+static void bench_end(bench_run_t *run) {
+    run->elapsed_ns = bench_now_ns() - run->elapsed_ns;
+    for (int i = 0; i < BENCH_COUNTER_COUNT; i++) {
+        run->counters[i] = -1;
+#if defined(__linux__)
+        uint64_t value;
+        if (bench_perf_fds[i] >= 0) {
+            ioctl(bench_perf_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(bench_perf_fds[i], &value, sizeof(value)) == (ssize_t)sizeof(value)) {
+                run->counters[i] = (int64_t)value;
+            }
+        }
+#endif
+    }
+}
+
+static void bench_shuffle(uint32_t *values, uint32_t n) {
+    for (uint32_t i = n; i > 1; i--) {
+        uint32_t j    = bench_rng_below(i);
+        uint32_t swap = values[i - 1];
+        values[i - 1] = values[j];
+        values[j]     = swap;
+    }
+}
+
+/** Allocate zeroed memory, a benchmark cannot continue without it */
+static void *bench_alloc(size_t size) {
+    void *block = calloc(1, size > 0 ? size : 1);
+    if (block == NULL) {
+        fprintf(stderr, "bench_sps: out of memory\n");
+        exit(1);
+    }
+    return block;
+}
+
+static sparse_set_t *bench_new_set(const bench_run_t *run) {
+    sparse_set_t *set = sps_new_ex(run->config->component_size, run->config->count, SPARSE_SET_MAX);
+    if (set == NULL) {
+        fprintf(stderr, "bench_sps: failed to create a set\n");
+        exit(1);
+    }
+    return set;
+}
+
+/** Create a set holding every present index, in the shuffled order */
+static sparse_set_t *bench_filled_set(bench_run_t *run) {
+    sparse_set_t *set = bench_new_set(run);
+    for (uint32_t i = 0; i < run->config->count; i++) {
+        memcpy(run->component, &run->present[i], sizeof(uint32_t));
+        sps_add(set, run->present[i], run->component);
+    }
+    return set;
+}
+
+static uint64_t bench_add_sequential(bench_run_t *run) {
+    sparse_set_t *set = bench_new_set(run);
+    uint32_t step     = run->range / run->config->count;
+
+    bench_begin(run);
+    for (uint32_t i = 0; i < run->config->count; i++) {
+        sps_add(set, i * step, run->component);
+    }
+    bench_end(run);
+
+    sps_free(set);
+    return run->config->count;
+}
+
+static uint64_t bench_add_random(bench_run_t *run) {
+    sparse_set_t *set = bench_new_set(run);
+
+    bench_begin(run);
+    for (uint32_t i = 0; i < run->config->count; i++) {
+        sps_add(set, run->present[i], run->component);
+    }
+    bench_end(run);
+
+    sps_free(set);
+    return run->config->count;
+}
+
+static uint64_t bench_add_unchecked(bench_run_t *run) {
+    sparse_set_t *set = bench_new_set(run);
+
+    bench_begin(run);
+    for (uint32_t i = 0; i < run->config->count; i++) {
+        sps_add_unchecked(set, run->present[i], run->component);
+    }
+    bench_end(run);
+
+    sps_free(set);
+    return run->config->count;
+}
+
+static uint64_t bench_add_many(bench_run_t *run) {
+    sparse_set_t *set  = bench_new_set(run);
+    size_t size        = run->config->component_size * run->config->count;
+    uint8_t *batch     = bench_alloc(size);
+
+    bench_begin(run);
+    sps_add_many(set, run->present, run->config->count, batch);
+    bench_end(run);
+
+    free(batch);
+    sps_free(set);
+    return run->config->count;
+}
+
+static uint64_t bench_get_sequential(bench_run_t *run) {
+    sparse_set_t *set = bench_filled_set(run);
+    uintptr_t sum     = 0;
+
+    // Walks the dense order, so component reads are sequential
+    bench_begin(run);
+    for (uint32_t i = 0; i < run->config->count; i++) {
+        sum += (uintptr_t)sps_get(set, run->present[i]);
+    }
+    bench_end(run);
+
+    bench_sink = sum;
+    sps_free(set);
+    return run->config->count;
+}
+
+static uint64_t bench_get_random(bench_run_t *run) {
+    sparse_set_t *set = bench_filled_set(run);
+    uint32_t *order   = bench_alloc(run->config->count * sizeof(*order));
+    memcpy(order, run->present, run->config->count * sizeof(*order));
+    bench_shuffle(order, run->config->count);
+    uintptr_t sum = 0;
+
+    bench_begin(run);
+    for (uint32_t i = 0; i < run->config->count; i++) {
+        sum += *(const uint8_t *)sps_get(set, order[i]);
+    }
+    bench_end(run);
+
+    bench_sink = sum;
+    free(order);
+    sps_free(set);
+    return run->config->count;
+}
+
+static uint64_t bench_get_unchecked(bench_run_t *run) {
+    sparse_set_t *set = bench_filled_set(run);
+    uint32_t *order   = bench_alloc(run->config->count * sizeof(*order));
+    memcpy(order, run->present, run->config->count * sizeof(*order));
+    bench_shuffle(order, run->config->count);
+    uintptr_t sum = 0;
+
+    // Same probes as get_random through the inline accessor
+    bench_begin(run);
+    for (uint32_t i = 0; i < run->config->count; i++) {
+        const uint8_t *component = sps_get_unchecked(set, order[i]);
+        sum += component != NULL ? *component : 0;
+    }
+    bench_end(run);
+
+    bench_sink = sum;
+    free(order);
+    sps_free(set);
+    return run->config->count;
+}
+
+static uint64_t bench_get_miss(bench_run_t *run) {
+    sparse_set_t *set = bench_filled_set(run);
+    uint32_t misses   = run->range - run->config->count;
+    uintptr_t sum     = 0;
+
+    bench_begin(run);
+    for (uint32_t i = 0; i < misses; i++) {
+        sum += sps_has(set, run->absent[i]);
+    }
+    bench_end(run);
+
+    bench_sink = sum;
+    sps_free(set);
+    return misses;
+}
+
+/** Probe every index of the range, present and absent ones shuffled together */
+static uint32_t *bench_probes(const bench_run_t *run) {
+    uint32_t *probes = bench_alloc((size_t)run->range * sizeof(*probes));
+    memcpy(probes, run->present, (size_t)run->range * sizeof(*probes));
+    bench_shuffle(probes, run->range);
+    return probes;
+}
+
+static uint64_t bench_has_random(bench_run_t *run) {
+    sparse_set_t *set = bench_filled_set(run);
+    uint32_t *probes  = bench_probes(run);
+    uintptr_t sum     = 0;
+
+    bench_begin(run);
+    for (uint32_t i = 0; i < run->range; i++) {
+        sum += sps_has(set, probes[i]);
+    }
+    bench_end(run);
+
+    bench_sink = sum;
+    free(probes);
+    sps_free(set);
+    return run->range;
+}
+
+static uint64_t bench_has_unchecked(bench_run_t *run) {
+    sparse_set_t *set = bench_filled_set(run);
+    uint32_t *probes  = bench_probes(run);
+    uintptr_t sum     = 0;
+
+    bench_begin(run);
+    for (uint32_t i = 0; i < run->range; i++) {
+        sum += sps_has_unchecked(set, probes[i]);
+    }
+    bench_end(run);
+
+    bench_sink = sum;
+    free(probes);
+    sps_free(set);
+    return run->range;
+}
+
+static uint64_t bench_has_many(bench_run_t *run) {
+    sparse_set_t *set = bench_filled_set(run);
+    uint32_t *probes  = bench_probes(run);
+    uint64_t *bits    = bench_alloc(((size_t)run->range + 63) / 64 * sizeof(*bits));
+
+    bench_begin(run);
+    bench_sink = sps_has_many(set, probes, run->range, bits);
+    bench_end(run);
+
+    free(bits);
+    free(probes);
+    sps_free(set);
+    return run->range;
+}
+
+static uint64_t bench_remove_random(bench_run_t *run) {
+    sparse_set_t *set = bench_filled_set(run);
+    uint32_t *order   = bench_alloc(run->config->count * sizeof(*order));
+    memcpy(order, run->present, run->config->count * sizeof(*order));
+    bench_shuffle(order, run->config->count);
+
+    bench_begin(run);
+    for (uint32_t i = 0; i < run->config->count; i++) {
+        sps_remove(set, order[i]);
+    }
+    bench_end(run);
+
+    free(order);
+    sps_free(set);
+    return run->config->count;
+}
+
+static uint64_t bench_iter_next(bench_run_t *run) {
+    sparse_set_t *set = bench_filled_set(run);
+    sparse_set_iter_t iter = sps_iter_new(set);
+    uintptr_t sum          = 0;
+    uint32_t index;
+    const uint8_t *component;
+
+    bench_begin(run);
+    while ((component = sps_iter_next(&iter, &index)) != NULL) {
+        sum += *component + index;
+    }
+    bench_end(run);
+
+    bench_sink = sum;
+    sps_free(set);
+    return run->config->count;
+}
+
+static uint64_t bench_iter_span(bench_run_t *run) {
+    sparse_set_t *set      = bench_filled_set(run);
+    sparse_set_span_t span = sps_span(set);
+    size_t size            = run->config->component_size;
+    uintptr_t sum          = 0;
+
+    bench_begin(run);
+    const uint8_t *components = span.components;
+    for (size_t i = 0; i < span.count; i++) {
+        sum += components[i * size] + span.entities[i];
+    }
+    bench_end(run);
+
+    bench_sink = sum;
+    sps_free(set);
+    return run->config->count;
+}
+
+static uint64_t bench_churn(bench_run_t *run) {
+    sparse_set_t *set = bench_filled_set(run);
+    uint64_t ops      = (uint64_t)run->config->count * 4;
+    uintptr_t sum     = 0;
+
+    // Half lookups, the rest toggles an index of the range in or out
+    bench_begin(run);
+    for (uint64_t i = 0; i < ops; i++) {
+        uint32_t index = bench_rng_below(run->range);
+        if (i & 1) {
+            sum += (uintptr_t)sps_get(set, index);
+        } else if (sps_has(set, index)) {
+            sps_remove(set, index);
+        } else {
+            sps_add(set, index, run->component);
+        }
+    }
+    bench_end(run);
+
+    bench_sink = sum;
+    sps_free(set);
+    return ops;
+}
+
+/** Create a set whose components carry a uint32_t key laid out per the distribution */
+static sparse_set_t *bench_keyed_set(bench_run_t *run) {
+    sparse_set_t *set = bench_filled_set(run);
+    uint32_t n        = run->config->count;
+    uint8_t *c        = set->components;
+    size_t size       = run->config->component_size;
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t key;
+        switch (run->config->distribution) {
+            case BENCH_RANDOM:
+                key = (uint32_t)bench_rng();
+                break;
+            case BENCH_REVERSED:
+                key = n - i;
+                break;
+            case BENCH_NEARLY_SORTED:
+            case BENCH_DISTRIBUTION_COUNT:
+            default:
+                key = i;
+                break;
+        }
+        memcpy(c + (size_t)i * size, &key, sizeof(key));
+    }
+
+    // One percent of the elements out of place
+    if (run->config->distribution == BENCH_NEARLY_SORTED) {
+        for (uint32_t i = 0; i < n / 100; i++) {
+            uint32_t a = bench_rng_below(n);
+            uint32_t b = bench_rng_below(n);
+            uint32_t ka;
+            uint32_t kb;
+            memcpy(&ka, c + (size_t)a * size, sizeof(ka));
+            memcpy(&kb, c + (size_t)b * size, sizeof(kb));
+            memcpy(c + (size_t)a * size, &kb, sizeof(kb));
+            memcpy(c + (size_t)b * size, &ka, sizeof(ka));
+        }
+    }
+    return set;
+}
+
+static int bench_compare_key(const void *a, const void *b, void *context) {
+    (void)context;
+    uint32_t ka;
+    uint32_t kb;
+    memcpy(&ka, a, sizeof(ka));
+    memcpy(&kb, b, sizeof(kb));
+    return (ka > kb) - (ka < kb);
+}
+
+static uint64_t bench_sort(bench_run_t *run) {
+    sparse_set_t *set = bench_keyed_set(run);
+
+    bench_begin(run);
+    sps_sort(set, bench_compare_key, NULL);
+    bench_end(run);
+
+    sps_free(set);
+    return run->config->count;
+}
+
+/** Tasks of one batch run by one thread, every BENCH_WORKERS-th from first */
+typedef struct bench_worker {
+    sps_task_func_t func;
+    void *task;
+    size_t count;
+    size_t first;
+} bench_worker_t;
+
+static void *bench_worker_main(void *arg) {
+    bench_worker_t *worker = arg;
+    for (size_t i = worker->first; i < worker->count; i += BENCH_WORKERS) {
+        worker->func(worker->task, i);
+    }
+    return NULL;
+}
+
+/** Scheduler starting a thread per worker for every batch, inline without threads */
+static void bench_run_tasks(sps_task_func_t func, void *task, size_t count, void *ctx) {
+    (void)ctx;
+    bench_worker_t workers[BENCH_WORKERS];
+    for (size_t w = 0; w < BENCH_WORKERS; w++) {
+        workers[w] = (bench_worker_t){func, task, count, w};
+    }
+
+#if defined(BENCH_HAVE_THREADS)
+    pthread_t threads[BENCH_WORKERS];
+    bool started[BENCH_WORKERS] = {false};
+    for (size_t w = 1; w < BENCH_WORKERS; w++) {
+        started[w] = pthread_create(&threads[w], NULL, bench_worker_main, &workers[w]) == 0;
+    }
+
+    bench_worker_main(&workers[0]);
+    for (size_t w = 1; w < BENCH_WORKERS; w++) {
+        if (started[w]) {
+            pthread_join(threads[w], NULL);
+        } else {
+            bench_worker_main(&workers[w]);
+        }
+    }
+#else
+    for (size_t w = 0; w < BENCH_WORKERS; w++) {
+        bench_worker_main(&workers[w]);
+    }
+#endif
+}
+
+static uint64_t bench_sort_parallel(bench_run_t *run) {
+    sparse_set_t *set         = bench_keyed_set(run);
+    sps_scheduler_t scheduler = {.run = bench_run_tasks, .workers = BENCH_WORKERS};
+
+    bench_begin(run);
+    sps_sort_parallel(set, bench_compare_key, NULL, &scheduler);
+    bench_end(run);
+
+    sps_free(set);
+    return run->config->count;
+}
+
+static uint64_t bench_sort_by_key(bench_run_t *run) {
+    sparse_set_t *set = bench_keyed_set(run);
+
+    bench_begin(run);
+    sps_sort_by_key(set, 0, SPS_KEY_U32);
+    bench_end(run);
+
+    sps_free(set);
+    return run->config->count;
+}
+
+static const bench_def_t bench_defs[] = {
+    {"add_sequential", bench_add_sequential, BENCH_ACCESS},
+    {"add_random", bench_add_random, BENCH_ACCESS},
+    {"add_unchecked", bench_add_unchecked, BENCH_ACCESS},
+    {"add_many", bench_add_many, BENCH_ACCESS},
+    {"get_sequential", bench_get_sequential, BENCH_ACCESS},
+    {"get_random", bench_get_random, BENCH_ACCESS},
+    {"get_unchecked", bench_get_unchecked, BENCH_ACCESS},
+    {"get_miss", bench_get_miss, BENCH_ACCESS},
+    {"has_random", bench_has_random, BENCH_ACCESS},
+    {"has_unchecked", bench_has_unchecked, BENCH_ACCESS},
+    {"has_many", bench_has_many, BENCH_ACCESS},
+    {"remove_random", bench_remove_random, BENCH_ACCESS},
+    {"iter_next", bench_iter_next, BENCH_ACCESS},
+    {"iter_span", bench_iter_span, BENCH_ACCESS},
+    {"churn", bench_churn, BENCH_ACCESS},
+    {"sort", bench_sort, BENCH_SORT},
+    {"sort_parallel", bench_sort_parallel, BENCH_SORT},
+    {"sort_by_key", bench_sort_by_key, BENCH_SORT},
+};
+
+static const size_t bench_component_sizes[] = {4, 16, 64, 256};
+static const uint32_t bench_counts[]        = {1024, 65536, 262144};
+static const uint32_t bench_quick_counts[]  = {1024, 16384};
+static const double bench_fills[]           = {1.0, 0.5, 0.1};
+
+typedef struct bench_options {
+    bool json;
+    bool quick;
+    unsigned reps;
+    const char *filter;
+} bench_options_t;
+
+/** Draw the indices of a case: count present ones and the rest of the range */
+static void bench_prepare(bench_run_t *run, const bench_case_t *config) {
+    run->config = config;
+    run->range  = (uint32_t)((double)config->count / config->fill);
+
+    uint32_t *all  = bench_alloc((size_t)run->range * sizeof(*all));
+    run->component = bench_alloc(BENCH_MAX_COMPONENT);
+
+    for (uint32_t i = 0; i < run->range; i++) {
+        all[i] = i;
+    }
+    bench_shuffle(all, run->range);
+
+    run->present = all;
+    run->absent  = all + config->count;
+}
+
+static int bench_compare_double(const void *a, const void *b) {
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+static void bench_report(const bench_options_t *options,
+                         const bench_def_t *def,
+                         const bench_case_t *config,
+                         uint64_t ops,
+                         double *ns_per_op,
+                         const int64_t *counters) {
+    qsort(ns_per_op, options->reps, sizeof(*ns_per_op), bench_compare_double);
+    double best   = ns_per_op[0];
+    double median = ns_per_op[options->reps / 2];
+
+    const char *distribution = def->axes == BENCH_SORT ? bench_distribution_names[config->distribution] : "";
+    double fill              = def->axes == BENCH_SORT ? 1.0 : config->fill;
+
+    char counter_text[BENCH_COUNTER_COUNT][32];
+    for (int i = 0; i < BENCH_COUNTER_COUNT; i++) {
+        if (counters[i] < 0) {
+            snprintf(counter_text[i], sizeof(counter_text[i]), "%s", options->json ? "null" : "");
+        } else {
+            snprintf(counter_text[i],
+                     sizeof(counter_text[i]),
+                     "%.4f",
+                     (double)counters[i] / (double)(ops > 0 ? ops : 1));
+        }
+    }
+
+    if (options->json) {
+        printf("{\"benchmark\":\"%s\",\"component_size\":%zu,\"count\":%u,\"fill\":%.2f,"
+               "\"distribution\":\"%s\",\"ops\":%llu,\"ns_per_op\":%.3f,\"ns_per_op_median\":%.3f,"
+               "\"cache_misses_per_op\":%s,\"cache_references_per_op\":%s}\n",
+               def->name,
+               config->component_size,
+               config->count,
+               fill,
+               distribution,
+               (unsigned long long)ops,
+               best,
+               median,
+               counter_text[BENCH_CACHE_MISSES],
+               counter_text[BENCH_CACHE_REFERENCES]);
+    } else {
+        printf("%s,%zu,%u,%.2f,%s,%llu,%.3f,%.3f,%s,%s\n",
+               def->name,
+               config->component_size,
+               config->count,
+               fill,
+               distribution,
+               (unsigned long long)ops,
+               best,
+               median,
+               counter_text[BENCH_CACHE_MISSES],
+               counter_text[BENCH_CACHE_REFERENCES]);
+    }
+    fflush(stdout);
+}
+
+/** Run one case options->reps times, keeping the counters of the fastest run */
+static void bench_case(const bench_options_t *options, const bench_def_t *def, const bench_case_t *config) {
+    bench_run_t run = {0};
+    bench_prepare(&run, config);
+
+    double *ns_per_op = bench_alloc(options->reps * sizeof(*ns_per_op));
+    int64_t best_counters[BENCH_COUNTER_COUNT];
+    double best = -1.0;
+    uint64_t ops = 0;
+
+    for (unsigned rep = 0; rep < options->reps; rep++) {
+        ops            = def->run(&run);
+        ns_per_op[rep] = (double)run.elapsed_ns / (double)(ops > 0 ? ops : 1);
+        if (best < 0.0 || ns_per_op[rep] < best) {
+            best = ns_per_op[rep];
+            memcpy(best_counters, run.counters, sizeof(best_counters));
+        }
+    }
+
+    bench_report(options, def, config, ops, ns_per_op, best_counters);
+    free(ns_per_op);
+    free(run.present);
+    free(run.component);
+}
+
+static bool bench_parse(int argc, char **argv, bench_options_t *options) {
+    *options = (bench_options_t){.reps = BENCH_DEFAULT_REPS};
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            const char *format = argv[++i];
+            if (strcmp(format, "json") != 0 && strcmp(format, "csv") != 0) return false;
+            options->json = strcmp(format, "json") == 0;
+        } else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+            long reps = strtol(argv[++i], NULL, 10);
+            if (reps <= 0 || reps > 1000) return false;
+            options->reps = (unsigned)reps;
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            options->filter = argv[++i];
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            options->quick = true;
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv) {
+    bench_options_t options;
+    if (!bench_parse(argc, argv, &options)) {
+        fprintf(stderr, "usage: %s [--format csv|json] [--reps N] [--filter SUBSTRING] [--quick]\n", argv[0]);
+        return 1;
+    }
+
+    const uint32_t *counts = options.quick ? bench_quick_counts : bench_counts;
+    size_t count_n = options.quick ? sizeof(bench_quick_counts) / sizeof(*bench_quick_counts)
+                                   : sizeof(bench_counts) / sizeof(*bench_counts);
+
+    bench_perf_open();
+    if (!options.json) {
+        printf("benchmark,component_size,count,fill,distribution,ops,ns_per_op,ns_per_op_median,"
+               "cache_misses_per_op,cache_references_per_op\n");
+    }
+
+    for (size_t d = 0; d < sizeof(bench_defs) / sizeof(*bench_defs); d++) {
+        const bench_def_t *def = &bench_defs[d];
+        if (options.filter != NULL && strstr(def->name, options.filter) == NULL) {
+            continue;
+        }
+
+        size_t variants = def->axes == BENCH_SORT ? BENCH_DISTRIBUTION_COUNT
+                                                  : sizeof(bench_fills) / sizeof(*bench_fills);
+        for (size_t s = 0; s < sizeof(bench_component_sizes) / sizeof(*bench_component_sizes); s++) {
+            for (size_t c = 0; c < count_n; c++) {
+                for (size_t v = 0; v < variants; v++) {
+                    bench_case_t config = {
+                        .component_size = bench_component_sizes[s],
+                        .count          = counts[c],
+                        .fill           = def->axes == BENCH_SORT ? 1.0 : bench_fills[v],
+                        .distribution   = def->axes == BENCH_SORT ? (bench_distribution_t)v : BENCH_RANDOM,
+                    };
+                    bench_case(&options, def, &config);
+                }
+            }
+        }
+    }
+
+    bench_perf_close();
+    return 0;
+}
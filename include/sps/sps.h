@@ -14,8 +14,175 @@
 #include <stddef.h>
 #include <stdint.h>
 
-/** @brief Maximum capacity of the sparse set */
-#define SPARSE_SET_MAX (UINT16_MAX)
+#ifdef SPS_ENABLE_STATS
+#include <stdatomic.h>
+#endif
+
+/** @brief Maximum capacity of the sparse set, also used as the invalid entity index */
+#define SPARSE_SET_MAX (UINT32_MAX)
+
+/** @brief log2 of the number of entries in one sparse page */
+#define SPS_PAGE_BITS (12)
+
+/** @brief Number of entity indices covered by one lazily allocated sparse page */
+#define SPS_PAGE_SIZE (1U << SPS_PAGE_BITS)
+
+/** @brief Number of sparse pages needed to cover the full 32-bit index range */
+#define SPS_PAGE_COUNT_MAX ((size_t)1 << (32 - SPS_PAGE_BITS))
+
+/** @brief Number of component slots reserved up front by sps_new */
+#define SPS_DEFAULT_CAPACITY (64)
+
+/** @brief Largest component storage alignment a set can be created with */
+#define SPS_ALIGN_MAX (4096U)
+
+/** @brief Set flag: record which components changed position or value since the last sort */
+#define SPS_TRACK_ORDER (1U << 0)
+
+/** @brief Set flag: too many components changed to track, the next sort is a full one */
+#define SPS_ORDER_STALE (1U << 1)
+
+/** @brief Set flag: components are split into one dense column per field */
+#define SPS_SOA (1U << 2)
+
+/** @brief Set flag: the set belongs to an owning group, which keeps its dense order */
+#define SPS_OWNED (1U << 3)
+
+/** @brief Set flag: record which components were added, modified or removed since the last clear */
+#define SPS_TRACK_CHANGES (1U << 4)
+
+/** @brief Set flag: the change list may hold removed or repeated entities and is compacted before use */
+#define SPS_CHANGES_STALE (1U << 5)
+
+/** @brief Set flag: a change list could not grow, changes are found by scanning and removals were lost */
+#define SPS_CHANGES_LOST (1U << 6)
+
+/** @brief Set flag: the dense storage is a read-only file mapping, the set cannot be modified */
+#define SPS_READ_ONLY (1U << 7)
+
+/** @brief Set flag: removals leave tombstones in place instead of moving the last component */
+#define SPS_STABLE_REMOVE (1U << 8)
+
+/** @brief Set flag: components live in fixed size blocks that never move as the set grows */
+#define SPS_PAGED (1U << 9)
+
+/** @brief Dense entry of a component removed in stable mode, until sps_compact */
+#define SPS_TOMBSTONE (SPARSE_SET_MAX)
+
+/** @brief Version of the binary format written by sps_serialize */
+#define SPS_FORMAT_VERSION (1U)
+
+/** @brief Alignment of every array in the binary format, relative to its start */
+#define SPS_FORMAT_ALIGN (64U)
+
+/** @brief Change kind: the component was added since the last sps_changes_clear */
+#define SPS_CHANGE_ADDED (1U << 0)
+
+/** @brief Change kind: the component was replaced or marked dirty since the last sps_changes_clear */
+#define SPS_CHANGE_MODIFIED (1U << 1)
+
+/** @brief Maximum number of sets an owning group can hold */
+#define SPS_GROUP_MAX_SETS (8)
+
+/** @brief Handle that is never returned for an entity present in a set */
+#define SPS_HANDLE_INVALID ((sps_handle_t)SPARSE_SET_MAX)
+
+/**
+ * @brief Generational entity handle
+ *
+ * Packs a 32-bit entity index in the low half and a 32-bit generation in the
+ * high half. A handle only matches a component that was added with the same
+ * generation, so a recycled entity index cannot reach the previous owner's
+ * component.
+ */
+typedef uint64_t sps_handle_t;
+
+/**
+ * @brief Entry of a sparse page
+ *
+ * The generation sits next to the dense position so handle validation reads
+ * the same cache line as a plain lookup.
+ */
+typedef struct sps_slot {
+    uint32_t dense;      /**< Position in the dense array plus one, or 0 when absent */
+    uint32_t generation; /**< Generation the component was added with */
+} sps_slot_t;
+
+/**
+ * @brief Memory allocator used by a set for all of its storage
+ *
+ * Every call receives the alignment the block needs and the user context.
+ * Sizes passed to resize and release are the sizes the blocks were last
+ * requested with, so arena and pool allocators need not store them.
+ */
+typedef struct sps_allocator {
+    /** Allocate size bytes aligned to align, a power of two that exceeds
+     *  _Alignof(max_align_t) for the set itself (64) and for the storage of
+     *  sets created with a larger alignment, or return NULL on failure */
+    void* (*alloc)(size_t size, size_t align, void* ctx);
+    /** Resize a block keeping its first old_size bytes, or return NULL and keep
+     *  the old block on failure; may be NULL to allocate, copy and release instead */
+    void* (*resize)(void* ptr, size_t old_size, size_t new_size, size_t align, void* ctx);
+    /** Release a block previously returned by alloc or resize */
+    void (*release)(void* ptr, size_t size, void* ctx);
+    void* ctx; /**< User context passed to every call */
+} sps_allocator_t;
+
+/**
+ * @brief Field of a component, as laid out in the component struct
+ */
+typedef struct sps_field {
+    size_t offset; /**< Byte offset of the field within the component */
+    size_t size;   /**< Size of the field in bytes */
+} sps_field_t;
+
+/**
+ * @brief Dense column holding one field of every component
+ *
+ * data + i * size is the field of the component at dense position i.
+ */
+typedef struct sps_column {
+    uint8_t* data; /**< Packed field values, in dense order */
+    size_t offset; /**< Byte offset of the field within the component */
+    size_t size;   /**< Size of the field in bytes */
+} sps_column_t;
+
+/**
+ * @brief Usage counters of a set
+ *
+ * Only collected when the library is built with SPS_ENABLE_STATS.
+ */
+typedef struct sps_stats {
+    uint64_t adds;        /**< Components added */
+    uint64_t removes;     /**< Components removed */
+    uint64_t gets;        /**< Lookups through the get and has functions, single or batched */
+    uint64_t misses;      /**< Lookups that found no component */
+    uint64_t sorts;       /**< Calls to any of the sps_sort functions */
+    uint64_t comparisons; /**< Comparator invocations made by the sorts */
+    uint64_t sort_ns;     /**< Wall clock time spent in the sorts, in nanoseconds */
+    uint64_t bytes_moved; /**< Component bytes moved by removals, sorts and group swaps */
+    uint32_t peak_count;  /**< Largest count the set reached */
+} sps_stats_t;
+
+#ifdef SPS_ENABLE_STATS
+/**
+ * @brief Usage counters as a set stores them, read through sps_stats
+ *
+ * Lookups may run on several threads at once, so the counters are atomic and
+ * updated with relaxed ordering.
+ */
+typedef struct sps_counters {
+    _Atomic uint64_t adds;
+    _Atomic uint64_t removes;
+    _Atomic uint64_t gets;
+    _Atomic uint64_t misses;
+    _Atomic uint64_t sorts;
+    _Atomic uint64_t comparisons;
+    _Atomic uint64_t sort_ns;
+    _Atomic uint64_t bytes_moved;
+    _Atomic uint32_t peak_count;
+} sps_counters_t;
+#endif
 
 /**
  * @brief Sparse set data structure
@@ -23,15 +190,96 @@
  * Implements a sparse set with associated component data. The set maintains
  * a sparse array mapping entity IDs to dense array indices, and a dense array
  * for fast iteration of active entities.
+ *
+ * The sparse array is split into pages of SPS_PAGE_SIZE entries that are
+ * allocated the first time an index inside them is added. Pages that were
+ * never touched share a single read-only empty page, so memory use follows
+ * the number of touched pages rather than the largest entity index; the page
+ * directory itself costs one pointer per SPS_PAGE_SIZE indices up to the
+ * largest page touched.
+ *
+ * The sparse pages, the dense array and the component storage are separate
+ * blocks, so random probes of the sparse pages and linear scans of the dense
+ * storage never share a page; sps_advise tunes the paging of the latter.
  */
 typedef struct sparse_set {
-    uint16_t count;                  /**< Number of active entities in the set */
-    size_t component_size;           /**< Size of individual component in bytes */
-    uint16_t sparse[SPARSE_SET_MAX]; /**< Maps entity index to position in dense array */
-    uint16_t dense[SPARSE_SET_MAX];  /**< Stores active entity indices in packed format */
-    uint8_t components[];            /**< Component data associated with entities */
+    // Read by every lookup, add and iteration. Sets are allocated 64 byte aligned, so these
+    // share one cache line; paged sets also read blocks and block_bits, further down.
+    uint32_t count;        /**< Number of dense entries in use, tombstones included */
+    uint32_t flags;        /**< Tracking modes and state, 0 for a plain set */
+    sps_slot_t** sparse;   /**< Page directory mapping entity index to its sparse slot */
+    uint32_t page_count;   /**< Number of entries in the page directory */
+    uint32_t capacity;     /**< Number of slots allocated in dense and components */
+    uint32_t* dense;       /**< Stores active entity indices in packed format */
+    uint8_t* components;   /**< Component data associated with entities */
+    size_t component_size; /**< Size of individual component in bytes */
+    sps_column_t* columns; /**< Field columns of a structure-of-arrays set, else NULL */
+    uint32_t column_count; /**< Number of entries in columns */
+    uint32_t max_capacity; /**< Upper bound the dense storage may grow to */
+    // Touched by structural changes and bookkeeping only
+    uint32_t pages_used;     /**< Number of sparse pages actually allocated */
+    uint32_t tombstones;     /**< Dense entries that are SPS_TOMBSTONE */
+    uint32_t advice;         /**< sps_advice_t applied to the dense storage */
+    size_t alignment;        /**< Alignment of the component storage and of each component */
+    uint8_t** blocks;        /**< Component blocks of a paged set, or NULL */
+    uint32_t block_bits;     /**< Log2 of the number of components per block of a paged set */
+    void* scratch;           /**< Reusable workspace for sorting, grown on demand */
+    size_t scratch_size;     /**< Size of the scratch workspace in bytes */
+    uint8_t* marks;          /**< Per dense slot state bits, allocated once tracking is on */
+    uint32_t* dirty;         /**< Entity indices that may be out of order since the last sort */
+    uint32_t dirty_count;    /**< Number of entries in dirty */
+    uint32_t dirty_capacity; /**< Number of entries allocated for dirty */
+    uint32_t* changed;         /**< Entity indices added or modified since the last clear */
+    uint32_t changed_count;    /**< Number of entries in changed */
+    uint32_t changed_capacity; /**< Number of entries allocated for changed */
+    uint32_t* removed;         /**< Entity indices removed since the last clear */
+    uint32_t removed_count;    /**< Number of entries in removed */
+    uint32_t removed_capacity; /**< Number of entries allocated for removed */
+    struct sps_group* group;   /**< Owning group of the set, or NULL */
+    sps_allocator_t allocator; /**< Allocator backing every block of the set */
+    bool scratch_borrowed;     /**< The scratch workspace belongs to the caller */
+    uint32_t partitioned;      /**< Open sps_partition calls, structural changes are refused */
+    void* mapping;             /**< File mapping backing the storage of a read-only set, or NULL */
+    size_t mapping_size;       /**< Size of the file mapping in bytes */
+#ifdef SPS_ENABLE_STATS
+    sps_counters_t stats; /**< Usage counters, see sps_stats */
+#endif
 } sparse_set_t;
 
+/**
+ * @brief Creation parameters of a sparse set
+ *
+ * Zero initialized members select the defaults, so only the members of
+ * interest need to be named in a designated initializer.
+ */
+typedef struct sps_desc {
+    size_t component_size;            /**< Size of each component in bytes */
+    size_t initial_capacity;          /**< Number of components to allocate up front */
+    size_t max_capacity;              /**< Maximum number of components, 0 for SPARSE_SET_MAX */
+    const sps_field_t* fields;        /**< Field layout for structure-of-arrays storage, or NULL */
+    size_t field_count;               /**< Number of entries in fields */
+    const sps_allocator_t* allocator; /**< Allocator to use, or NULL for malloc and free */
+    void* workspace;                  /**< Caller owned sort workspace, see sps_attach_workspace */
+    size_t workspace_size;            /**< Size of workspace in bytes */
+    size_t alignment;                 /**< Component alignment, see sps_new_aligned, 0 for default */
+    size_t block_length;              /**< Components per storage block, see sps_new_paged, 0 for one array */
+} sps_desc_t;
+
+/**
+ * @brief Owning group of sets kept co-sorted for lookup free joins
+ *
+ * Entities that have a component in every member set occupy the first size
+ * dense positions of each member, in the same order. The group is kept up
+ * to date by sps_add and sps_remove on the members, so walking the prefix
+ * visits matching components of all members in parallel arrays without any
+ * sparse lookup.
+ */
+typedef struct sps_group {
+    sparse_set_t* sets[SPS_GROUP_MAX_SETS]; /**< Member sets */
+    uint32_t set_count;                     /**< Number of entries in sets */
+    uint32_t size;                          /**< Number of entities in every member */
+} sps_group_t;
+
 /**
  * @brief Iterator for sparse set traversal
  *
@@ -39,9 +287,121 @@ typedef struct sparse_set {
  */
 typedef struct sparse_set_iter {
     sparse_set_t* set; /**< Set being iterated */
-    uint16_t index;    /**< Current iteration index */
+    uint32_t index;    /**< Current iteration index */
 } sparse_set_iter_t;
 
+/**
+ * @brief Iterator over the components changed since the last sps_changes_clear
+ */
+typedef struct sps_change_iter {
+    sparse_set_t* set; /**< Set being iterated */
+    uint32_t index;    /**< Current position in the change list */
+} sps_change_iter_t;
+
+/**
+ * @brief Pack an entity index and generation into a handle
+ *
+ * @param index Entity index
+ * @param generation Generation of the entity
+ * @return Packed handle
+ */
+static inline sps_handle_t sps_handle_make(uint32_t index, uint32_t generation) {
+    return ((sps_handle_t)generation << 32) | index;
+}
+
+/**
+ * @brief Get the entity index of a handle
+ *
+ * @param handle Packed handle
+ * @return Entity index stored in the low 32 bits
+ */
+static inline uint32_t sps_handle_index(sps_handle_t handle) {
+    return (uint32_t)handle;
+}
+
+/**
+ * @brief Get the generation of a handle
+ *
+ * @param handle Packed handle
+ * @return Generation stored in the high 32 bits
+ */
+static inline uint32_t sps_handle_generation(sps_handle_t handle) {
+    return (uint32_t)(handle >> 32);
+}
+
+/**
+ * @brief Contiguous run of the dense arrays
+ *
+ * entities[i] is the entity index of the component at
+ * (uint8_t*)components + i * component_size, for i in [0, count). Both point
+ * straight into the set's packed storage, so a loop over a span is a plain
+ * array walk the compiler can vectorize. Each component is aligned to the
+ * alignment of the set. Spans stay valid until the next
+ * structural change of the set (add, remove, sort or clear).
+ *
+ * Spans handed out by sps_iter_next_span never contain tombstones; spans of
+ * sps_span and sps_range do while the set has any, with an entity of
+ * SPS_TOMBSTONE.
+ *
+ * Spans of a structure-of-arrays set have no components pointer; the fields
+ * of the run start at position begin of each column. Neither do spans of
+ * sps_span and sps_range on a paged set, whose components are contiguous
+ * within a block only; sps_iter_next_span ends its spans at block
+ * boundaries instead, so a range is walked by starting an iterator at its
+ * begin and passing the remaining length as max.
+ */
+typedef struct sparse_set_span {
+    uint32_t* entities; /**< Entity indices of the run */
+    void* components;   /**< First component of the run */
+    size_t begin;       /**< Dense position of the first element */
+    size_t count;       /**< Number of elements in the run */
+} sparse_set_span_t;
+
+/** @brief Maximum number of sets a view can join */
+#define SPS_VIEW_MAX_SETS (8)
+
+/** @brief Maximum number of entities produced by one view block */
+#define SPS_VIEW_BLOCK (64)
+
+/**
+ * @brief Join over several sets, yielding entities present in all of them
+ *
+ * The view walks the dense array of its smallest set, the driver, and probes
+ * the other sets for each candidate. It holds no copy of the sets and is
+ * invalidated by any structural change to one of them.
+ */
+typedef struct sps_view {
+    sparse_set_t* sets[SPS_VIEW_MAX_SETS]; /**< Joined sets, in the caller's order */
+    uint32_t set_count;                    /**< Number of entries in sets */
+    uint32_t driver;                       /**< Entry of sets whose dense array is walked */
+    uint32_t position;                     /**< Next dense position of the driver */
+} sps_view_t;
+
+/**
+ * @brief Batch of entities produced by sps_view_next_block
+ *
+ * components[s][i] is the component of entities[i] in the view's set s.
+ */
+typedef struct sps_view_block {
+    size_t count;                                        /**< Number of entities in the block */
+    uint32_t entities[SPS_VIEW_BLOCK];                   /**< Entity indices of the block */
+    void* components[SPS_VIEW_MAX_SETS][SPS_VIEW_BLOCK]; /**< Component pointers per set */
+} sps_view_block_t;
+
+/**
+ * @brief Buffer of deferred add, replace and remove operations on one set
+ *
+ * Opaque; created with sps_commands_new and applied with sps_flush.
+ */
+typedef struct sps_commands sps_commands_t;
+
+/**
+ * @brief Set shared between one writer thread and any number of reader threads
+ *
+ * Opaque; created with sps_shared_new.
+ */
+typedef struct sps_shared sps_shared_t;
+
 /**
  * @brief Function type for custom component sorting
  *
@@ -52,6 +412,37 @@ typedef struct sparse_set_iter {
  */
 typedef int (*sps_sort_func_t)(const void* c1, const void* c2, void* ctx);
 
+/**
+ * @brief Body of a parallel task
+ *
+ * @param task Shared state of all tasks of the batch
+ * @param index Index of the task within the batch
+ */
+typedef void (*sps_task_func_t)(void* task, size_t index);
+
+/**
+ * @brief Hook into the caller's job system for parallel operations
+ *
+ * The library never creates threads; it hands batches of independent tasks
+ * to run and waits for them there.
+ */
+typedef struct sps_scheduler {
+    /** Call func(task, i) once for every i below count, on any threads and in
+     *  any order, and return only after all of the calls returned */
+    void (*run)(sps_task_func_t func, void* task, size_t count, void* ctx);
+    size_t workers; /**< Number of tasks that can run at the same time */
+    void* ctx;      /**< User context passed to run */
+} sps_scheduler_t;
+
+/**
+ * @brief Type of a sort key embedded in a component
+ */
+typedef enum sps_key_type {
+    SPS_KEY_U32, /**< uint32_t key */
+    SPS_KEY_I32, /**< int32_t key */
+    SPS_KEY_F32, /**< float key; -0.0f sorts before 0.0f and NaNs sort by their bits */
+} sps_key_type_t;
+
 /**
  * @brief Get next component from iterator
  *
@@ -59,7 +450,28 @@ typedef int (*sps_sort_func_t)(const void* c1, const void* c2, void* ctx);
  * @param index Pointer to receive the entity index (can be NULL if not needed)
  * @return Pointer to the next component data, or NULL if iteration is complete
  */
-void* sps_iter_next(sparse_set_iter_t* iter, uint16_t* index);
+void* sps_iter_next(sparse_set_iter_t* iter, uint32_t* index);
+
+/**
+ * @brief Get the next run of components from an iterator
+ *
+ * Hands out the remaining dense storage in chunks instead of one component
+ * at a time. Can be mixed with sps_iter_next on the same iterator.
+ *
+ * @param iter Pointer to iterator instance
+ * @param max Maximum number of elements per span, or 0 for no limit
+ * @param span Receives the next span
+ * @return true if a non-empty span was produced, false if iteration is complete
+ */
+bool sps_iter_next_span(sparse_set_iter_t* iter, size_t max, sparse_set_span_t* span);
+
+/**
+ * @brief Get the whole dense storage of a set as a single span
+ *
+ * @param set Sparse set to view
+ * @return Span covering every component in the set
+ */
+sparse_set_span_t sps_span(sparse_set_t* set);
 
 /**
  * @brief Create new iterator for the given set
@@ -69,6 +481,85 @@ void* sps_iter_next(sparse_set_iter_t* iter, uint16_t* index);
  */
 sparse_set_iter_t sps_iter_new(sparse_set_t* set);
 
+/**
+ * @brief Split the dense storage into disjoint ranges for parallel processing
+ *
+ * Produces up to max_ranges spans that together cover the set exactly once,
+ * with sizes as even as possible. Where the ranges are long enough their
+ * boundaries fall on multiples of 64 bytes from the start of the component
+ * storage (and of every column), which keeps workers off each other's cache
+ * lines. The spans can be handed to different threads, which may read and
+ * write the components in them without synchronization.
+ *
+ * Until the matching sps_partition_end no structural change (add, remove,
+ * sort or flush) may happen on the set; debug builds report one as an error.
+ *
+ * @param set Sparse set to split
+ * @param max_ranges Maximum number of ranges to produce
+ * @param ranges Receives the ranges (max_ranges entries)
+ * @return Number of non-empty ranges written
+ */
+size_t sps_partition(sparse_set_t* set, size_t max_ranges, sparse_set_span_t* ranges);
+
+/**
+ * @brief End a partitioned phase started by sps_partition
+ *
+ * @param set Sparse set that was partitioned
+ */
+void sps_partition_end(sparse_set_t* set);
+
+/**
+ * @brief Get a window of the dense storage as a span
+ *
+ * @param set Sparse set to view
+ * @param begin First dense position of the window
+ * @param end One past the last dense position, clamped to the set's count
+ * @return Span covering [begin, end), empty if begin is past the end
+ */
+sparse_set_span_t sps_range(sparse_set_t* set, size_t begin, size_t end);
+
+/**
+ * @brief Create a view over the entities present in every one of the sets
+ *
+ * The set with the fewest components is chosen as the driver, so the work
+ * of a full pass is proportional to the smallest set.
+ *
+ * @param sets Sets to join (set_count entries, none NULL)
+ * @param set_count Number of sets, from 1 to SPS_VIEW_MAX_SETS
+ * @return Initialized view positioned at the start; a view over no sets
+ *         yields nothing
+ */
+sps_view_t sps_view_new(sparse_set_t* const* sets, size_t set_count);
+
+/**
+ * @brief Get the next entity of a view
+ *
+ * Sparse slots of the candidates a few positions ahead are prefetched in
+ * every probed set while the current candidate is checked.
+ *
+ * @param view Pointer to view instance
+ * @param index Pointer to receive the entity index (can be NULL if not needed)
+ * @param components Receives one component pointer per set, in the order the
+ *        sets were given to sps_view_new
+ * @return true if an entity was produced, false if iteration is complete
+ */
+bool sps_view_next(sps_view_t* view, uint32_t* index, void** components);
+
+/**
+ * @brief Get the next block of entities of a view
+ *
+ * Takes up to SPS_VIEW_BLOCK candidates from the driver and probes them one
+ * set at a time, prefetching each set's slots a fixed distance ahead of the
+ * reads, so the lookups of a block overlap instead of stalling one after
+ * another. Candidates missing from a set are not probed in the later sets.
+ * Can be mixed with sps_view_next on the same view.
+ *
+ * @param view Pointer to view instance
+ * @param block Receives the entities and their components
+ * @return true if a non-empty block was produced, false if iteration is complete
+ */
+bool sps_view_next_block(sps_view_t* view, sps_view_block_t* block);
+
 /**
  * @brief Get the number of entities in the sparse set
  *
@@ -80,9 +571,12 @@ sparse_set_iter_t sps_iter_new(sparse_set_t* set);
 size_t sps_count(const sparse_set_t* set);
 
 /**
- * @brief Sort components using insertion sort algorithm
+ * @brief Sort components using a stable merge sort
  *
  * Rearranges components and maintains entity-component associations.
+ * Runs in O(n log n) comparisons and permutes the dense and component arrays
+ * in place. The index workspace is kept by the set and reused, so repeated
+ * sorts only allocate when the set has grown since the previous sort.
  *
  * @param set Sparse set to sort
  * @param compare Comparison function for ordering components
@@ -90,6 +584,186 @@ size_t sps_count(const sparse_set_t* set);
  */
 void sps_sort(sparse_set_t* set, sps_sort_func_t compare, void* context);
 
+/**
+ * @brief Sort components on several threads of a job system
+ *
+ * Sorts slices of the set in parallel, merges them in parallel rounds that
+ * split every merge by output position, then gathers and stores the
+ * components in parallel. The result is the same order sps_sort produces,
+ * whatever the number of workers or the order the tasks run in. Unlike
+ * sps_sort the permutation is applied out of place, so the workspace also
+ * holds a copy of every component. Sets too small to be worth splitting,
+ * or for which that workspace cannot be allocated, are sorted by sps_sort.
+ *
+ * @param set Sparse set to sort
+ * @param compare Comparison function, called concurrently from several threads
+ * @param context User context passed to comparison function
+ * @param scheduler Runs the tasks, or NULL to sort on the calling thread
+ */
+void sps_sort_parallel(sparse_set_t* set,
+                       sps_sort_func_t compare,
+                       void* context,
+                       const sps_scheduler_t* scheduler);
+
+/**
+ * @brief Sort components by a 32-bit key stored inside each component
+ *
+ * Extracts the key at key_offset and runs a stable LSD radix sort, so no
+ * comparator is called. Passes over digits that are identical for every key
+ * are skipped. The result is the same order sps_sort produces with a
+ * comparator on that key.
+ *
+ * @param set Sparse set to sort
+ * @param key_offset Byte offset of the key within the component (need not be aligned)
+ * @param key_type Type of the key
+ */
+void sps_sort_by_key(sparse_set_t* set, size_t key_offset, sps_key_type_t key_type);
+
+/**
+ * @brief Reorder a set to follow the dense order of another set
+ *
+ * Entities present in both sets move to the front of target, in the order
+ * they have in reference, so the first positions of both can be walked in
+ * lockstep without lookups. The other entities of target follow in their
+ * previous relative order. Runs in O(count) of both sets with no
+ * comparator calls. Incremental sorts of target start over with a full
+ * sort afterwards.
+ *
+ * @param target Sparse set to reorder
+ * @param reference Sparse set whose order is copied, left unchanged
+ * @return Number of entities present in both sets
+ */
+size_t sps_sort_as(sparse_set_t* target, const sparse_set_t* reference);
+
+/**
+ * @brief Restore sorted order by re-inserting only the changed components
+ *
+ * The first call sorts the whole set and enables SPS_TRACK_ORDER. From then
+ * on sps_add, sps_add_or_replace, sps_remove and sps_mark_dirty record which
+ * components may be out of place, and later calls sort only those and merge
+ * them into the rest. Comparisons scale with the number of changes, and
+ * components only move as far as their sort position changed. Falls back
+ * to a full sort when a large part of the set changed.
+ *
+ * Every sort of the set must use the same ordering for the result to be
+ * sorted. Changed components are placed after unchanged ones with an equal
+ * key.
+ *
+ * @param set Sparse set to sort
+ * @param compare Comparison function for ordering components
+ * @param context User context passed to comparison function
+ */
+void sps_sort_incremental(sparse_set_t* set, sps_sort_func_t compare, void* context);
+
+/**
+ * @brief Flag a component whose sort key was changed in place
+ *
+ * Only needed for components modified through a pointer returned by
+ * sps_get or sps_add. Records the component as out of order when
+ * SPS_TRACK_ORDER is enabled and as modified when SPS_TRACK_CHANGES is;
+ * does nothing otherwise.
+ *
+ * @param set Sparse set containing the component
+ * @param index Entity index of the modified component
+ */
+void sps_mark_dirty(sparse_set_t* set, uint32_t index);
+
+/**
+ * @brief Enable or disable change tracking
+ *
+ * While SPS_TRACK_CHANGES is set the set keeps a list of the entities added
+ * (sps_add and friends) or modified (sps_add_or_replace on a present entity,
+ * sps_mark_dirty) and a list of the entities removed since the last
+ * sps_changes_clear. The per-slot change bits travel with the components
+ * when removals, sorts and groups move them, so the tracking stays exact
+ * whatever the dense order does. Enabling starts with nothing recorded;
+ * disabling drops the lists.
+ *
+ * Writes through a pointer returned by sps_get are not seen, report them
+ * with sps_mark_dirty.
+ *
+ * @param set Sparse set to configure
+ * @param enable Whether changes should be recorded
+ * @return false on allocation failure, tracking is then left off
+ */
+bool sps_track_changes(sparse_set_t* set, bool enable);
+
+/**
+ * @brief Enable or disable order preserving removal
+ *
+ * While SPS_STABLE_REMOVE is set a removal unlinks the entity and leaves a
+ * tombstone at its dense position instead of moving the last component
+ * into the hole, so the order established by a sort survives. Iterators and
+ * views skip tombstones, lookups never see them. sps_compact drops them in
+ * one pass; sorts, sps_partition and adds that would otherwise grow the
+ * storage compact on their own. sps_serialize and sps_snapshot leave the
+ * tombstones out and write what the compacted set would. Disabling compacts
+ * the set.
+ *
+ * @param set Sparse set to configure, not owned by a group
+ * @param enable Whether removals should preserve the order
+ * @return false if the set is read-only or owned by a group
+ */
+bool sps_stable_remove(sparse_set_t* set, bool enable);
+
+/**
+ * @brief Drop the tombstones left by stable removals
+ *
+ * Moves each live component down over the tombstones in front of it,
+ * keeping the order, in a single pass over the dense entries.
+ *
+ * @param set Sparse set to compact
+ */
+void sps_compact(sparse_set_t* set);
+
+/**
+ * @brief Start iterating over the components changed since the last clear
+ *
+ * Each changed entity is visited once, in the order it first changed. Do not
+ * add or remove entities while iterating.
+ *
+ * @param set Sparse set with change tracking enabled
+ * @return Iterator positioned at the first changed component
+ */
+sps_change_iter_t sps_changes_iter(sparse_set_t* set);
+
+/**
+ * @brief Get the next changed component
+ *
+ * Entities that were removed again after changing are skipped; they show up
+ * in sps_changes_removed if they were present at the last clear.
+ *
+ * @param iter Pointer to iterator instance
+ * @param index Pointer to receive the entity index (can be NULL if not needed)
+ * @param kind Pointer to receive the SPS_CHANGE_* bits (can be NULL if not needed)
+ * @return Pointer to the changed component, or NULL if iteration is complete
+ */
+void* sps_changes_next(sps_change_iter_t* iter, uint32_t* index, uint32_t* kind);
+
+/**
+ * @brief Get the entities removed since the last clear
+ *
+ * Only entities that were present at the last sps_changes_clear are listed.
+ * An entity removed and added again is listed here and as added. The list is
+ * incomplete when SPS_CHANGES_LOST is set.
+ *
+ * @param set Sparse set with change tracking enabled
+ * @param indices Receives a pointer to the removed entity indices, valid until
+ *        the next change of the set
+ * @return Number of removed entities
+ */
+size_t sps_changes_removed(const sparse_set_t* set, const uint32_t** indices);
+
+/**
+ * @brief Forget every recorded change
+ *
+ * Costs time proportional to the number of changes recorded, not to the
+ * size of the set.
+ *
+ * @param set Sparse set with change tracking enabled
+ */
+void sps_changes_clear(sparse_set_t* set);
+
 /**
  * @brief Check if an entity exists in the set
  *
@@ -97,7 +771,7 @@ void sps_sort(sparse_set_t* set, sps_sort_func_t compare, void* context);
  * @param index Entity index to check
  * @return true if entity exists in set, false otherwise
  */
-bool sps_has(sparse_set_t* set, uint16_t index);
+bool sps_has(sparse_set_t* set, uint32_t index);
 
 /**
  * @brief Add or replace an entity component in the sparse set
@@ -108,10 +782,13 @@ bool sps_has(sparse_set_t* set, uint16_t index);
  * @return Pointer to the component data in the set, or NULL on failure
  *         (failure can occur if the set is full when trying to add a new component)
  *
+ * Adding a new component may grow the storage, which invalidates previously
+ * returned component pointers.
+ *
  * If the entity already exists in the set, its component data will be replaced.
  * If the entity doesn't exist, it will be added to the set.
  */
-void* sps_add_or_replace(sparse_set_t* set, uint16_t index, void* component);
+void* sps_add_or_replace(sparse_set_t* set, uint32_t index, void* component);
 
 /**
  * @brief Add an entity with its component to the set
@@ -121,8 +798,23 @@ void* sps_add_or_replace(sparse_set_t* set, uint16_t index, void* component);
  * @param component Pointer to component data to copy (must be non-NULL)
  * @return Pointer to the newly added component data, or NULL on failure
  *         (failure occurs if index already exists or set is full)
+ *
+ * When the set is at capacity the storage grows geometrically up to its
+ * maximum capacity, which invalidates previously returned component pointers.
+ */
+void* sps_add(sparse_set_t* set, uint32_t index, void* component);
+
+/**
+ * @brief Add an entity and return uninitialized storage for its component
+ *
+ * Lets callers construct the component in place instead of copying it in.
+ *
+ * @param set Sparse set to modify
+ * @param index Entity index to add
+ * @return Pointer to the uninitialized component storage, or NULL on failure
+ *         (failure occurs if index already exists or set is full)
  */
-void* sps_add(sparse_set_t* set, uint16_t index, void* component);
+void* sps_emplace(sparse_set_t* set, uint32_t index);
 
 /**
  * @brief Remove an entity and its component from the set
@@ -132,7 +824,7 @@ void* sps_add(sparse_set_t* set, uint16_t index, void* component);
  * @param set Sparse set to modify
  * @param index Entity index to remove
  */
-void sps_remove(sparse_set_t* set, uint16_t index);
+void sps_remove(sparse_set_t* set, uint32_t index);
 
 /**
  * @brief Get component data for an entity
@@ -141,15 +833,839 @@ void sps_remove(sparse_set_t* set, uint16_t index);
  * @param index Entity index to look up
  * @return Pointer to component data, or NULL if entity doesn't exist in set
  */
-void* sps_get(sparse_set_t* set, uint16_t index);
+void* sps_get(sparse_set_t* set, uint32_t index);
 
 /**
- * @brief Create a new sparse set
+ * @brief Dense position of an entity, without argument validation
  *
- * @param component_size Size of each component in bytes
- * @return Pointer to newly allocated sparse set, or NULL on allocation failure
+ * Inline lookup for hot loops over a set known to be valid: no NULL check,
+ * no error reporting and no usage counters, so it compiles to a bounds
+ * check and two loads in the caller.
+ *
+ * @param set Valid sparse set
+ * @param index Entity index, SPARSE_SET_MAX included
+ * @return Dense position of the entity, or SPARSE_SET_MAX if it is absent
  */
-sparse_set_t* sps_new(size_t component_size);
+static inline uint32_t sps_lookup_unchecked(const sparse_set_t* set, uint32_t index) {
+    uint32_t page = index >> SPS_PAGE_BITS;
+    if (page >= set->page_count) {
+        return SPARSE_SET_MAX;
+    }
+
+    // An empty slot wraps around to SPARSE_SET_MAX
+    return set->sparse[page][index & (SPS_PAGE_SIZE - 1U)].dense - 1U;
+}
+
+/**
+ * @brief Inline sps_has without argument validation, see sps_lookup_unchecked
+ *
+ * @param set Valid sparse set
+ * @param index Entity index to check
+ * @return true if entity exists in set, false otherwise
+ */
+static inline bool sps_has_unchecked(const sparse_set_t* set, uint32_t index) {
+    return sps_lookup_unchecked(set, index) != SPARSE_SET_MAX;
+}
+
+/**
+ * @brief Inline sps_get without argument validation, see sps_lookup_unchecked
+ *
+ * @param set Valid sparse set
+ * @param index Entity index to look up
+ * @return Pointer to component data, or NULL if entity doesn't exist in set
+ */
+static inline void* sps_get_unchecked(const sparse_set_t* set, uint32_t index) {
+    uint32_t dense_idx = sps_lookup_unchecked(set, index);
+    if (dense_idx == SPARSE_SET_MAX) {
+        return NULL;
+    }
+
+    if (set->flags & SPS_PAGED) {
+        uint32_t mask = (1U << set->block_bits) - 1U;
+        return set->blocks[dense_idx >> set->block_bits] +
+               (size_t)(dense_idx & mask) * set->component_size;
+    }
+
+    if (set->columns != NULL) {
+        return set->columns[0].data + (size_t)dense_idx * set->columns[0].size;
+    }
+
+    return set->components + (size_t)dense_idx * set->component_size;
+}
+
+/**
+ * @brief sps_add without argument validation
+ *
+ * Skips the NULL checks and the lookup that rejects an entity already in
+ * the set. Adding still grows the storage, maps sparse pages and updates
+ * tracking and groups, so it stays out of line.
+ *
+ * @param set Valid sparse set
+ * @param index Entity index below SPARSE_SET_MAX that is not in the set
+ * @param component Pointer to component data to copy
+ * @return Pointer to the newly added component data, or NULL if the set is
+ *         full, read-only or out of memory
+ */
+void* sps_add_unchecked(sparse_set_t* set, uint32_t index, const void* component);
+
+/**
+ * @brief Add an entity component under a generational handle
+ *
+ * Components added through sps_add behave as generation 0.
+ *
+ * @param set Sparse set to modify
+ * @param handle Handle of the entity to add
+ * @param component Pointer to component data to copy (must be non-NULL)
+ * @return Pointer to the newly added component data, or NULL on failure
+ *         (failure occurs if the index already exists, under any generation,
+ *         or the set is full)
+ */
+void* sps_add_handle(sparse_set_t* set, sps_handle_t handle, void* component);
+
+/**
+ * @brief Remove the component of a handle
+ *
+ * Does nothing (and reports an error in debug builds) if the handle is stale.
+ *
+ * @param set Sparse set to modify
+ * @param handle Handle of the entity to remove
+ */
+void sps_remove_handle(sparse_set_t* set, sps_handle_t handle);
+
+/**
+ * @brief Check if a handle refers to a live component
+ *
+ * @param set Sparse set to query
+ * @param handle Handle to check
+ * @return true if the index exists with the same generation, false otherwise
+ */
+bool sps_has_handle(sparse_set_t* set, sps_handle_t handle);
+
+/**
+ * @brief Get component data for a handle
+ *
+ * @param set Sparse set to query
+ * @param handle Handle to look up
+ * @return Pointer to component data, or NULL if the index is absent or was
+ *         added under a different generation
+ */
+void* sps_get_handle(sparse_set_t* set, sps_handle_t handle);
+
+/**
+ * @brief Get the current handle of an entity index
+ *
+ * @param set Sparse set to query
+ * @param index Entity index to look up
+ * @return Handle with the generation the component was added with, or
+ *         SPS_HANDLE_INVALID if the index is not in the set
+ */
+sps_handle_t sps_handle(sparse_set_t* set, uint32_t index);
+
+/**
+ * @brief Add a batch of entities with their components
+ *
+ * Arguments and capacity are validated once for the whole batch, storage is
+ * grown at most once and the components are copied with a single memcpy
+ * into the contiguous slots at the end of the dense array.
+ *
+ * @param set Sparse set to modify
+ * @param indices Entity indices to add (n entries)
+ * @param n Number of entities to add
+ * @param components Contiguous array of n components, in the order of indices
+ * @return Pointer to the first added component, the others follow it
+ *         contiguously unless the set is owned by a group, which may move
+ *         them into its prefix; NULL on failure, in which case the set is unchanged
+ *         (failure occurs if any index already exists or repeats, or the set
+ *         cannot hold n more components)
+ */
+void* sps_add_many(sparse_set_t* set, const uint32_t* indices, size_t n, const void* components);
+
+/**
+ * @brief Remove a batch of entities and their components
+ *
+ * @param set Sparse set to modify
+ * @param indices Entity indices to remove (n entries)
+ * @param n Number of entities to remove
+ * @return Number of entities removed; indices that are not in the set are skipped
+ */
+size_t sps_remove_many(sparse_set_t* set, const uint32_t* indices, size_t n);
+
+/**
+ * @brief Remove every entity and component, keeping the storage for reuse
+ *
+ * Only the sparse slots of the live entities are reset, so the cost follows
+ * the count rather than the index range or the capacity. Removals are
+ * reported to change tracking as usual and an owning group becomes empty.
+ *
+ * @param set Sparse set to clear
+ */
+void sps_clear(sparse_set_t* set);
+
+/**
+ * @brief Look up components for a batch of entities
+ *
+ * Sparse slots are prefetched ahead of the lookups, which hides most of the
+ * cache misses of random indices.
+ *
+ * @param set Sparse set to query
+ * @param indices Entity indices to look up (n entries)
+ * @param n Number of entities to look up
+ * @param out Receives a component pointer per index, NULL for missing ones
+ * @return Number of indices found in the set
+ */
+size_t sps_get_many(sparse_set_t* set, const uint32_t* indices, size_t n, void** out);
+
+/**
+ * @brief Copy components for a batch of entities into a contiguous buffer
+ *
+ * Sparse slots and then the components themselves are prefetched in a
+ * software pipeline ahead of the copies.
+ *
+ * @param set Sparse set to query
+ * @param indices Entity indices to look up (n entries)
+ * @param n Number of entities to look up
+ * @param out Buffer of n components; entries of missing indices are zeroed
+ * @return Number of indices found in the set
+ */
+size_t sps_copy_many(sparse_set_t* set, const uint32_t* indices, size_t n, void* out);
+
+/**
+ * @brief Test a batch of entities for membership
+ *
+ * On x86-64 CPUs with AVX2 the sparse slots are fetched four at a time with
+ * gather loads, otherwise one at a time with the same prefetching as
+ * sps_get_many.
+ *
+ * @param set Sparse set to query
+ * @param indices Entity indices to test (n entries)
+ * @param n Number of entities to test
+ * @param out Bitmask of (n + 63) / 64 words; bit i % 64 of out[i / 64] is set if
+ *        indices[i] is in the set, unused bits of the last word are cleared
+ * @return Number of indices found in the set
+ */
+size_t sps_has_many(sparse_set_t* set, const uint32_t* indices, size_t n, uint64_t* out);
+
+/**
+ * @brief Get the number of bitmap words that cover every index of the set
+ *
+ * @param set Pointer to the sparse set (must not be NULL)
+ * @return Number of uint64_t words sps_bitmap_export needs to miss no entity
+ */
+size_t sps_bitmap_words(const sparse_set_t* set);
+
+/**
+ * @brief Export the presence bitmap of a set
+ *
+ * Bit i % 64 of bits[i / 64] is set if entity i is in the set. Entities that
+ * do not fit in words words are left out. Costs one pass over the bitmap and
+ * one over the dense array, so intersecting sets becomes sps_bitmap_and on
+ * their bitmaps followed by sps_bitmap_indices.
+ *
+ * @param set Sparse set to export
+ * @param bits Bitmap to fill, cleared first
+ * @param words Number of words in bits
+ * @return Number of entities set in the bitmap
+ */
+size_t sps_bitmap_export(const sparse_set_t* set, uint64_t* bits, size_t words);
+
+/**
+ * @brief Intersect a bitmap with another one in place
+ *
+ * @param dst Bitmap to intersect, receives dst & src
+ * @param src Bitmap to intersect with
+ * @param words Number of words in both bitmaps
+ * @return Number of bits set in the result
+ */
+size_t sps_bitmap_and(uint64_t* dst, const uint64_t* src, size_t words);
+
+/**
+ * @brief List the set bits of a bitmap in ascending order
+ *
+ * @param bits Bitmap to walk
+ * @param words Number of words in bits
+ * @param out Receives one index per set bit, as many as sps_bitmap_and or
+ *        sps_bitmap_export reported
+ * @return Number of indices written
+ */
+size_t sps_bitmap_indices(const uint64_t* bits, size_t words, uint32_t* out);
+
+/**
+ * @brief Reserve storage for at least the given number of components
+ *
+ * Growing ahead of time keeps subsequent sps_add calls free of reallocation.
+ *
+ * @param set Sparse set to grow
+ * @param capacity Number of components the set must be able to hold
+ * @return true if the set can hold capacity components, false if capacity
+ *         exceeds the maximum capacity or allocation failed
+ */
+bool sps_reserve(sparse_set_t* set, size_t capacity);
+
+/**
+ * @brief Get the number of components the set can hold without growing
+ *
+ * @param set Pointer to the sparse set (must not be NULL)
+ * @return Number of allocated component slots
+ */
+size_t sps_capacity(const sparse_set_t* set);
+
+/**
+ * @brief Paging hint for the dense storage of a set
+ */
+typedef enum sps_advice {
+    SPS_ADVICE_NORMAL,     /**< No hint, drops an earlier sequential hint */
+    SPS_ADVICE_SEQUENTIAL, /**< The storage is scanned front to back, read ahead aggressively */
+    SPS_ADVICE_HUGE_PAGES, /**< Back the storage with transparent huge pages where possible */
+} sps_advice_t;
+
+/**
+ * @brief Give the operating system a paging hint for the dense storage
+ *
+ * Applies to the whole pages inside the dense array and the component
+ * storage or columns, and is applied again each time they grow. The sparse
+ * pages are never included, so random lookups do not disturb the hint.
+ * Huge pages only cover aligned 2 MB ranges inside a block, reserve the
+ * capacity up front so the blocks are large enough. A huge page hint is not
+ * undone by a later SPS_ADVICE_NORMAL.
+ *
+ * @param set Sparse set to advise
+ * @param advice Hint to apply
+ * @return true if the hint was applied, false if the platform does not
+ *         support it or refused it
+ */
+bool sps_advise(sparse_set_t* set, sps_advice_t advice);
+
+/**
+ * @brief Get the set's reusable workspace
+ *
+ * The sort functions draw their temporary buffers from this workspace. It
+ * only grows, so repeated sorts of a set that does not grow perform no
+ * allocation. Its contents are not preserved between calls, and any sort
+ * of the set may overwrite or reallocate it.
+ *
+ * @param set Set owning the workspace
+ * @param size Number of bytes required
+ * @return Buffer of at least size bytes aligned for any type, or NULL on allocation failure
+ */
+void* sps_workspace(sparse_set_t* set, size_t size);
+
+/**
+ * @brief Hand the set a caller owned buffer to use as its workspace
+ *
+ * Replaces and releases the set's own workspace. Sorts that fit in the
+ * buffer make no allocator calls; a sort that needs more allocates a larger
+ * workspace from the set's allocator instead. The buffer must stay valid
+ * until it is replaced or the set is freed, and is never released by the set.
+ *
+ * @param set Set to modify
+ * @param buffer Buffer aligned for any type, or NULL to drop the workspace
+ * @param size Size of buffer in bytes
+ */
+void sps_attach_workspace(sparse_set_t* set, void* buffer, size_t size);
+
+/**
+ * @brief Get the number of bytes currently allocated by the set
+ *
+ * Includes the page directory, the touched sparse pages and the dense and
+ * component storage.
+ *
+ * @param set Pointer to the sparse set (must not be NULL)
+ * @return Allocated size in bytes
+ */
+size_t sps_memory_usage(const sparse_set_t* set);
+
+/**
+ * @brief Read the usage counters of a set
+ *
+ * Counters are only collected when the library is built with
+ * SPS_ENABLE_STATS; other builds pay nothing for them and report zeros.
+ * Lookups on a set shared between readers are all counted.
+ *
+ * @param set Pointer to the sparse set (must not be NULL)
+ * @param stats Receives the counters
+ * @return true if the counters are collected, false otherwise
+ */
+bool sps_stats(const sparse_set_t* set, sps_stats_t* stats);
+
+/**
+ * @brief Reset the usage counters of a set
+ *
+ * The peak count restarts from the current count.
+ *
+ * @param set Pointer to the sparse set (must not be NULL)
+ */
+void sps_stats_reset(sparse_set_t* set);
+
+/**
+ * @brief Create a new sparse set from a descriptor
+ *
+ * Every block of the set, including the set itself, comes from the
+ * descriptor's allocator.
+ *
+ * @param desc Creation parameters
+ * @return Pointer to newly allocated sparse set, or NULL on invalid arguments
+ *         or allocation failure
+ */
+sparse_set_t* sps_new_desc(const sps_desc_t* desc);
+
+/**
+ * @brief Create a new sparse set with explicit capacity bounds
+ *
+ * The dense and component arrays start with room for initial_capacity
+ * components and double in size whenever they fill up, never exceeding
+ * max_capacity.
+ *
+ * @param component_size Size of each component in bytes
+ * @param initial_capacity Number of components to allocate up front (may be 0)
+ * @param max_capacity Maximum number of components (at most SPARSE_SET_MAX)
+ * @return Pointer to newly allocated sparse set, or NULL on invalid arguments
+ *         or allocation failure
+ */
+sparse_set_t* sps_new_ex(size_t component_size, size_t initial_capacity, size_t max_capacity);
+
+/**
+ * @brief Create a new sparse set
+ *
+ * Equivalent to sps_new_ex(component_size, SPS_DEFAULT_CAPACITY, SPARSE_SET_MAX).
+ *
+ * @param component_size Size of each component in bytes
+ * @return Pointer to newly allocated sparse set, or NULL on allocation failure
+ */
+sparse_set_t* sps_new(size_t component_size);
+
+/**
+ * @brief Create a new sparse set whose components are aligned for SIMD loads
+ *
+ * The component storage starts on a multiple of alignment, and since
+ * component_size must itself be a multiple of alignment every component
+ * does too, as it would in an array of a type declared with
+ * _Alignas(alignment). The guarantee holds across growth and for every
+ * pointer and span the set hands out. Structure-of-arrays sets created
+ * through sps_new_desc align the start of each column instead.
+ *
+ * @param component_size Size of each component in bytes, a multiple of alignment
+ * @param alignment Power of two up to SPS_ALIGN_MAX, e.g. 16, 32 or 64
+ * @return Pointer to newly allocated sparse set, or NULL on invalid arguments
+ *         or allocation failure
+ */
+sparse_set_t* sps_new_aligned(size_t component_size, size_t alignment);
+
+/**
+ * @brief Create a new sparse set whose components never move as it grows
+ *
+ * Components are stored in blocks of block_length components, addressed by
+ * dense position, and growing the set only allocates more blocks. Pointers
+ * returned by sps_add, sps_get and friends therefore stay valid across any
+ * number of adds, until the component itself is moved: by a removal that
+ * fills the hole with it (never under sps_stable_remove), or by a sort,
+ * compaction or clear. Paged sets are always stored as an array of
+ * structures.
+ *
+ * @param component_size Size of each component in bytes
+ * @param block_length Components per block, a power of two
+ * @return Pointer to newly allocated sparse set, or NULL on invalid arguments
+ *         or allocation failure
+ */
+sparse_set_t* sps_new_paged(size_t component_size, size_t block_length);
+
+/**
+ * @brief Create a sparse set that stores each component field in its own column
+ *
+ * Components are still passed in and out as structs of component_size bytes,
+ * but each field is scattered into a separate dense column kept in lockstep
+ * with the dense array, so a loop touching a few fields only streams those
+ * columns. Bytes of the component not covered by a field are not stored.
+ *
+ * Functions that return a component pointer (sps_add, sps_get, sps_iter_next,
+ * ...) return the entity's element of the first column instead; use
+ * sps_get_field or sps_column to reach the fields. Sort comparators still
+ * receive whole components, gathered from the columns.
+ *
+ * @param component_size Size of the component struct in bytes
+ * @param fields Layout of the fields within the component (field_count entries)
+ * @param field_count Number of fields, at least 1
+ * @return Pointer to newly allocated sparse set, or NULL on invalid arguments
+ *         or allocation failure
+ */
+sparse_set_t* sps_new_soa(size_t component_size, const sps_field_t* fields, size_t field_count);
+
+/**
+ * @brief Get the dense column of a field
+ *
+ * The column holds sps_count(set) packed values of the field's size, in the
+ * same order as the entities of sps_span.
+ *
+ * @param set Structure-of-arrays set to query
+ * @param field Index of the field in the layout the set was created with
+ * @return First element of the column, or NULL if the set has no such field
+ */
+void* sps_column(sparse_set_t* set, size_t field);
+
+/**
+ * @brief Get one field of an entity's component
+ *
+ * @param set Structure-of-arrays set to query
+ * @param index Entity index to look up
+ * @param field Index of the field in the layout the set was created with
+ * @return Pointer to the field, or NULL if the entity doesn't exist in set
+ */
+void* sps_get_field(sparse_set_t* set, uint32_t index, size_t field);
+
+/**
+ * @brief Create a command buffer for deferred changes to a set
+ *
+ * Recording only copies the operation into a preallocated slot claimed
+ * with an atomic increment, so any number of threads can record at once,
+ * and recording while iterating the set is safe. The buffer is allocated
+ * from the set's allocator.
+ *
+ * @param set Set the commands will be applied to
+ * @param capacity Maximum number of commands recorded between flushes
+ * @return Pointer to newly allocated command buffer, or NULL on invalid
+ *         arguments or allocation failure
+ */
+sps_commands_t* sps_commands_new(sparse_set_t* set, size_t capacity);
+
+/**
+ * @brief Record a deferred sps_add
+ *
+ * @param commands Command buffer to record into
+ * @param index Entity index to add
+ * @param component Component data, copied into the buffer
+ * @return true if recorded, false if the buffer is full
+ */
+bool sps_defer_add(sps_commands_t* commands, uint32_t index, const void* component);
+
+/**
+ * @brief Record a deferred sps_add_or_replace
+ *
+ * @param commands Command buffer to record into
+ * @param index Entity index to add or update
+ * @param component Component data, copied into the buffer
+ * @return true if recorded, false if the buffer is full
+ */
+bool sps_defer_add_or_replace(sps_commands_t* commands, uint32_t index, const void* component);
+
+/**
+ * @brief Record a deferred sps_remove
+ *
+ * @param commands Command buffer to record into
+ * @param index Entity index to remove
+ * @return true if recorded, false if the buffer is full
+ */
+bool sps_defer_remove(sps_commands_t* commands, uint32_t index);
+
+/**
+ * @brief Apply and clear the recorded commands
+ *
+ * Commands are grouped by entity index with a radix sort, which keeps the
+ * writes to the sparse pages in address order, and the commands of each
+ * entity are folded into at most one change: an add followed by a remove
+ * cancels out, and only the last written value is copied into the set.
+ * The set ends up with the same entities and values as applying the
+ * commands one by one in the order their slots were claimed, but not
+ * necessarily the same dense order or change records: a remove followed by
+ * an add of an entity already present becomes a replace, which keeps its
+ * dense position and is recorded as a modification. Must not run
+ * concurrently with recording.
+ *
+ * @param commands Command buffer to apply
+ * @return Number of commands consumed
+ */
+size_t sps_flush(sps_commands_t* commands);
+
+/**
+ * @brief Free a command buffer, discarding commands not yet flushed
+ *
+ * @param commands Command buffer to free
+ */
+void sps_commands_free(sps_commands_t* commands);
+
+/**
+ * @brief Create a set for one writer and concurrent wait-free readers
+ *
+ * Keeps two instances of the set (the left-right scheme). Readers always
+ * use the published instance, while the writer changes the other one and
+ * logs each change. sps_shared_publish swaps the instances, waits for the
+ * readers still on the old one to leave, and replays the log onto it, so
+ * a mutation costs two O(1) set operations plus a log entry and readers
+ * never block or retry.
+ *
+ * @param desc Creation parameters of both instances; desc->workspace is ignored
+ * @param log_capacity Changes the writer can make between two publishes;
+ *        a full log is published automatically
+ * @return Pointer to newly allocated shared set, or NULL on invalid
+ *         arguments or allocation failure
+ */
+sps_shared_t* sps_shared_new(const sps_desc_t* desc, size_t log_capacity);
+
+/**
+ * @brief Add an entity to a shared set (writer thread only)
+ *
+ * The change becomes visible to readers with the next sps_shared_publish.
+ *
+ * @param shared Shared set to modify
+ * @param index Entity index to add
+ * @param component Pointer to component data to copy (must be non-NULL)
+ * @return false if the index already exists or the set is full
+ */
+bool sps_shared_add(sps_shared_t* shared, uint32_t index, void* component);
+
+/**
+ * @brief Add or replace an entity component in a shared set (writer thread only)
+ *
+ * @param shared Shared set to modify
+ * @param index Entity index to add or update
+ * @param component Pointer to component data to copy (must be non-NULL)
+ * @return false if the set is full
+ */
+bool sps_shared_add_or_replace(sps_shared_t* shared, uint32_t index, void* component);
+
+/**
+ * @brief Remove an entity from a shared set (writer thread only)
+ *
+ * @param shared Shared set to modify
+ * @param index Entity index to remove
+ * @return false if the index is not in the set
+ */
+bool sps_shared_remove(sps_shared_t* shared, uint32_t index);
+
+/**
+ * @brief Make the writer's changes visible to readers (writer thread only)
+ *
+ * Waits until no reader is left on the instance being retired. The writer
+ * must not hold a read section of the same set while publishing.
+ *
+ * @param shared Shared set to publish
+ */
+void sps_shared_publish(sps_shared_t* shared);
+
+/**
+ * @brief Enter a read section of a shared set
+ *
+ * Wait-free. The returned set is a consistent published version that stays
+ * unchanged until the matching sps_read_end; it must only be read, with any
+ * of the functions that do not modify a set.
+ *
+ * @param shared Shared set to read
+ * @param token Receives the value to pass to sps_read_end
+ * @return Published instance of the set
+ */
+sparse_set_t* sps_read_begin(sps_shared_t* shared, uint32_t* token);
+
+/**
+ * @brief Leave a read section of a shared set
+ *
+ * @param shared Shared set that was read
+ * @param token Value returned through sps_read_begin
+ */
+void sps_read_end(sps_shared_t* shared, uint32_t token);
+
+/**
+ * @brief Free a shared set
+ *
+ * No reader may be inside a read section.
+ *
+ * @param shared Shared set to free
+ */
+void sps_shared_free(sps_shared_t* shared);
+
+/**
+ * @brief Create an owning group over sets
+ *
+ * Entities already present in every set are moved to the front of each
+ * set. From then on adds and removes on a member swap the entity into or
+ * out of the shared prefix, at the cost of a lookup in every other member.
+ * Members cannot be sorted while they are owned. The group is allocated
+ * from the first set's allocator.
+ *
+ * @param sets Sets to own (set_count entries, distinct and not owned by another group)
+ * @param set_count Number of sets, from 1 to SPS_GROUP_MAX_SETS
+ * @return Pointer to newly allocated group, or NULL on invalid arguments
+ *         or allocation failure
+ */
+sps_group_t* sps_group_new(sparse_set_t* const* sets, size_t set_count);
+
+/**
+ * @brief Get the number of entities present in every member of a group
+ *
+ * @param group Group to query
+ * @return Length of the shared prefix
+ */
+size_t sps_group_size(const sps_group_t* group);
+
+/**
+ * @brief Get the shared prefix of one member as a span
+ *
+ * Spans of different members of the same group line up: position i holds
+ * the same entity in each of them. As with sps_span, the span of a
+ * structure-of-arrays or paged member has no components pointer; walk its
+ * blocks with sps_iter_next_span, passing what is left of the prefix as max.
+ *
+ * @param group Group to view
+ * @param set Index of the member in the order given to sps_group_new
+ * @return Span covering the group's entities in that member
+ */
+sparse_set_span_t sps_group_span(const sps_group_t* group, size_t set);
+
+/**
+ * @brief Release the member sets and free a group
+ *
+ * The members keep their current contents and order. A group must be freed
+ * before any of its members.
+ *
+ * @param group Group to free
+ */
+void sps_group_free(sps_group_t* group);
+
+/**
+ * @brief Get the number of bytes sps_serialize writes for a set
+ *
+ * @param set Sparse set to measure
+ * @return Size of the serialized set in bytes
+ */
+size_t sps_serialized_size(const sparse_set_t* set);
+
+/**
+ * @brief Write a set to a buffer in the binary format
+ *
+ * The format is a header followed by the dense array, the generations when
+ * any entity has a nonzero one, and the component storage (one array per
+ * column for SoA sets). Every array starts at a multiple of
+ * SPS_FORMAT_ALIGN from the start of the buffer, so a buffer written to a
+ * file can be mapped with sps_map_file. Values are stored in host byte
+ * order; loading on a host of the other byte order fails. Tombstones left
+ * by stable removals are not written, the output matches the compacted set.
+ *
+ * @param set Sparse set to write
+ * @param buffer Destination buffer
+ * @param size Size of buffer in bytes, at least sps_serialized_size(set)
+ * @return Number of bytes written, or 0 if the buffer is too small
+ */
+size_t sps_serialize(const sparse_set_t* set, void* buffer, size_t size);
+
+/**
+ * @brief Create a set from a buffer written by sps_serialize
+ *
+ * The dense and component arrays are copied in bulk and the sparse array is
+ * rebuilt in one linear pass over the dense array.
+ *
+ * @param data Serialized set
+ * @param size Size of data in bytes
+ * @param allocator Allocator for the new set, or NULL for malloc and free
+ * @return Pointer to newly allocated sparse set, or NULL if the data is
+ *         malformed or on allocation failure
+ */
+sparse_set_t* sps_deserialize(const void* data, size_t size, const sps_allocator_t* allocator);
+
+/**
+ * @brief Map a file written from sps_serialize as a read-only set
+ *
+ * The dense and component arrays point straight into the file's pages, so
+ * nothing is copied and pages are only read in when touched; only the
+ * sparse array is built. The set has SPS_READ_ONLY set: lookups, iteration,
+ * views and change queries work, while adds, removes, replaces and sorts
+ * are refused. Components must not be written through returned pointers.
+ * sps_free unmaps the file. Only available on POSIX systems.
+ *
+ * @param path Path of the file to map
+ * @param allocator Allocator for the sparse array, or NULL for malloc and free
+ * @return Pointer to the mapped sparse set, or NULL if the file cannot be
+ *         mapped or is malformed
+ */
+sparse_set_t* sps_map_file(const char* path, const sps_allocator_t* allocator);
+
+/**
+ * @brief Get the number of bytes sps_snapshot writes for a set
+ *
+ * @param set Sparse set to measure
+ * @return Size of a snapshot of the set in bytes
+ */
+size_t sps_snapshot_size(const sparse_set_t* set);
+
+/**
+ * @brief Copy the live contents of a set into a buffer
+ *
+ * Only the live entries of the dense array, their generations and their
+ * components are copied, so the cost follows the number of entities rather
+ * than the capacity or the range of indices. Tombstones left by stable
+ * removals are skipped, the snapshot matches the compacted set. The snapshot
+ * is packed without padding and stored in host byte order.
+ *
+ * @param set Sparse set to copy
+ * @param buffer Destination buffer
+ * @param size Size of buffer in bytes, at least sps_snapshot_size(set)
+ * @return Number of bytes written, or 0 if the buffer is too small
+ */
+size_t sps_snapshot(const sparse_set_t* set, void* buffer, size_t size);
+
+/**
+ * @brief Replace the contents of a set with a snapshot
+ *
+ * The set must have the component layout the snapshot was taken with. Only
+ * the sparse slots of the entities present before and after are written;
+ * sparse pages stay allocated. The dense order is the one of the snapshot.
+ * With SPS_TRACK_ORDER the next incremental sort is a full one, and with
+ * SPS_TRACK_CHANGES every component is reported as modified and
+ * SPS_CHANGES_LOST is set. Sets owned by a group cannot be restored.
+ *
+ * @param set Sparse set to overwrite
+ * @param snapshot Snapshot written by sps_snapshot
+ * @param size Size of snapshot in bytes
+ * @return false if the snapshot is malformed or of another layout, or on
+ *         allocation failure; the set is left unchanged unless an entity
+ *         of the snapshot is invalid, which leaves it empty
+ */
+bool sps_restore(sparse_set_t* set, const void* snapshot, size_t size);
+
+/**
+ * @brief Get the largest size sps_delta_encode can produce for a snapshot
+ *
+ * @param snapshot_size Size of the snapshot to encode in bytes
+ * @return Upper bound on the size of the delta in bytes
+ */
+size_t sps_delta_bound(size_t snapshot_size);
+
+/**
+ * @brief Encode a snapshot as the difference to an earlier one
+ *
+ * Each array of the snapshot is XORed against the same array of the base
+ * (past the base's count against zero), and runs of zero bytes are stored
+ * as counts, so entities whose components did not change cost almost
+ * nothing. Both snapshots must come from sets of the same layout.
+ *
+ * @param base Earlier snapshot
+ * @param base_size Size of base in bytes
+ * @param snapshot Snapshot to encode
+ * @param size Size of snapshot in bytes
+ * @param out Destination buffer
+ * @param out_size Size of out in bytes, sps_delta_bound(size) always suffices
+ * @return Number of bytes written, or 0 on invalid snapshots or if out is too small
+ */
+size_t sps_delta_encode(const void* base,
+                        size_t base_size,
+                        const void* snapshot,
+                        size_t size,
+                        void* out,
+                        size_t out_size);
+
+/**
+ * @brief Rebuild a snapshot from the base it was encoded against and the delta
+ *
+ * @param base Snapshot passed as base to sps_delta_encode
+ * @param base_size Size of base in bytes
+ * @param delta Delta written by sps_delta_encode
+ * @param delta_size Size of delta in bytes
+ * @param out Destination buffer for the snapshot
+ * @param out_size Size of out in bytes
+ * @return Size of the rebuilt snapshot, or 0 on a malformed delta or if out is too small
+ */
+size_t sps_delta_decode(const void* base,
+                        size_t base_size,
+                        const void* delta,
+                        size_t delta_size,
+                        void* out,
+                        size_t out_size);
 
 /**
  * @brief Free a sparse set and its resources
@@ -0,0 +1,221 @@
+/**
+ * @file sps_typed.h
+ * @brief Compile-time specialized sparse set accessors
+ *
+ * SPS_DEFINE(name, T) emits static inline functions that operate on a
+ * regular sparse_set_t holding components of type T. Because sizeof(T) is
+ * known at compile time, component moves become fixed-size assignments and
+ * indexing becomes plain array arithmetic that the compiler can inline into
+ * the caller's loop. The generated functions can be mixed freely with the
+ * generic sps_* functions on the same set.
+ *
+ * @code
+ * SPS_DEFINE(transform, transform_t)
+ *
+ * sparse_set_t *transforms = transform_sps_new();
+ * transform_sps_add(transforms, entity, &(transform_t){0});
+ * transform_t *t = transform_sps_get(transforms, entity);
+ * @endcode
+ *
+ * The inline fast paths of get, remove and sort only handle plain sets
+ * (flags == 0). Sets with tracking or other modes enabled are forwarded to
+ * the generic functions, as is every set in builds with SPS_ENABLE_STATS so
+ * that each access is counted. has only reads the sparse pages, so it stays
+ * inline for every set outside such builds.
+ * The accessors assume T is stored whole, so they must not be used on sets
+ * created by sps_new_soa.
+ */
+
+#ifndef SPS_TYPED_H_
+#define SPS_TYPED_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sps.h"
+
+static inline uint32_t sps_typed_lookup(const sparse_set_t* set, uint32_t index) {
+    return sps_lookup_unchecked(set, index);
+}
+
+static inline void sps_typed_link(sparse_set_t* set, uint32_t index, uint32_t dense_idx) {
+    set->sparse[index >> SPS_PAGE_BITS][index & (SPS_PAGE_SIZE - 1U)].dense = dense_idx + 1U;
+}
+
+static inline void sps_typed_unlink(sparse_set_t* set, uint32_t index) {
+    set->sparse[index >> SPS_PAGE_BITS][index & (SPS_PAGE_SIZE - 1U)] = (sps_slot_t){0};
+}
+
+/** @brief Whether every access is forwarded to the generic functions */
+#ifdef SPS_ENABLE_STATS
+#define SPS_TYPED_GENERIC true
+#else
+#define SPS_TYPED_GENERIC false
+#endif
+
+/** @brief Length of the runs the typed sort seeds with insertion sort */
+#define SPS_TYPED_SORT_RUN (16U)
+
+/**
+ * @brief Define typed accessors for a component type
+ *
+ * Emits, for a set created with name_sps_new():
+ * - name_sps_new(void)
+ * - name_sps_add(set, index, const T *component)
+ * - name_sps_get(set, index)
+ * - name_sps_has(set, index)
+ * - name_sps_remove(set, index)
+ * - name_sps_sort(set, int (*compare)(const T *, const T *, void *), void *context)
+ *
+ * They behave like the generic function of the same name.
+ *
+ * @param name Prefix of the generated functions
+ * @param T Component type
+ */
+#define SPS_DEFINE(name, T)                                                                        \
+    typedef int (*name##_sps_compare_t)(const T* a, const T* b, void* context);                    \
+                                                                                                   \
+    typedef struct name##_sps_sort_ctx {                                                           \
+        name##_sps_compare_t compare;                                                              \
+        void* context;                                                                             \
+    } name##_sps_sort_ctx_t;                                                                       \
+                                                                                                   \
+    static inline int name##_sps_compare_(const void* a, const void* b, void* context) {           \
+        const name##_sps_sort_ctx_t* ctx = (const name##_sps_sort_ctx_t*)context;                  \
+        return ctx->compare((const T*)a, (const T*)b, ctx->context);                               \
+    }                                                                                              \
+                                                                                                   \
+    static inline sparse_set_t* name##_sps_new(void) {                                             \
+        return sps_new(sizeof(T));                                                                 \
+    }                                                                                              \
+                                                                                                   \
+    static inline T* name##_sps_add(sparse_set_t* set, uint32_t index, const T* component) {       \
+        T* target = (T*)sps_emplace(set, index);                                                   \
+        if (target != NULL) {                                                                      \
+            *target = *component;                                                                  \
+        }                                                                                          \
+        return target;                                                                             \
+    }                                                                                              \
+                                                                                                   \
+    static inline T* name##_sps_get(sparse_set_t* set, uint32_t index) {                           \
+        if (SPS_TYPED_GENERIC || set->flags != 0) {                                                \
+            return (T*)sps_get(set, index);                                                        \
+        }                                                                                          \
+                                                                                                   \
+        uint32_t dense_idx = sps_typed_lookup(set, index);                                         \
+        return dense_idx == SPARSE_SET_MAX ? NULL : (T*)(void*)set->components + dense_idx;        \
+    }                                                                                              \
+                                                                                                   \
+    static inline bool name##_sps_has(sparse_set_t* set, uint32_t index) {                         \
+        if (SPS_TYPED_GENERIC) {                                                                   \
+            return sps_has(set, index);                                                            \
+        }                                                                                          \
+        return sps_typed_lookup(set, index) != SPARSE_SET_MAX;                                     \
+    }                                                                                              \
+                                                                                                   \
+    static inline void name##_sps_remove(sparse_set_t* set, uint32_t index) {                      \
+        uint32_t dense_idx = sps_typed_lookup(set, index);                                         \
+        if (SPS_TYPED_GENERIC || set->flags != 0 || dense_idx == SPARSE_SET_MAX) {                 \
+            sps_remove(set, index);                                                                \
+            return;                                                                                \
+        }                                                                                          \
+                                                                                                   \
+        T* components  = (T*)(void*)set->components;                                              \
+        uint32_t last  = set->count - 1U;                                                          \
+        uint32_t moved = set->dense[last];                                                         \
+                                                                                                   \
+        components[dense_idx] = components[last];                                                  \
+        set->dense[dense_idx] = moved;                                                             \
+        sps_typed_link(set, moved, dense_idx);                                                     \
+                                                                                                   \
+        set->dense[last] = SPARSE_SET_MAX;                                                         \
+        sps_typed_unlink(set, index);                                                              \
+        set->count = last;                                                                         \
+    }                                                                                              \
+                                                                                                   \
+    static inline void name##_sps_sort(                                                            \
+        sparse_set_t* set, name##_sps_compare_t compare, void* context) {                          \
+        uint32_t n       = set->count;                                                             \
+        uint32_t* order  = NULL;                                                                   \
+        if (!SPS_TYPED_GENERIC && set->flags == 0 && n > 1) {                                      \
+            order = (uint32_t*)sps_workspace(set, 2 * (size_t)n * sizeof(uint32_t));               \
+        }                                                                                          \
+                                                                                                   \
+        if (order == NULL) {                                                                       \
+            name##_sps_sort_ctx_t ctx = {compare, context};                                        \
+            sps_sort(set, name##_sps_compare_, &ctx);                                              \
+            return;                                                                                \
+        }                                                                                          \
+                                                                                                   \
+        T* c = (T*)(void*)set->components;                                                         \
+        for (uint32_t i = 0; i < n; i++) {                                                         \
+            order[i] = i;                                                                          \
+        }                                                                                          \
+                                                                                                   \
+        /* Stable merge sort seeded with insertion sorted runs */                                  \
+        for (uint32_t lo = 0; lo < n; lo += SPS_TYPED_SORT_RUN) {                                  \
+            uint32_t hi = n - lo < SPS_TYPED_SORT_RUN ? n : lo + SPS_TYPED_SORT_RUN;               \
+            for (uint32_t i = lo + 1; i < hi; i++) {                                               \
+                uint32_t key = order[i];                                                           \
+                uint32_t j   = i;                                                                  \
+                while (j > lo && compare(&c[order[j - 1]], &c[key], context) > 0) {                \
+                    order[j] = order[j - 1];                                                       \
+                    j--;                                                                           \
+                }                                                                                  \
+                order[j] = key;                                                                    \
+            }                                                                                      \
+        }                                                                                          \
+                                                                                                   \
+        uint32_t* src = order;                                                                     \
+        uint32_t* dst = order + n;                                                                 \
+        for (uint32_t width = SPS_TYPED_SORT_RUN; width < n; width *= 2) {                         \
+            for (uint32_t lo = 0; lo < n; lo += 2 * width) {                                       \
+                uint32_t mid   = n - lo < width ? n : lo + width;                                  \
+                uint32_t hi    = n - mid < width ? n : mid + width;                                \
+                uint32_t left  = lo;                                                               \
+                uint32_t right = mid;                                                              \
+                uint32_t out   = lo;                                                               \
+                if (mid < hi && compare(&c[src[mid - 1]], &c[src[mid]], context) > 0) {            \
+                    while (left < mid && right < hi) {                                             \
+                        if (compare(&c[src[left]], &c[src[right]], context) <= 0) {                \
+                            dst[out++] = src[left++];                                              \
+                        } else {                                                                   \
+                            dst[out++] = src[right++];                                             \
+                        }                                                                          \
+                    }                                                                              \
+                }                                                                                  \
+                while (left < mid) dst[out++] = src[left++];                                       \
+                while (right < hi) dst[out++] = src[right++];                                      \
+            }                                                                                      \
+                                                                                                   \
+            uint32_t* swap = src;                                                                  \
+            src            = dst;                                                                  \
+            dst            = swap;                                                                 \
+        }                                                                                          \
+                                                                                                   \
+        /* Follow the permutation cycles, holding one component aside */                           \
+        for (uint32_t start = 0; start < n; start++) {                                             \
+            if (src[start] == start) {                                                             \
+                continue;                                                                          \
+            }                                                                                      \
+                                                                                                   \
+            T held              = c[start];                                                        \
+            uint32_t held_index = set->dense[start];                                               \
+            uint32_t pos        = start;                                                           \
+            while (src[pos] != start) {                                                            \
+                uint32_t next   = src[pos];                                                        \
+                c[pos]          = c[next];                                                         \
+                set->dense[pos] = set->dense[next];                                                \
+                sps_typed_link(set, set->dense[pos], pos);                                         \
+                src[pos] = pos;                                                                    \
+                pos      = next;                                                                   \
+            }                                                                                      \
+                                                                                                   \
+            c[pos]          = held;                                                                \
+            set->dense[pos] = held_index;                                                          \
+            sps_typed_link(set, held_index, pos);                                                  \
+            src[pos] = pos;                                                                        \
+        }                                                                                          \
+    }
+
+#endif  // SPS_TYPED_H_
@@ -6,252 +6,1577 @@
 #include <stdlib.h>
 #include <string.h>
 
-#ifndef NDEBUG
-#define sps_error(msg)                                            \
-    do {                                                          \
-        fprintf(stderr,                                           \
-                "sparse set assertion error in %s (%s:%d): %s\n", \
-                __func__,                                         \
-                __FILE_NAME__,                                    \
-                __LINE__,                                         \
-                (msg));                                           \
-        abort();                                                  \
-    } while (0)
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+#include "sps_internal.h"
+
+// Sparse slots hold the dense position plus one, so a zero-filled page reads as empty.
+// Every unmapped slot of the page directory points at this page, which is never written.
+sps_slot_t sps_empty_page[SPS_PAGE_SIZE];
+
+static void *sps_default_alloc(size_t size, size_t align, void *ctx) {
+    (void)ctx;
+#ifdef _MSC_VER
+    return _aligned_malloc(size, align);
+#else
+    if (align <= SPS_ALLOC_ALIGN) {
+        return malloc(size);
+    }
+
+    // aligned_alloc wants a size that is a multiple of the alignment
+    if (size > SIZE_MAX - align) {
+        return NULL;
+    }
+    return aligned_alloc(align, (size + align - 1) & ~(align - 1));
+#endif
+}
+
+static void *sps_default_resize(void *ptr, size_t old_size, size_t new_size, size_t align, void *ctx) {
+#ifdef _MSC_VER
+    (void)old_size;
+    (void)ctx;
+    return _aligned_realloc(ptr, new_size, align);
+#else
+    if (align <= SPS_ALLOC_ALIGN) {
+        return realloc(ptr, new_size);
+    }
+
+    // realloc only keeps the alignment malloc guarantees
+    void *resized = sps_default_alloc(new_size, align, ctx);
+    if (resized != NULL) {
+        memcpy(resized, ptr, old_size < new_size ? old_size : new_size);
+        free(ptr);
+    }
+    return resized;
+#endif
+}
+
+static void sps_default_release(void *ptr, size_t size, void *ctx) {
+    (void)size;
+    (void)ctx;
+#ifdef _MSC_VER
+    _aligned_free(ptr);
 #else
-#define sps_error(msg) (void)msg
+    free(ptr);
 #endif
+}
+
+const sps_allocator_t sps_default_allocator = {
+    .alloc   = sps_default_alloc,
+    .resize  = sps_default_resize,
+    .release = sps_default_release,
+    .ctx     = NULL,
+};
+
+static bool sps_map_page(sparse_set_t *set, uint32_t index) {
+    uint32_t page = index >> SPS_PAGE_BITS;
+
+    if (page >= set->page_count) {
+        size_t page_count = set->page_count > 0 ? (size_t)set->page_count * 2 : 1;
+        if (page_count <= page) page_count = (size_t)page + 1;
+        if (page_count > SPS_PAGE_COUNT_MAX) page_count = SPS_PAGE_COUNT_MAX;
+
+        sps_slot_t **sparse = sps_mem_realloc(&set->allocator,
+                                              set->sparse,
+                                              set->page_count * sizeof(*sparse),
+                                              page_count * sizeof(*sparse));
+        if (sparse == NULL) {
+            return false;
+        }
+
+        for (size_t i = set->page_count; i < page_count; i++) {
+            sparse[i] = sps_empty_page;
+        }
+
+        set->sparse     = sparse;
+        set->page_count = (uint32_t)page_count;
+    }
+
+    if (set->sparse[page] == sps_empty_page) {
+        sps_slot_t *slots = sps_mem_alloc(&set->allocator, SPS_PAGE_SIZE * sizeof(*slots));
+        if (slots == NULL) {
+            return false;
+        }
+        memset(slots, 0, SPS_PAGE_SIZE * sizeof(*slots));
+
+        set->sparse[page] = slots;
+        set->pages_used++;
+    }
+
+    return true;
+}
+
+static void *sps_resize_block(sparse_set_t *set,
+                              void *block,
+                              size_t from,
+                              size_t to,
+                              size_t align) {
+    if (to == 0) {
+        sps_mem_free(&set->allocator, block, from);
+        return NULL;
+    }
+
+    return sps_mem_realloc_aligned(&set->allocator, block, from, to, align);
+}
+
+/**
+ * Resize the block directory of a paged set from one capacity to another.
+ * Blocks in use never move; new ones are allocated, the ones past the new
+ * capacity released.
+ */
+static bool sps_resize_blocks(sparse_set_t *set, size_t from, size_t to) {
+    size_t length = (size_t)1 << set->block_bits;
+    size_t bytes  = length * set->component_size;
+    size_t have   = (from + length - 1) >> set->block_bits;
+    size_t want   = (to + length - 1) >> set->block_bits;
+    if (want == have) {
+        return true;
+    }
+
+    for (size_t b = want; b < have; b++) {
+        sps_mem_free(&set->allocator, set->blocks[b], bytes);
+    }
+
+    uint8_t **blocks = sps_resize_block(
+        set, set->blocks, have * sizeof(*blocks), want * sizeof(*blocks), SPS_ALLOC_ALIGN);
+    if (blocks == NULL && want > 0) {
+        return false;
+    }
+    set->blocks = blocks;
+
+    for (size_t b = have; b < want; b++) {
+        blocks[b] = sps_mem_alloc_aligned(&set->allocator, bytes, set->alignment);
+        if (blocks[b] == NULL) {
+            while (b-- > have) {
+                sps_mem_free(&set->allocator, blocks[b], bytes);
+            }
+
+            blocks = sps_resize_block(
+                set, set->blocks, want * sizeof(*blocks), have * sizeof(*blocks), SPS_ALLOC_ALIGN);
+            if (blocks != NULL || have == 0) set->blocks = blocks;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Resize the component array, or column i of an SoA set, from one capacity
+ * to another.
+ */
+static bool sps_resize_storage(sparse_set_t *set, uint32_t i, size_t from, size_t to) {
+    if (set->flags & SPS_PAGED) {
+        return sps_resize_blocks(set, from, to);
+    }
+
+    uint8_t **block = set->columns != NULL ? &set->columns[i].data : &set->components;
+    size_t size     = set->columns != NULL ? set->columns[i].size : set->component_size;
+
+    uint8_t *resized = sps_resize_block(set, *block, from * size, to * size, set->alignment);
+    if (resized == NULL && to > 0) {
+        return false;
+    }
+
+    *block = resized;
+    return true;
+}
+
+static bool sps_grow(sparse_set_t *set, size_t min_capacity) {
+    if (min_capacity > set->max_capacity || (set->flags & SPS_READ_ONLY)) {
+        return false;
+    }
+
+    // Double the storage so that a sequence of adds stays amortized O(1)
+    size_t capacity = set->capacity > 0 ? (size_t)set->capacity * 2 : 1;
+    if (capacity < min_capacity) capacity = min_capacity;
+    if (set->flags & SPS_PAGED) {
+        // Fill the last block, it is allocated whole anyway
+        size_t mask = ((size_t)1 << set->block_bits) - 1;
+        capacity    = capacity <= SIZE_MAX - mask ? (capacity + mask) & ~mask : SIZE_MAX;
+    }
+    if (capacity > set->max_capacity) capacity = set->max_capacity;
+    if (capacity > SIZE_MAX / set->component_size) {
+        return false;
+    }
+
+    // Arrays are resized one at a time; on failure the ones already resized
+    // are shrunk back, so every block keeps the size the allocator last saw
+    size_t old      = set->capacity;
+    uint32_t *dense = sps_resize_block(
+        set, set->dense, old * sizeof(*dense), capacity * sizeof(*dense), SPS_ALLOC_ALIGN);
+    if (dense == NULL) {
+        return false;
+    }
+    set->dense = dense;
+
+    uint32_t arrays  = set->columns != NULL ? set->column_count : 1;
+    uint32_t resized = 0;
+    while (resized < arrays && sps_resize_storage(set, resized, old, capacity)) {
+        resized++;
+    }
+
+    bool grown = resized == arrays;
+    if (grown && (set->marks != NULL || (set->flags & (SPS_TRACK_ORDER | SPS_TRACK_CHANGES)))) {
+        size_t from    = set->marks != NULL ? old : 0;
+        uint8_t *marks =
+            sps_resize_block(set, set->marks, from, capacity * sizeof(*marks), SPS_ALLOC_ALIGN);
+        grown          = marks != NULL;
+        if (grown) set->marks = marks;
+    }
+
+    if (!grown) {
+        while (resized-- > 0) {
+            sps_resize_storage(set, resized, capacity, old);
+        }
+
+        dense = sps_resize_block(
+            set, set->dense, capacity * sizeof(*dense), old * sizeof(*dense), SPS_ALLOC_ALIGN);
+        if (dense != NULL || old == 0) set->dense = dense;
+        return false;
+    }
+
+    set->capacity = (uint32_t)capacity;
+    if (set->advice != SPS_ADVICE_NORMAL) {
+        sps_advise_storage(set);
+    }
+    return true;
+}
+
+bool sps_alloc_marks(sparse_set_t *set) {
+    if (set->marks != NULL || set->capacity == 0) {
+        return true;
+    }
+
+    set->marks = sps_mem_alloc(&set->allocator, set->capacity * sizeof(*set->marks));
+    if (set->marks == NULL) {
+        return false;
+    }
+
+    memset(set->marks, 0, set->capacity * sizeof(*set->marks));
+    return true;
+}
+
+void sps_mark_unsorted(sparse_set_t *set, uint32_t dense_idx) {
+    if (!(set->flags & SPS_TRACK_ORDER) || (set->flags & SPS_ORDER_STALE) ||
+        (set->marks[dense_idx] & SPS_MARK_UNSORTED)) {
+        return;
+    }
+
+    // Past about twice the live count a full sort is cheaper than tracking individual changes
+    if (set->dirty_count == set->dirty_capacity) {
+        size_t capacity = set->dirty_capacity > 0 ? (size_t)set->dirty_capacity * 2 : 16;
+        uint32_t *dirty = NULL;
+        if (set->dirty_capacity <= set->count) {
+            dirty = sps_mem_realloc(&set->allocator,
+                                    set->dirty,
+                                    set->dirty_capacity * sizeof(*dirty),
+                                    capacity * sizeof(*dirty));
+        }
+
+        if (dirty == NULL) {
+            set->flags |= SPS_ORDER_STALE;
+            return;
+        }
+
+        set->dirty          = dirty;
+        set->dirty_capacity = (uint32_t)capacity;
+    }
+
+    set->marks[dense_idx] |= SPS_MARK_UNSORTED;
+    set->dirty[set->dirty_count++] = set->dense[dense_idx];
+}
+
+static uint32_t sps_push_slot(sparse_set_t *set, uint32_t index, uint32_t generation) {
+    sps_assert_unpartitioned(set);
+
+    if (set->flags & SPS_READ_ONLY) {
+        sps_error("sparse set is read-only");
+        return SPARSE_SET_MAX;
+    }
+
+    // Reclaim tombstones before growing the storage to make room
+    if (set->count == set->capacity && set->tombstones > 0) {
+        sps_compact(set);
+    }
+
+    if (set->count == set->capacity && !sps_grow(set, (size_t)set->count + 1)) {
+        sps_error("sparse set is full");
+        return SPARSE_SET_MAX;
+    }
+
+    if (!sps_map_page(set, index)) {
+        sps_error("failed to allocate sparse page");
+        return SPARSE_SET_MAX;
+    }
+
+    set->sparse[index >> SPS_PAGE_BITS][index & SPS_PAGE_MASK] = (sps_slot_t){
+        .dense      = set->count + 1U,
+        .generation = generation,
+    };
+    set->dense[set->count] = index;
+
+    if (set->marks != NULL) {
+        set->marks[set->count] = 0;
+    }
+
+    sps_mark_unsorted(set, set->count);
+    sps_mark_changed(set, set->count, SPS_MARK_ADDED);
+    set->count++;
+    SPS_STAT_ADD(set, adds, 1);
+    SPS_STAT_PEAK(set);
+    return set->count - 1;
+}
+
+/**
+ * Let the owning group claim a freshly added entity, returning the dense
+ * position the entity ends up at.
+ */
+static uint32_t sps_settle(sparse_set_t *set, uint32_t index, uint32_t dense_idx) {
+    if (set->group == NULL) {
+        return dense_idx;
+    }
+
+    sps_group_join(set->group, index);
+    return sps_lookup(set, index);
+}
+
+bool sps_rebuild_sparse(sparse_set_t *set, const uint8_t *generations) {
+    for (uint32_t i = 0; i < set->count; i++) {
+        if (i + SPS_PREFETCH_DISTANCE < set->count) {
+            sps_prefetch_slot(set, set->dense[i + SPS_PREFETCH_DISTANCE]);
+        }
+
+        uint32_t index = set->dense[i];
+        if (index == SPARSE_SET_MAX || !sps_map_page(set, index)) {
+            return false;
+        }
 
-void *sps_iter_next(sparse_set_iter_t *iter, uint16_t *index) {
-    if (index == NULL || iter == NULL) {
+        sps_slot_t *slot = &set->sparse[index >> SPS_PAGE_BITS][index & SPS_PAGE_MASK];
+        if (slot->dense != 0) {
+            return false;
+        }
+
+        // Generations may come from an unaligned buffer
+        uint32_t generation = 0;
+        if (generations != NULL) {
+            memcpy(&generation, generations + (size_t)i * sizeof(generation), sizeof(generation));
+        }
+
+        *slot = (sps_slot_t){.dense = i + 1U, .generation = generation};
+    }
+
+    return true;
+}
+
+static void *sps_push(sparse_set_t *set,
+                      uint32_t index,
+                      uint32_t generation,
+                      const void *component) {
+    uint32_t dense_idx = sps_push_slot(set, index, generation);
+    if (dense_idx == SPARSE_SET_MAX) {
+        return NULL;
+    }
+
+    sps_store(set, dense_idx, component);
+    return sps_element(set, sps_settle(set, index, dense_idx));
+}
+
+void *sps_iter_next(sparse_set_iter_t *iter, uint32_t *index) {
+    if (iter == NULL) {
         sps_error("invalid function paramaters");
         return NULL;
     }
 
+    while (iter->index < iter->set->count && iter->set->dense[iter->index] == SPS_TOMBSTONE) {
+        iter->index++;
+    }
+
     if (iter->index >= iter->set->count) {
         return NULL;
     }
 
-    *index          = iter->set->dense[iter->index];
-    void *component = (char *)iter->set->components + (iter->index * iter->set->component_size);
+    if (index != NULL) {
+        *index = iter->set->dense[iter->index];
+    }
+
+    void *component = sps_element(iter->set, iter->index);
     iter->index++;
     return component;
 }
 
-sparse_set_iter_t sps_iter_new(sparse_set_t *set) {
-    if (set == NULL) {
-        sps_error("sparse set is invalid");
+bool sps_iter_next_span(sparse_set_iter_t *iter, size_t max, sparse_set_span_t *span) {
+    if (iter == NULL || span == NULL) {
+        sps_error("invalid function paramaters");
+        return false;
     }
 
-    return (sparse_set_iter_t){
-        .set   = set,
-        .index = 0,
+    sparse_set_t *set = iter->set;
+    while (iter->index < set->count && set->dense[iter->index] == SPS_TOMBSTONE) {
+        iter->index++;
+    }
+
+    if (iter->index >= set->count) {
+        *span = (sparse_set_span_t){0};
+        return false;
+    }
+
+    size_t count = set->count - iter->index;
+    if (max > 0 && count > max) count = max;
+    if (count > sps_block_room(set, iter->index)) count = sps_block_room(set, iter->index);
+
+    // A span ends at the next tombstone
+    if (set->tombstones > 0) {
+        for (size_t i = 1; i < count; i++) {
+            if (set->dense[iter->index + i] == SPS_TOMBSTONE) {
+                count = i;
+                break;
+            }
+        }
+    }
+
+    *span = (sparse_set_span_t){
+        .entities   = set->dense + iter->index,
+        .components = set->columns == NULL ? sps_component(set, iter->index) : NULL,
+        .begin      = iter->index,
+        .count      = count,
     };
+    iter->index += (uint32_t)count;
+    return true;
 }
 
-size_t sps_count(const sparse_set_t *set) {
+sparse_set_span_t sps_span(sparse_set_t *set) {
     if (set == NULL) {
-        sps_error("set cannot be NULL");
-        return 0;
+        sps_error("sparse set is invalid");
+        return (sparse_set_span_t){0};
     }
 
-    return set->count;
+    return (sparse_set_span_t){
+        .entities   = set->dense,
+        .components = set->columns == NULL && !(set->flags & SPS_PAGED) ? set->components : NULL,
+        .begin      = 0,
+        .count      = set->count,
+    };
 }
 
-void sps_sort(sparse_set_t *set, sps_sort_func_t compare, void *context) {
-    if (set == NULL || compare == NULL) {
+sparse_set_span_t sps_range(sparse_set_t *set, size_t begin, size_t end) {
+    if (set == NULL || end < begin) {
         sps_error("invalid arguments");
-        return;
+        return (sparse_set_span_t){0};
     }
 
-    if (set->count <= 1) {
-        return;  // Already sorted or empty
+    if (end > set->count) end = set->count;
+    if (begin >= end) {
+        return (sparse_set_span_t){.begin = begin};
     }
 
-    // Create a temporary array to store the original order
-    uint16_t *order = malloc(set->count * sizeof(uint16_t));
-    if (order == NULL) {
-        sps_error("failed to allocate temporary order array");
-        return;
+    return (sparse_set_span_t){
+        .entities   = set->dense + begin,
+        .components = set->columns == NULL && !(set->flags & SPS_PAGED)
+                          ? sps_component(set, (uint32_t)begin)
+                          : NULL,
+        .begin      = begin,
+        .count      = end - begin,
+    };
+}
+
+/**
+ * Number of elements whose storage spans a whole number of 64 byte lines in
+ * every array written through a range.
+ */
+static size_t sps_partition_grain(const sparse_set_t *set) {
+    size_t grain = 1;
+    for (uint32_t i = 0; i < (set->columns != NULL ? set->column_count : 1); i++) {
+        size_t size = set->columns != NULL ? set->columns[i].size : set->component_size;
+
+        // 64 / gcd(64, size) elements fill whole lines, always a power of two
+        size_t lines = 64;
+        while (lines > 1 && size % 2 == 0) {
+            lines /= 2;
+            size /= 2;
+        }
+        if (lines > grain) grain = lines;
     }
 
-    // Initialize with current order
-    for (uint16_t i = 0; i < set->count; i++) {
-        order[i] = i;
+    // Whole blocks of a paged set, so no two ranges share one
+    if ((set->flags & SPS_PAGED) && ((size_t)1 << set->block_bits) > grain) {
+        grain = (size_t)1 << set->block_bits;
     }
 
-    // Perform insertion sort (stable) with the custom comparator
-    for (uint16_t i = 1; i < set->count; i++) {
-        uint16_t key   = order[i];
-        void *key_comp = (char *)set->components + (key * set->component_size);
-        int j          = i - 1;
+    return grain;
+}
 
-        // Move elements that are greater than key to one position ahead
-        while (j >= 0) {
-            void *comp_j = (char *)set->components + (order[j] * set->component_size);
-            if (compare(comp_j, key_comp, context) <= 0) {
-                break;
-            }
-            order[j + 1] = order[j];
-            j--;
+size_t sps_partition(sparse_set_t *set, size_t max_ranges, sparse_set_span_t *ranges) {
+    if (set == NULL || ranges == NULL || max_ranges == 0) {
+        sps_error("invalid arguments");
+        return 0;
+    }
+
+    // Ranges are handed out without tombstones
+    if (set->tombstones > 0 && set->partitioned == 0 && !(set->flags & SPS_READ_ONLY)) {
+        sps_compact(set);
+    }
+
+    // Round the chunk length to the grain unless that would idle workers
+    size_t count = set->count;
+    size_t grain = sps_partition_grain(set);
+    if (count / max_ranges < grain) grain = 1;
+
+    size_t units     = (count + grain - 1) / grain;
+    size_t produced  = 0;
+    size_t begin     = 0;
+    size_t per_range = units / max_ranges;
+    size_t remainder = units % max_ranges;
+
+    for (size_t i = 0; i < max_ranges && begin < count; i++) {
+        size_t length = (per_range + (i < remainder ? 1 : 0)) * grain;
+        size_t end    = begin + length < count ? begin + length : count;
+        if (end == begin) {
+            break;
         }
-        order[j + 1] = key;
+
+        ranges[produced++] = sps_range(set, begin, end);
+        begin              = end;
     }
 
-    // Allocate temporary buffers
-    void *temp_components = malloc(set->count * set->component_size);
-    uint16_t *temp_dense  = malloc(set->count * sizeof(uint16_t));
+    set->partitioned++;
+    return produced;
+}
 
-    if (temp_components == NULL || temp_dense == NULL) {
-        sps_error("failed to allocate temporary buffers");
-        free(order);
-        if (temp_components) free(temp_components);
-        if (temp_dense) free(temp_dense);
+void sps_partition_end(sparse_set_t *set) {
+    if (set == NULL || set->partitioned == 0) {
+        sps_error("set is not partitioned");
         return;
     }
 
-    // Rebuild arrays based on the sorted order
-    for (uint16_t i = 0; i < set->count; i++) {
-        uint16_t old_pos = order[i];
+    set->partitioned--;
+}
 
-        // Copy component to temp buffer
-        memcpy((char *)temp_components + (i * set->component_size),
-               (char *)set->components + (old_pos * set->component_size),
-               set->component_size);
+sparse_set_iter_t sps_iter_new(sparse_set_t *set) {
+    if (set == NULL) {
+        sps_error("sparse set is invalid");
+    }
 
-        // Copy dense array entry
-        temp_dense[i] = set->dense[old_pos];
+    return (sparse_set_iter_t){
+        .set   = set,
+        .index = 0,
+    };
+}
 
-        // Update sparse array to point to new position
-        set->sparse[set->dense[old_pos]] = i;
+size_t sps_count(const sparse_set_t *set) {
+    if (set == NULL) {
+        sps_error("set cannot be NULL");
+        return 0;
     }
 
-    // Copy temp buffers back to original arrays
-    memcpy(set->components, temp_components, set->count * set->component_size);
-    memcpy(set->dense, temp_dense, set->count * sizeof(uint16_t));
-
-    // Clean up
-    free(order);
-    free(temp_components);
-    free(temp_dense);
+    return set->count - set->tombstones;
 }
 
-bool sps_has(sparse_set_t *set, uint16_t index) {
+bool sps_has(sparse_set_t *set, uint32_t index) {
     if (set == NULL || index == SPARSE_SET_MAX) {
         sps_error("invalid arguments");
         return false;
     }
 
-    return set->sparse[index] != SPARSE_SET_MAX;
+    bool found = sps_lookup(set, index) != SPARSE_SET_MAX;
+    SPS_STAT_LOOKUP(set, found);
+    return found;
 }
 
-void *sps_add_or_replace(sparse_set_t *set, uint16_t index, void *component) {
+void *sps_add_or_replace(sparse_set_t *set, uint32_t index, void *component) {
     if (set == NULL || component == NULL || index == SPARSE_SET_MAX) {
         sps_error("invalid arguments");
         return NULL;
     }
 
     // Check if the index already exists in the set
-    if (index < SPARSE_SET_MAX && set->sparse[index] < set->count &&
-        set->dense[set->sparse[index]] == index) {
+    uint32_t dense_idx = sps_lookup(set, index);
+    if (dense_idx < set->count) {
+        if (set->flags & SPS_READ_ONLY) {
+            sps_error("sparse set is read-only");
+            return NULL;
+        }
+
         // Element exists, replace it
-        void *target = (char *)set->components + (set->sparse[index] * set->component_size);
-        memcpy(target, component, set->component_size);
-        return target;
+        sps_store(set, dense_idx, component);
+        sps_mark_unsorted(set, dense_idx);
+        sps_mark_changed(set, dense_idx, SPS_MARK_MODIFIED);
+        return sps_element(set, dense_idx);
     } else {
         // Element doesn't exist, add it
-        set->sparse[index]     = set->count;
-        set->dense[set->count] = index;
-        void *target           = (char *)set->components + (set->count * set->component_size);
-        memcpy(target, component, set->component_size);
-        set->count++;
-        return target;
+        return sps_push(set, index, 0, component);
     }
 }
 
-void *sps_add(sparse_set_t *set, uint16_t index, void *component) {
+void *sps_add(sparse_set_t *set, uint32_t index, void *component) {
     if (set == NULL || component == NULL || index == SPARSE_SET_MAX) {
         sps_error("invalid arguments");
         return NULL;
     }
 
-    if (set->count == SPARSE_SET_MAX) {
-        sps_error("sparse set is full");
-        return NULL;
-    }
-
-    if (set->sparse[index] != UINT16_MAX) {
+    if (sps_lookup(set, index) != SPARSE_SET_MAX) {
         sps_error("sparse set is already set at index");
         return NULL;
     }
 
-    set->sparse[index]     = set->count;
-    set->dense[set->count] = index;
-    void *target           = (char *)set->components + (set->count * set->component_size);
-    memcpy(target, component, set->component_size);
-    set->count++;
-    return target;
+    return sps_push(set, index, 0, component);
 }
 
-void sps_remove(sparse_set_t *set, uint16_t index) {
-    if (set == NULL || index == SPARSE_SET_MAX) {
-        sps_error("invalid arguments");
-        return;
+static bool sps_erase(sparse_set_t *set, uint32_t index, uint32_t dense_idx) {
+    sps_assert_unpartitioned(set);
+
+    if (set->flags & SPS_READ_ONLY) {
+        sps_error("sparse set is read-only");
+        return false;
     }
 
-    if (set->sparse[index] == SPARSE_SET_MAX) {
-        sps_error("sparse index is not in use");
-        return;
+    sps_mark_removed(set, dense_idx);
+
+    if (set->flags & SPS_STABLE_REMOVE) {
+        sps_unlink(set, index);
+        set->dense[dense_idx] = SPS_TOMBSTONE;
+        if (set->marks != NULL) {
+            set->marks[dense_idx] = 0;
+        }
+        set->tombstones++;
+        SPS_STAT_ADD(set, removes, 1);
+
+        // Tombstones at the end are released right away
+        while (set->count > 0 && set->dense[set->count - 1] == SPS_TOMBSTONE) {
+            set->dense[set->count - 1] = SPARSE_SET_MAX;
+            set->count--;
+            set->tombstones--;
+        }
+        return true;
     }
 
-    void *last_comp = (char *)set->components + ((set->count - 1) * set->component_size);
-    void *target    = (char *)set->components + (set->sparse[index] * set->component_size);
-    memcpy(target, last_comp, set->component_size);
+    // Leave the owning group's prefix first so the swap below cannot break it
+    if (set->group != NULL && dense_idx < set->group->size) {
+        sps_group_leave(set->group, index);
+        dense_idx = sps_lookup(set, index);
+    }
 
     // cache the indexes
-    uint16_t sparse_idx = set->dense[set->count - 1];
-    uint16_t dense_idx  = set->sparse[index];
+    uint32_t sparse_idx = set->dense[set->count - 1];
+
+    sps_move(set, dense_idx, set->count - 1, 1);
 
     // update indexes
-    set->dense[dense_idx]   = sparse_idx;
-    set->sparse[sparse_idx] = dense_idx;
+    set->dense[dense_idx] = sparse_idx;
+    sps_link(set, sparse_idx, dense_idx);
 
     // invalidate old indexes
     set->dense[set->count - 1] = SPARSE_SET_MAX;
-    set->sparse[index]         = SPARSE_SET_MAX;
+    sps_unlink(set, index);
     set->count--;
+    SPS_STAT_ADD(set, removes, 1);
+
+    // The last component now sits in the middle of the order
+    if (set->marks != NULL) {
+        set->marks[dense_idx] = set->marks[set->count];
+    }
+
+    if (dense_idx < set->count) {
+        sps_mark_unsorted(set, dense_idx);
+    }
+    return true;
+}
+
+void *sps_add_unchecked(sparse_set_t *set, uint32_t index, const void *component) {
+    return sps_push(set, index, 0, component);
 }
 
-void *sps_get(sparse_set_t *set, uint16_t index) {
+void *sps_emplace(sparse_set_t *set, uint32_t index) {
     if (set == NULL || index == SPARSE_SET_MAX) {
         sps_error("invalid arguments");
         return NULL;
     }
 
-    if (set->sparse[index] == SPARSE_SET_MAX) {
+    if (sps_lookup(set, index) != SPARSE_SET_MAX) {
+        sps_error("sparse set is already set at index");
+        return NULL;
+    }
+
+    uint32_t dense_idx = sps_push_slot(set, index, 0);
+    if (dense_idx == SPARSE_SET_MAX) {
         return NULL;
     }
 
-    return (char *)set->components + (set->sparse[index] * set->component_size);
+    return sps_element(set, sps_settle(set, index, dense_idx));
 }
 
-sparse_set_t *sps_new(size_t component_size) {
-    if (component_size == 0) {
+void sps_remove(sparse_set_t *set, uint32_t index) {
+    if (set == NULL || index == SPARSE_SET_MAX) {
+        sps_error("invalid arguments");
+        return;
+    }
+
+    uint32_t dense_idx = sps_lookup(set, index);
+    if (dense_idx == SPARSE_SET_MAX) {
+        sps_error("sparse index is not in use");
+        return;
+    }
+
+    sps_erase(set, index, dense_idx);
+}
+
+void *sps_get(sparse_set_t *set, uint32_t index) {
+    if (set == NULL || index == SPARSE_SET_MAX) {
+        sps_error("invalid arguments");
         return NULL;
     }
 
-    sparse_set_t *sps = malloc(sizeof(*sps) + SPARSE_SET_MAX * component_size);
-    if (sps == NULL) {
-        sps_error("failed to allocate sparse set");
+    uint32_t dense_idx = sps_lookup(set, index);
+    SPS_STAT_LOOKUP(set, dense_idx != SPARSE_SET_MAX);
+    if (dense_idx == SPARSE_SET_MAX) {
         return NULL;
     }
 
-    memset(sps->dense, 0xFFU, sizeof(sps->dense));
-    memset(sps->sparse, 0xFFU, sizeof(sps->sparse));
-    sps->component_size = component_size;
-    sps->count          = 0;
-    return sps;
+    return sps_element(set, dense_idx);
 }
 
-void sps_free(sparse_set_t *set) {
-    free(set);
+void sps_mark_dirty(sparse_set_t *set, uint32_t index) {
+    if (set == NULL || index == SPARSE_SET_MAX) {
+        sps_error("invalid arguments");
+        return;
+    }
+
+    uint32_t dense_idx = sps_lookup(set, index);
+    if (dense_idx == SPARSE_SET_MAX) {
+        sps_error("sparse index is not in use");
+        return;
+    }
+
+    sps_mark_unsorted(set, dense_idx);
+    sps_mark_changed(set, dense_idx, SPS_MARK_MODIFIED);
+}
+
+void *sps_add_handle(sparse_set_t *set, sps_handle_t handle, void *component) {
+    uint32_t index = sps_handle_index(handle);
+    if (set == NULL || component == NULL || index == SPARSE_SET_MAX) {
+        sps_error("invalid arguments");
+        return NULL;
+    }
+
+    if (sps_lookup(set, index) != SPARSE_SET_MAX) {
+        sps_error("sparse set is already set at index");
+        return NULL;
+    }
+
+    return sps_push(set, index, sps_handle_generation(handle), component);
+}
+
+void sps_remove_handle(sparse_set_t *set, sps_handle_t handle) {
+    uint32_t index = sps_handle_index(handle);
+    if (set == NULL || index == SPARSE_SET_MAX) {
+        sps_error("invalid arguments");
+        return;
+    }
+
+    uint32_t dense_idx = sps_lookup_handle(set, handle);
+    if (dense_idx == SPARSE_SET_MAX) {
+        sps_error("handle is stale or not in use");
+        return;
+    }
+
+    sps_erase(set, index, dense_idx);
+}
+
+bool sps_has_handle(sparse_set_t *set, sps_handle_t handle) {
+    if (set == NULL || sps_handle_index(handle) == SPARSE_SET_MAX) {
+        sps_error("invalid arguments");
+        return false;
+    }
+
+    bool found = sps_lookup_handle(set, handle) != SPARSE_SET_MAX;
+    SPS_STAT_LOOKUP(set, found);
+    return found;
+}
+
+void *sps_get_handle(sparse_set_t *set, sps_handle_t handle) {
+    if (set == NULL || sps_handle_index(handle) == SPARSE_SET_MAX) {
+        sps_error("invalid arguments");
+        return NULL;
+    }
+
+    uint32_t dense_idx = sps_lookup_handle(set, handle);
+    SPS_STAT_LOOKUP(set, dense_idx != SPARSE_SET_MAX);
+    if (dense_idx == SPARSE_SET_MAX) {
+        return NULL;
+    }
+
+    return sps_element(set, dense_idx);
+}
+
+sps_handle_t sps_handle(sparse_set_t *set, uint32_t index) {
+    if (set == NULL || index == SPARSE_SET_MAX) {
+        sps_error("invalid arguments");
+        return SPS_HANDLE_INVALID;
+    }
+
+    sps_slot_t slot = sps_slot(set, index);
+    if (slot.dense == 0) {
+        return SPS_HANDLE_INVALID;
+    }
+
+    return sps_handle_make(index, slot.generation);
+}
+
+static void *sps_add_batch(sparse_set_t *set,
+                           const uint32_t *indices,
+                           size_t n,
+                           const void *components) {
+    if (set == NULL || indices == NULL || components == NULL || n == 0) {
+        sps_error("invalid arguments");
+        return NULL;
+    }
+
+    sps_assert_unpartitioned(set);
+
+    if (set->flags & SPS_READ_ONLY) {
+        sps_error("sparse set is read-only");
+        return NULL;
+    }
+
+    if (set->count + n > set->capacity && set->tombstones > 0) {
+        sps_compact(set);
+    }
+
+    if (n > set->max_capacity - set->count) {
+        sps_error("sparse set is full");
+        return NULL;
+    }
+
+    if (set->count + n > set->capacity && !sps_grow(set, set->count + n)) {
+        sps_error("failed to grow sparse set");
+        return NULL;
+    }
+
+    // Validate every index against the set before anything is written
+    for (size_t i = 0; i < n; i++) {
+        if (i + SPS_PREFETCH_DISTANCE < n) {
+            sps_prefetch_slot(set, indices[i + SPS_PREFETCH_DISTANCE]);
+        }
+
+        if (indices[i] == SPARSE_SET_MAX || sps_lookup(set, indices[i]) != SPARSE_SET_MAX) {
+            sps_error("sparse set is already set at index");
+            return NULL;
+        }
+
+        if (!sps_map_page(set, indices[i])) {
+            sps_error("failed to allocate sparse page");
+            return NULL;
+        }
+    }
+
+    // Link the new entries, the only failure left is an index repeated in the batch
+    uint32_t first = set->count;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t index  = indices[i];
+        sps_slot_t *slot = &set->sparse[index >> SPS_PAGE_BITS][index & SPS_PAGE_MASK];
+
+        if (slot->dense != 0) {
+            sps_error("index repeated in batch");
+            while (i-- > 0) {
+                sps_unlink(set, indices[i]);
+            }
+            return NULL;
+        }
+
+        *slot = (sps_slot_t){.dense = first + (uint32_t)i + 1U};
+    }
+
+    if (set->columns == NULL) {
+        sps_scatter(set, first, (uint32_t)n, components);
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            sps_store(set, first + (uint32_t)i, (const uint8_t *)components + i * set->component_size);
+        }
+    }
+    memcpy(set->dense + first, indices, n * sizeof(*set->dense));
+    set->count += (uint32_t)n;
+    SPS_STAT_ADD(set, adds, n);
+    SPS_STAT_PEAK(set);
+
+    if (set->marks != NULL) {
+        memset(set->marks + first, 0, n * sizeof(*set->marks));
+        for (uint32_t i = first; i < set->count; i++) {
+            sps_mark_unsorted(set, i);
+            sps_mark_changed(set, i, SPS_MARK_ADDED);
+        }
+    }
+
+    if (set->group != NULL) {
+        for (size_t i = 0; i < n; i++) {
+            sps_group_join(set->group, indices[i]);
+        }
+        return sps_element(set, sps_lookup(set, indices[0]));
+    }
+
+    return sps_element(set, first);
+}
+
+void *sps_add_many(sparse_set_t *set, const uint32_t *indices, size_t n, const void *components) {
+    SPS_ZONE_BEGIN(zone, "sps_add_many");
+    void *first = sps_add_batch(set, indices, n, components);
+    SPS_ZONE_END(zone);
+    return first;
+}
+
+size_t sps_remove_many(sparse_set_t *set, const uint32_t *indices, size_t n) {
+    if (set == NULL || (indices == NULL && n > 0)) {
+        sps_error("invalid arguments");
+        return 0;
+    }
+
+    SPS_ZONE_BEGIN(zone, "sps_remove_many");
+    size_t removed = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i + SPS_PREFETCH_DISTANCE < n) {
+            sps_prefetch_slot(set, indices[i + SPS_PREFETCH_DISTANCE]);
+        }
+
+        // Indices that are not in the set are skipped, not reported
+        uint32_t dense_idx = sps_lookup(set, indices[i]);
+        if (indices[i] == SPARSE_SET_MAX || dense_idx == SPARSE_SET_MAX) {
+            continue;
+        }
+
+        if (sps_erase(set, indices[i], dense_idx)) {
+            removed++;
+        }
+    }
+
+    SPS_ZONE_END(zone);
+    return removed;
+}
+
+void sps_clear(sparse_set_t *set) {
+    if (set == NULL) {
+        sps_error("set cannot be NULL");
+        return;
+    }
+
+    sps_assert_unpartitioned(set);
+
+    if (set->flags & SPS_READ_ONLY) {
+        sps_error("sparse set is read-only");
+        return;
+    }
+
+    SPS_ZONE_BEGIN(zone, "sps_clear");
+
+    // Every change list entry now names a removed entity
+    for (uint32_t i = 0; i < set->count; i++) {
+        if (set->dense[i] == SPS_TOMBSTONE) {
+            continue;
+        }
+        sps_mark_removed(set, i);
+        sps_unlink(set, set->dense[i]);
+    }
+    if (set->count > 0) {
+        memset(set->dense, 0xFF, set->count * sizeof(*set->dense));
+    }
+    set->changed_count = 0;
+    set->flags &= ~(SPS_ORDER_STALE | SPS_CHANGES_STALE);
+    set->dirty_count = 0;
+
+    // No entity is left in every member of the group
+    if (set->group != NULL) {
+        set->group->size = 0;
+    }
+
+    SPS_STAT_ADD(set, removes, set->count - set->tombstones);
+    set->count      = 0;
+    set->tombstones = 0;
+    SPS_ZONE_END(zone);
+}
+
+bool sps_stable_remove(sparse_set_t *set, bool enable) {
+    if (set == NULL) {
+        sps_error("invalid arguments");
+        return false;
+    }
+
+    if (set->flags & (SPS_OWNED | SPS_READ_ONLY)) {
+        sps_error("cannot change the removal policy of this set");
+        return false;
+    }
+
+    if (!enable) {
+        sps_compact(set);
+        set->flags &= ~SPS_STABLE_REMOVE;
+        return true;
+    }
+
+    set->flags |= SPS_STABLE_REMOVE;
+    return true;
+}
+
+void sps_compact(sparse_set_t *set) {
+    if (set == NULL) {
+        sps_error("set cannot be NULL");
+        return;
+    }
+
+    sps_assert_unpartitioned(set);
+
+    if (set->flags & SPS_READ_ONLY) {
+        sps_error("sparse set is read-only");
+        return;
+    }
+
+    if (set->tombstones == 0) {
+        return;
+    }
+
+    SPS_ZONE_BEGIN(zone, "sps_compact");
+
+    // Slide each run of live entries down over the tombstones seen so far
+    uint32_t kept = 0;
+    uint32_t at   = 0;
+    while (at < set->count) {
+        if (set->dense[at] == SPS_TOMBSTONE) {
+            at++;
+            continue;
+        }
+
+        uint32_t run = at;
+        while (at < set->count && set->dense[at] != SPS_TOMBSTONE) {
+            at++;
+        }
+
+        uint32_t length = at - run;
+        if (kept != run) {
+            sps_move(set, kept, run, length);
+            memmove(set->dense + kept, set->dense + run, length * sizeof(*set->dense));
+            if (set->marks != NULL) {
+                memmove(set->marks + kept, set->marks + run, length * sizeof(*set->marks));
+            }
+            for (uint32_t i = kept; i < kept + length; i++) {
+                sps_link(set, set->dense[i], i);
+            }
+        }
+        kept += length;
+    }
+
+    memset(set->dense + kept, 0xFF, (set->count - kept) * sizeof(*set->dense));
+    set->count      = kept;
+    set->tombstones = 0;
+    SPS_ZONE_END(zone);
+}
+
+size_t sps_get_many(sparse_set_t *set, const uint32_t *indices, size_t n, void **out) {
+    if (set == NULL || ((indices == NULL || out == NULL) && n > 0)) {
+        sps_error("invalid arguments");
+        return 0;
+    }
+
+    // Slots are prefetched a full distance ahead so each lookup hits the cache
+    SPS_ZONE_BEGIN(zone, "sps_get_many");
+    size_t found = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i + SPS_PREFETCH_DISTANCE < n) {
+            sps_prefetch_slot(set, indices[i + SPS_PREFETCH_DISTANCE]);
+        }
+
+        uint32_t dense_idx = sps_lookup(set, indices[i]);
+        if (dense_idx == SPARSE_SET_MAX) {
+            out[i] = NULL;
+            continue;
+        }
+
+        out[i] = sps_element(set, dense_idx);
+        found++;
+    }
+
+    SPS_STAT_LOOKUPS(set, n, found);
+    SPS_ZONE_END(zone);
+    return found;
+}
+
+size_t sps_copy_many(sparse_set_t *set, const uint32_t *indices, size_t n, void *out) {
+    if (set == NULL || ((indices == NULL || out == NULL) && n > 0)) {
+        sps_error("invalid arguments");
+        return 0;
+    }
+
+    // Two stage pipeline: slots are prefetched two distances ahead, resolved
+    // and their components prefetched one distance ahead, then copied
+    SPS_ZONE_BEGIN(zone, "sps_copy_many");
+    uint32_t ahead[SPS_PREFETCH_DISTANCE];
+    size_t found = 0;
+
+    for (size_t i = 0; i < n && i < 2 * SPS_PREFETCH_DISTANCE; i++) {
+        sps_prefetch_slot(set, indices[i]);
+    }
+
+    for (size_t i = 0; i < n && i < SPS_PREFETCH_DISTANCE; i++) {
+        ahead[i] = sps_lookup(set, indices[i]);
+        if (ahead[i] != SPARSE_SET_MAX) SPS_PREFETCH(sps_element(set, ahead[i]));
+    }
+
+    uint8_t *dst = out;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t dense_idx = ahead[i % SPS_PREFETCH_DISTANCE];
+
+        if (i + 2 * SPS_PREFETCH_DISTANCE < n) {
+            sps_prefetch_slot(set, indices[i + 2 * SPS_PREFETCH_DISTANCE]);
+        }
+
+        if (i + SPS_PREFETCH_DISTANCE < n) {
+            uint32_t next = sps_lookup(set, indices[i + SPS_PREFETCH_DISTANCE]);
+            if (next != SPARSE_SET_MAX) SPS_PREFETCH(sps_element(set, next));
+            ahead[i % SPS_PREFETCH_DISTANCE] = next;
+        }
+
+        uint8_t *target = dst + i * set->component_size;
+        if (dense_idx == SPARSE_SET_MAX) {
+            memset(target, 0, set->component_size);
+            continue;
+        }
+
+        sps_load(set, dense_idx, target);
+        found++;
+    }
+
+    SPS_STAT_LOOKUPS(set, n, found);
+    SPS_ZONE_END(zone);
+    return found;
+}
+
+static void sps_swap_bytes(uint8_t *a, uint8_t *b, size_t size) {
+    uint8_t temp[64];
+    while (size > 0) {
+        size_t n = size < sizeof(temp) ? size : sizeof(temp);
+        memcpy(temp, a, n);
+        memcpy(a, b, n);
+        memcpy(b, temp, n);
+        a += n;
+        b += n;
+        size -= n;
+    }
+}
+
+void sps_swap(sparse_set_t *set, uint32_t a, uint32_t b) {
+    if (a == b) {
+        return;
+    }
+
+    if (set->columns == NULL) {
+        sps_swap_bytes(sps_component(set, a), sps_component(set, b), set->component_size);
+        SPS_STAT_ADD(set, bytes_moved, 2 * set->component_size);
+    } else {
+        for (uint32_t i = 0; i < set->column_count; i++) {
+            sps_column_t *column = &set->columns[i];
+            sps_swap_bytes(column->data + (size_t)a * column->size,
+                           column->data + (size_t)b * column->size,
+                           column->size);
+            SPS_STAT_ADD(set, bytes_moved, 2 * column->size);
+        }
+    }
+
+    uint32_t index = set->dense[a];
+    set->dense[a]  = set->dense[b];
+    set->dense[b]  = index;
+    sps_link(set, set->dense[a], a);
+    sps_link(set, set->dense[b], b);
+
+    if (set->marks != NULL) {
+        uint8_t mark  = set->marks[a];
+        set->marks[a] = set->marks[b];
+        set->marks[b] = mark;
+    }
+
+    sps_mark_unsorted(set, a);
+    sps_mark_unsorted(set, b);
+}
+
+bool sps_reserve(sparse_set_t *set, size_t capacity) {
+    if (set == NULL) {
+        sps_error("set cannot be NULL");
+        return false;
+    }
+
+    if (capacity <= set->capacity) {
+        return true;
+    }
+
+    return sps_grow(set, capacity);
+}
+
+size_t sps_capacity(const sparse_set_t *set) {
+    if (set == NULL) {
+        sps_error("set cannot be NULL");
+        return 0;
+    }
+
+    return set->capacity;
+}
+
+void *sps_workspace(sparse_set_t *set, size_t size) {
+    if (set == NULL) {
+        sps_error("set cannot be NULL");
+        return NULL;
+    }
+
+    if (size <= set->scratch_size) {
+        return set->scratch;
+    }
+
+    // Old contents are never needed, so skip the copy a realloc would do
+    if (!set->scratch_borrowed) {
+        sps_mem_free(&set->allocator, set->scratch, set->scratch_size);
+    }
+
+    set->scratch          = sps_mem_alloc(&set->allocator, size);
+    set->scratch_size     = set->scratch != NULL ? size : 0;
+    set->scratch_borrowed = false;
+    return set->scratch;
+}
+
+void sps_attach_workspace(sparse_set_t *set, void *buffer, size_t size) {
+    if (set == NULL || (buffer == NULL && size > 0)) {
+        sps_error("invalid arguments");
+        return;
+    }
+
+    if (!set->scratch_borrowed) {
+        sps_mem_free(&set->allocator, set->scratch, set->scratch_size);
+    }
+
+    set->scratch          = buffer;
+    set->scratch_size     = size;
+    set->scratch_borrowed = buffer != NULL;
+}
+
+size_t sps_memory_usage(const sparse_set_t *set) {
+    if (set == NULL) {
+        sps_error("set cannot be NULL");
+        return 0;
+    }
+
+    // Columns together hold only the bytes covered by fields
+    size_t component_size = set->columns != NULL ? 0 : set->component_size;
+    for (uint32_t i = 0; i < set->column_count; i++) {
+        component_size += set->columns[i].size;
+    }
+
+    // Blocks of a paged set are allocated whole, behind a directory
+    size_t blocks = 0;
+    if (set->flags & SPS_PAGED) {
+        size_t length  = (size_t)1 << set->block_bits;
+        size_t count   = ((size_t)set->capacity + length - 1) >> set->block_bits;
+        blocks         = count * (sizeof(*set->blocks) + length * set->component_size);
+        component_size = 0;
+    }
+
+    return sizeof(*set) + blocks + (size_t)set->page_count * sizeof(*set->sparse) +
+           (size_t)set->pages_used * SPS_PAGE_SIZE * sizeof(**set->sparse) +
+           (size_t)set->capacity * (sizeof(*set->dense) + component_size) +
+           (size_t)set->column_count * sizeof(*set->columns) +
+           (set->marks != NULL ? (size_t)set->capacity * sizeof(*set->marks) : 0) +
+           (size_t)set->dirty_capacity * sizeof(*set->dirty) +
+           (size_t)set->changed_capacity * sizeof(*set->changed) +
+           (size_t)set->removed_capacity * sizeof(*set->removed) +
+           (set->scratch_borrowed ? 0 : set->scratch_size);
+}
+
+#ifdef SPS_ENABLE_STATS
+static void sps_counters_reset(sps_counters_t *counters, uint32_t peak_count) {
+    atomic_store_explicit(&counters->adds, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->removes, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->gets, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->misses, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->sorts, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->comparisons, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->sort_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->bytes_moved, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->peak_count, peak_count, memory_order_relaxed);
+}
+#endif
+
+bool sps_stats(const sparse_set_t *set, sps_stats_t *stats) {
+    if (set == NULL || stats == NULL) {
+        sps_error("invalid arguments");
+        return false;
+    }
+
+#ifdef SPS_ENABLE_STATS
+    const sps_counters_t *counters = &set->stats;
+    *stats = (sps_stats_t){
+        .adds        = atomic_load_explicit(&counters->adds, memory_order_relaxed),
+        .removes     = atomic_load_explicit(&counters->removes, memory_order_relaxed),
+        .gets        = atomic_load_explicit(&counters->gets, memory_order_relaxed),
+        .misses      = atomic_load_explicit(&counters->misses, memory_order_relaxed),
+        .sorts       = atomic_load_explicit(&counters->sorts, memory_order_relaxed),
+        .comparisons = atomic_load_explicit(&counters->comparisons, memory_order_relaxed),
+        .sort_ns     = atomic_load_explicit(&counters->sort_ns, memory_order_relaxed),
+        .bytes_moved = atomic_load_explicit(&counters->bytes_moved, memory_order_relaxed),
+        .peak_count  = atomic_load_explicit(&counters->peak_count, memory_order_relaxed),
+    };
+    return true;
+#else
+    *stats = (sps_stats_t){0};
+    return false;
+#endif
+}
+
+void sps_stats_reset(sparse_set_t *set) {
+    if (set == NULL) {
+        sps_error("set cannot be NULL");
+        return;
+    }
+
+#ifdef SPS_ENABLE_STATS
+    sps_counters_reset(&set->stats, set->count);
+#endif
+}
+
+_Static_assert(offsetof(sparse_set_t, pages_used) <= SPS_SET_ALIGN,
+               "lookup fields of a set must fit on its first cache line");
+
+sparse_set_t *sps_new_desc(const sps_desc_t *desc) {
+    if (desc == NULL || desc->component_size == 0 || desc->max_capacity > SPARSE_SET_MAX ||
+        (desc->fields == NULL && desc->field_count > 0) || desc->field_count > UINT32_MAX ||
+        (desc->workspace == NULL && desc->workspace_size > 0)) {
+        sps_error("invalid arguments");
+        return NULL;
+    }
+
+    for (size_t i = 0; i < desc->field_count; i++) {
+        if (desc->fields[i].size == 0 || desc->fields[i].offset > desc->component_size ||
+            desc->component_size - desc->fields[i].offset < desc->fields[i].size) {
+            sps_error("field lies outside the component");
+            return NULL;
+        }
+    }
+
+    // Components of an aligned AoS set are aligned one after the other only
+    // if the stride is a multiple of the alignment
+    size_t alignment = desc->alignment;
+    if ((alignment & (alignment - 1)) != 0 || alignment > SPS_ALIGN_MAX ||
+        (alignment > 0 && desc->field_count == 0 && desc->component_size % alignment != 0)) {
+        sps_error("invalid alignment");
+        return NULL;
+    }
+
+    // Blocks are addressed by shifting the dense position
+    size_t block_length = desc->block_length;
+    if ((block_length & (block_length - 1)) != 0 || block_length > SPARSE_SET_MAX ||
+        (block_length > 0 && desc->field_count > 0)) {
+        sps_error("invalid block length");
+        return NULL;
+    }
+
+    const sps_allocator_t *allocator = desc->allocator != NULL ? desc->allocator : &sps_default_allocator;
+    if (allocator->alloc == NULL || allocator->release == NULL) {
+        sps_error("allocator is incomplete");
+        return NULL;
+    }
+
+    sparse_set_t *sps = sps_mem_alloc_aligned(allocator, sizeof(*sps), SPS_SET_ALIGN);
+    if (sps == NULL) {
+        sps_error("failed to allocate sparse set");
+        return NULL;
+    }
+
+    size_t max_capacity = desc->max_capacity > 0 ? desc->max_capacity : SPARSE_SET_MAX;
+
+    sps->component_size   = desc->component_size;
+    sps->alignment        = alignment > SPS_ALLOC_ALIGN ? alignment : SPS_ALLOC_ALIGN;
+    sps->count            = 0;
+    sps->capacity         = 0;
+    sps->max_capacity     = (uint32_t)max_capacity;
+    sps->sparse           = NULL;
+    sps->page_count       = 0;
+    sps->pages_used       = 0;
+    sps->tombstones       = 0;
+    sps->blocks           = NULL;
+    sps->block_bits       = 0;
+    sps->scratch          = desc->workspace;
+    sps->scratch_size     = desc->workspace_size;
+    sps->scratch_borrowed = desc->workspace != NULL;
+    sps->flags            = 0;
+    sps->advice           = SPS_ADVICE_NORMAL;
+    sps->marks            = NULL;
+    sps->dirty            = NULL;
+    sps->dirty_count      = 0;
+    sps->dirty_capacity   = 0;
+    sps->changed          = NULL;
+    sps->changed_count    = 0;
+    sps->changed_capacity = 0;
+    sps->removed          = NULL;
+    sps->removed_count    = 0;
+    sps->removed_capacity = 0;
+    sps->dense            = NULL;
+    sps->components       = NULL;
+    sps->columns          = NULL;
+    sps->column_count     = 0;
+    sps->group            = NULL;
+    sps->partitioned      = 0;
+    sps->mapping          = NULL;
+    sps->mapping_size     = 0;
+    sps->allocator        = *allocator;
+#ifdef SPS_ENABLE_STATS
+    sps_counters_reset(&sps->stats, 0);
+#endif
+
+    if (desc->field_count > 0) {
+        sps->columns = sps_mem_alloc(allocator, desc->field_count * sizeof(*sps->columns));
+        if (sps->columns == NULL) {
+            sps_error("failed to allocate sparse set columns");
+            sps_free(sps);
+            return NULL;
+        }
+
+        for (size_t i = 0; i < desc->field_count; i++) {
+            sps->columns[i] = (sps_column_t){
+                .data   = NULL,
+                .offset = desc->fields[i].offset,
+                .size   = desc->fields[i].size,
+            };
+        }
+        sps->column_count = (uint32_t)desc->field_count;
+        sps->flags |= SPS_SOA;
+    }
+
+    if (block_length > 0) {
+        while (((size_t)1 << sps->block_bits) < block_length) {
+            sps->block_bits++;
+        }
+        sps->flags |= SPS_PAGED;
+    }
+
+    size_t initial_capacity = desc->initial_capacity;
+    if (initial_capacity > max_capacity) initial_capacity = max_capacity;
+    if (initial_capacity > 0 && !sps_grow(sps, initial_capacity)) {
+        sps_error("failed to allocate sparse set storage");
+        sps_free(sps);
+        return NULL;
+    }
+
+    return sps;
+}
+
+sparse_set_t *sps_new_ex(size_t component_size, size_t initial_capacity, size_t max_capacity) {
+    if (component_size == 0 || max_capacity == 0 || max_capacity > SPARSE_SET_MAX) {
+        return NULL;
+    }
+
+    return sps_new_desc(&(sps_desc_t){
+        .component_size   = component_size,
+        .initial_capacity = initial_capacity,
+        .max_capacity     = max_capacity,
+    });
+}
+
+sparse_set_t *sps_new(size_t component_size) {
+    return sps_new_ex(component_size, SPS_DEFAULT_CAPACITY, SPARSE_SET_MAX);
+}
+
+sparse_set_t *sps_new_aligned(size_t component_size, size_t alignment) {
+    if (component_size == 0 || alignment == 0) {
+        sps_error("invalid arguments");
+        return NULL;
+    }
+
+    return sps_new_desc(&(sps_desc_t){
+        .component_size   = component_size,
+        .initial_capacity = SPS_DEFAULT_CAPACITY,
+        .alignment        = alignment,
+    });
+}
+
+sparse_set_t *sps_new_paged(size_t component_size, size_t block_length) {
+    if (component_size == 0 || block_length == 0) {
+        sps_error("invalid arguments");
+        return NULL;
+    }
+
+    return sps_new_desc(&(sps_desc_t){
+        .component_size   = component_size,
+        .initial_capacity = SPS_DEFAULT_CAPACITY,
+        .block_length     = block_length,
+    });
+}
+
+sparse_set_t *sps_new_soa(size_t component_size, const sps_field_t *fields, size_t field_count) {
+    if (fields == NULL || field_count == 0) {
+        sps_error("invalid arguments");
+        return NULL;
+    }
+
+    return sps_new_desc(&(sps_desc_t){
+        .component_size   = component_size,
+        .initial_capacity = SPS_DEFAULT_CAPACITY,
+        .fields           = fields,
+        .field_count      = field_count,
+    });
+}
+
+void *sps_column(sparse_set_t *set, size_t field) {
+    if (set == NULL || field >= set->column_count) {
+        sps_error("invalid arguments");
+        return NULL;
+    }
+
+    return set->columns[field].data;
+}
+
+void *sps_get_field(sparse_set_t *set, uint32_t index, size_t field) {
+    if (set == NULL || index == SPARSE_SET_MAX || field >= set->column_count) {
+        sps_error("invalid arguments");
+        return NULL;
+    }
+
+    uint32_t dense_idx = sps_lookup(set, index);
+    SPS_STAT_LOOKUP(set, dense_idx != SPARSE_SET_MAX);
+    if (dense_idx == SPARSE_SET_MAX) {
+        return NULL;
+    }
+
+    return set->columns[field].data + ((size_t)dense_idx * set->columns[field].size);
+}
+
+void sps_free(sparse_set_t *set) {
+    if (set == NULL) {
+        return;
+    }
+
+    // Copy the allocator out, the set itself is released last
+    sps_allocator_t allocator = set->allocator;
+    size_t capacity           = set->capacity;
+
+    for (uint32_t i = 0; i < set->page_count; i++) {
+        if (set->sparse[i] != sps_empty_page) {
+            sps_mem_free(&allocator, set->sparse[i], SPS_PAGE_SIZE * sizeof(**set->sparse));
+        }
+    }
+
+    sps_mem_free(&allocator, set->dirty, set->dirty_capacity * sizeof(*set->dirty));
+    sps_mem_free(&allocator, set->changed, set->changed_capacity * sizeof(*set->changed));
+    sps_mem_free(&allocator, set->removed, set->removed_capacity * sizeof(*set->removed));
+    sps_mem_free(&allocator, set->marks, capacity * sizeof(*set->marks));
+    if (!set->scratch_borrowed) {
+        sps_mem_free(&allocator, set->scratch, set->scratch_size);
+    }
+    sps_mem_free(&allocator, set->sparse, set->page_count * sizeof(*set->sparse));
+
+    // The storage of a mapped set belongs to the file mapping
+    if (set->mapping != NULL) {
+        sps_unmap(set);
+    }
+    sps_mem_free(&allocator, set->dense, capacity * sizeof(*set->dense));
+    sps_mem_free(&allocator, set->components, capacity * set->component_size);
+    if (set->flags & SPS_PAGED) {
+        sps_resize_blocks(set, capacity, 0);
+    }
+    for (uint32_t i = 0; i < set->column_count; i++) {
+        sps_mem_free(&allocator, set->columns[i].data, capacity * set->columns[i].size);
+    }
+    sps_mem_free(&allocator, set->columns, set->column_count * sizeof(*set->columns));
+    sps_mem_free(&allocator, set, sizeof(*set));
 }
@@ -0,0 +1,93 @@
+#if defined(__linux__)
+#define _DEFAULT_SOURCE
+#define SPS_HAVE_MADVISE 1
+#elif defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#define SPS_HAVE_MADVISE 1
+#endif
+
+#include <stdint.h>
+
+#if defined(SPS_HAVE_MADVISE)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "sps.h"
+#include "sps_internal.h"
+
+#if defined(SPS_HAVE_MADVISE)
+/** Apply an advice to the whole pages inside a block, blocks smaller than a page are skipped */
+static bool sps_advise_block(void *block, size_t size, sps_advice_t advice) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (block == NULL || page_size <= 0) {
+        return block == NULL;
+    }
+
+    uintptr_t mask  = (uintptr_t)page_size - 1;
+    uintptr_t begin = ((uintptr_t)block + mask) & ~mask;
+    uintptr_t end   = ((uintptr_t)block + size) & ~mask;
+    if (end <= begin) {
+        return true;
+    }
+
+    void *pages   = (void *)begin;
+    size_t length = (size_t)(end - begin);
+    switch (advice) {
+        case SPS_ADVICE_NORMAL:
+            return posix_madvise(pages, length, POSIX_MADV_NORMAL) == 0;
+        case SPS_ADVICE_SEQUENTIAL:
+            return posix_madvise(pages, length, POSIX_MADV_SEQUENTIAL) == 0;
+        case SPS_ADVICE_HUGE_PAGES:
+#if defined(MADV_HUGEPAGE)
+            return madvise(pages, length, MADV_HUGEPAGE) == 0;
+#else
+            return false;
+#endif
+        default:
+            return false;
+    }
+}
+#endif
+
+bool sps_advise_storage(sparse_set_t *set) {
+#if defined(SPS_HAVE_MADVISE)
+    sps_advice_t advice = (sps_advice_t)set->advice;
+    bool applied        = sps_advise_block(set->dense, set->capacity * sizeof(*set->dense), advice);
+
+    if (set->flags & SPS_PAGED) {
+        size_t length = (size_t)1 << set->block_bits;
+        size_t blocks = ((size_t)set->capacity + length - 1) >> set->block_bits;
+        for (size_t b = 0; b < blocks; b++) {
+            applied &= sps_advise_block(set->blocks[b], length * set->component_size, advice);
+        }
+    } else if (set->columns == NULL) {
+        applied &= sps_advise_block(set->components, set->capacity * set->component_size, advice);
+    }
+
+    for (uint32_t i = 0; i < set->column_count; i++) {
+        applied &= sps_advise_block(set->columns[i].data, set->capacity * set->columns[i].size, advice);
+    }
+
+    return applied;
+#else
+    (void)set;
+    return false;
+#endif
+}
+
+bool sps_advise(sparse_set_t *set, sps_advice_t advice) {
+    if (set == NULL || (unsigned)advice > SPS_ADVICE_HUGE_PAGES) {
+        sps_error("invalid arguments");
+        return false;
+    }
+
+    uint32_t previous = set->advice;
+    set->advice       = (uint32_t)advice;
+    if (!sps_advise_storage(set)) {
+        set->advice = previous;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,198 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "sps.h"
+#include "sps_internal.h"
+
+// Define SPS_NO_SIMD to always take the scalar paths
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && !defined(SPS_NO_SIMD)
+#define SPS_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+/** @brief Number of entity bits held by one bitmap word */
+#define SPS_BITMAP_WORD_BITS (64U)
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SPS_POPCOUNT(word) ((size_t)__builtin_popcountll(word))
+#define SPS_CTZ(word) ((uint32_t)__builtin_ctzll(word))
+#else
+static inline size_t sps_popcount(uint64_t word) {
+    size_t count = 0;
+    for (; word != 0; word &= word - 1) count++;
+    return count;
+}
+
+static inline uint32_t sps_ctz(uint64_t word) {
+    uint32_t bit = 0;
+    for (; !(word & 1U); word >>= 1) bit++;
+    return bit;
+}
+
+#define SPS_POPCOUNT(word) sps_popcount(word)
+#define SPS_CTZ(word) sps_ctz(word)
+#endif
+
+/**
+ * Membership bits of up to 64 indices, one slot at a time. Slots are
+ * prefetched up to ahead indices from the start, past the end of the word.
+ */
+static uint64_t sps_has_word(const sparse_set_t *set,
+                             const uint32_t *indices,
+                             size_t n,
+                             size_t ahead) {
+    uint64_t word = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i + SPS_PREFETCH_DISTANCE < ahead) {
+            sps_prefetch_slot(set, indices[i + SPS_PREFETCH_DISTANCE]);
+        }
+
+        if (sps_lookup(set, indices[i]) != SPARSE_SET_MAX) {
+            word |= (uint64_t)1 << i;
+        }
+    }
+
+    return word;
+}
+
+#if defined(SPS_HAVE_AVX2)
+_Static_assert(sizeof(sps_slot_t) == 8, "gathers address slots with a scale of 8");
+
+/**
+ * Membership bits of up to 64 indices, four at a time: one gather loads the
+ * pages of four indices, a second one their slots. Lanes past the page
+ * directory are masked off and read as absent.
+ */
+__attribute__((target("avx2"))) static uint64_t sps_has_word_avx2(const sparse_set_t *set,
+                                                                  const uint32_t *indices,
+                                                                  size_t n,
+                                                                  size_t ahead) {
+    (void)ahead;
+    const __m128i page_count = _mm_set1_epi32((int)set->page_count);
+    const __m256i slot_mask  = _mm256_set1_epi64x(SPS_PAGE_MASK);
+    const __m256i dense_field = _mm256_set1_epi64x((long long)offsetof(sps_slot_t, dense) -
+                                                   (long long)(uintptr_t)sps_empty_page);
+
+    uint64_t word = 0;
+    size_t i      = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i index = _mm_loadu_si128((const __m128i *)(const void *)(indices + i));
+        __m128i page  = _mm_srli_epi32(index, SPS_PAGE_BITS);
+
+        // Pages fit in 31 bits, so the signed compare is exact
+        __m128i mapped = _mm_cmpgt_epi32(page_count, page);
+        __m256i pages  = _mm256_mask_i32gather_epi64(_mm256_setzero_si256(),
+                                                    (const long long *)(const void *)set->sparse,
+                                                    page,
+                                                    _mm256_cvtepi32_epi64(mapped),
+                                                    8);
+
+        // Slot addresses relative to sps_empty_page, which serves as the gather base
+        __m256i slot   = _mm256_and_si256(_mm256_cvtepu32_epi64(index), slot_mask);
+        slot           = _mm256_slli_epi64(slot, 3);
+        __m256i offset = _mm256_add_epi64(_mm256_add_epi64(pages, slot), dense_field);
+        __m128i dense  = _mm256_mask_i64gather_epi32(
+            _mm_setzero_si128(), (const int *)(const void *)sps_empty_page, offset, mapped, 1);
+
+        __m128i absent = _mm_cmpeq_epi32(dense, _mm_setzero_si128());
+        uint64_t bits  = (uint64_t)(~_mm_movemask_ps(_mm_castsi128_ps(absent)) & 0xF);
+        word |= bits << i;
+    }
+
+    if (i < n) {
+        word |= sps_has_word(set, indices + i, n - i, n - i) << i;
+    }
+    return word;
+}
+#endif
+
+size_t sps_has_many(sparse_set_t *set, const uint32_t *indices, size_t n, uint64_t *out) {
+    if (set == NULL || ((indices == NULL || out == NULL) && n > 0)) {
+        sps_error("invalid arguments");
+        return 0;
+    }
+
+    uint64_t (*has_word)(const sparse_set_t *, const uint32_t *, size_t, size_t) = sps_has_word;
+#if defined(SPS_HAVE_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        has_word = sps_has_word_avx2;
+    }
+#endif
+
+    size_t found = 0;
+    for (size_t i = 0; i < n; i += SPS_BITMAP_WORD_BITS) {
+        size_t len    = n - i < SPS_BITMAP_WORD_BITS ? n - i : SPS_BITMAP_WORD_BITS;
+        uint64_t word = has_word(set, indices + i, len, n - i);
+
+        out[i / SPS_BITMAP_WORD_BITS] = word;
+        found += SPS_POPCOUNT(word);
+    }
+
+    SPS_STAT_LOOKUPS(set, n, found);
+    return found;
+}
+
+size_t sps_bitmap_words(const sparse_set_t *set) {
+    if (set == NULL) {
+        sps_error("set cannot be NULL");
+        return 0;
+    }
+
+    return (size_t)set->page_count * (SPS_PAGE_SIZE / SPS_BITMAP_WORD_BITS);
+}
+
+size_t sps_bitmap_export(const sparse_set_t *set, uint64_t *bits, size_t words) {
+    if (set == NULL || (bits == NULL && words > 0)) {
+        sps_error("invalid arguments");
+        return 0;
+    }
+
+    if (words == 0) {
+        return 0;
+    }
+
+    memset(bits, 0, words * sizeof(*bits));
+
+    size_t found = 0;
+    for (uint32_t i = 0; i < set->count; i++) {
+        uint32_t index = set->dense[i];
+        if (index != SPS_TOMBSTONE && index / SPS_BITMAP_WORD_BITS < words) {
+            bits[index / SPS_BITMAP_WORD_BITS] |= (uint64_t)1 << (index % SPS_BITMAP_WORD_BITS);
+            found++;
+        }
+    }
+
+    return found;
+}
+
+size_t sps_bitmap_and(uint64_t *dst, const uint64_t *src, size_t words) {
+    if ((dst == NULL || src == NULL) && words > 0) {
+        sps_error("invalid arguments");
+        return 0;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < words; i++) {
+        dst[i] &= src[i];
+        count += SPS_POPCOUNT(dst[i]);
+    }
+
+    return count;
+}
+
+size_t sps_bitmap_indices(const uint64_t *bits, size_t words, uint32_t *out) {
+    if ((bits == NULL || out == NULL) && words > 0) {
+        sps_error("invalid arguments");
+        return 0;
+    }
+
+    // Each set bit is found directly, empty words cost a single test
+    size_t count = 0;
+    for (size_t i = 0; i < words; i++) {
+        for (uint64_t word = bits[i]; word != 0; word &= word - 1) {
+            out[count++] = (uint32_t)(i * SPS_BITMAP_WORD_BITS + SPS_CTZ(word));
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,197 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "sps.h"
+#include "sps_internal.h"
+
+/** @brief Number of entries a change list starts with */
+#define SPS_CHANGES_MIN_CAPACITY (16U)
+
+static bool sps_push_id(sparse_set_t *set, uint32_t **list, uint32_t *count, uint32_t *capacity, uint32_t id) {
+    if (*count == *capacity) {
+        size_t grown = *capacity > 0 ? (size_t)*capacity * 2 : SPS_CHANGES_MIN_CAPACITY;
+        if (grown > UINT32_MAX) {
+            return false;
+        }
+
+        uint32_t *ids = sps_mem_realloc(&set->allocator, *list, *capacity * sizeof(*ids), grown * sizeof(*ids));
+        if (ids == NULL) {
+            return false;
+        }
+
+        *list     = ids;
+        *capacity = (uint32_t)grown;
+    }
+
+    (*list)[(*count)++] = id;
+    return true;
+}
+
+void sps_mark_changed(sparse_set_t *set, uint32_t dense_idx, uint8_t mark) {
+    if (!(set->flags & SPS_TRACK_CHANGES)) {
+        return;
+    }
+
+    // An entity goes on the list the first time it changes, later changes only add bits
+    uint8_t *slot = &set->marks[dense_idx];
+    if (!(*slot & SPS_MARK_CHANGED) && !(set->flags & SPS_CHANGES_LOST) &&
+        !sps_push_id(set, &set->changed, &set->changed_count, &set->changed_capacity, set->dense[dense_idx])) {
+        set->flags |= SPS_CHANGES_LOST;
+    }
+
+    *slot |= mark;
+}
+
+void sps_mark_removed(sparse_set_t *set, uint32_t dense_idx) {
+    if (!(set->flags & SPS_TRACK_CHANGES)) {
+        return;
+    }
+
+    // The change list entry stays behind, it is dropped when the list is next compacted
+    uint8_t mark = set->marks[dense_idx];
+    if (mark & SPS_MARK_CHANGED) {
+        set->flags |= SPS_CHANGES_STALE;
+    }
+
+    // Entities added since the last clear were never seen by the consumer
+    if (!(mark & SPS_MARK_ADDED) && !(set->flags & SPS_CHANGES_LOST) &&
+        !sps_push_id(set, &set->removed, &set->removed_count, &set->removed_capacity, set->dense[dense_idx])) {
+        set->flags |= SPS_CHANGES_LOST;
+    }
+}
+
+/** Drop entries of removed entities and repeats of entities removed and added again */
+static void sps_changes_compact(sparse_set_t *set) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < set->changed_count; i++) {
+        uint32_t index     = set->changed[i];
+        uint32_t dense_idx = sps_lookup(set, index);
+        if (dense_idx == SPARSE_SET_MAX || !(set->marks[dense_idx] & SPS_MARK_CHANGED) ||
+            (set->marks[dense_idx] & SPS_MARK_SEEN)) {
+            continue;
+        }
+
+        set->marks[dense_idx] |= SPS_MARK_SEEN;
+        set->changed[kept++] = index;
+    }
+
+    for (uint32_t i = 0; i < kept; i++) {
+        set->marks[sps_lookup(set, set->changed[i])] &= (uint8_t)~SPS_MARK_SEEN;
+    }
+
+    set->changed_count = kept;
+    set->flags &= ~SPS_CHANGES_STALE;
+}
+
+bool sps_track_changes(sparse_set_t *set, bool enable) {
+    if (set == NULL) {
+        sps_error("invalid arguments");
+        return false;
+    }
+
+    if (!enable) {
+        sps_changes_clear(set);
+        sps_mem_free(&set->allocator, set->changed, set->changed_capacity * sizeof(*set->changed));
+        sps_mem_free(&set->allocator, set->removed, set->removed_capacity * sizeof(*set->removed));
+        set->changed          = NULL;
+        set->changed_capacity = 0;
+        set->removed          = NULL;
+        set->removed_capacity = 0;
+        set->flags &= ~SPS_TRACK_CHANGES;
+        return true;
+    }
+
+    if (!sps_alloc_marks(set)) {
+        sps_error("failed to allocate change marks");
+        return false;
+    }
+
+    set->flags |= SPS_TRACK_CHANGES;
+    return true;
+}
+
+sps_change_iter_t sps_changes_iter(sparse_set_t *set) {
+    if (set == NULL) {
+        sps_error("invalid arguments");
+        return (sps_change_iter_t){0};
+    }
+
+    if ((set->flags & SPS_CHANGES_STALE) && !(set->flags & SPS_CHANGES_LOST)) {
+        sps_changes_compact(set);
+    }
+
+    return (sps_change_iter_t){.set = set, .index = 0};
+}
+
+void *sps_changes_next(sps_change_iter_t *iter, uint32_t *index, uint32_t *kind) {
+    if (iter == NULL) {
+        sps_error("invalid function paramaters");
+        return NULL;
+    }
+
+    sparse_set_t *set = iter->set;
+    if (set == NULL) {
+        return NULL;
+    }
+
+    // Without a complete list the marks are the only record, so every slot is visited
+    bool scan          = set->flags & SPS_CHANGES_LOST;
+    uint32_t end       = scan ? set->count : set->changed_count;
+    uint32_t dense_idx = SPARSE_SET_MAX;
+    while (iter->index < end) {
+        uint32_t at = iter->index++;
+        dense_idx   = scan ? at : sps_lookup(set, set->changed[at]);
+        if (dense_idx != SPARSE_SET_MAX && (set->marks[dense_idx] & SPS_MARK_CHANGED)) {
+            break;
+        }
+        dense_idx = SPARSE_SET_MAX;
+    }
+
+    if (dense_idx == SPARSE_SET_MAX) {
+        return NULL;
+    }
+
+    if (index != NULL) {
+        *index = set->dense[dense_idx];
+    }
+
+    if (kind != NULL) {
+        *kind = (set->marks[dense_idx] & SPS_MARK_CHANGED) >> 1;
+    }
+
+    return sps_element(set, dense_idx);
+}
+
+size_t sps_changes_removed(const sparse_set_t *set, const uint32_t **indices) {
+    if (set == NULL || indices == NULL) {
+        sps_error("invalid arguments");
+        return 0;
+    }
+
+    *indices = set->removed;
+    return set->removed_count;
+}
+
+void sps_changes_clear(sparse_set_t *set) {
+    if (set == NULL) {
+        sps_error("invalid arguments");
+        return;
+    }
+
+    if (set->flags & SPS_CHANGES_LOST) {
+        for (uint32_t i = 0; i < set->count; i++) {
+            set->marks[i] &= (uint8_t)~SPS_MARK_CHANGED;
+        }
+    } else {
+        for (uint32_t i = 0; i < set->changed_count; i++) {
+            uint32_t dense_idx = sps_lookup(set, set->changed[i]);
+            if (dense_idx != SPARSE_SET_MAX) {
+                set->marks[dense_idx] &= (uint8_t)~SPS_MARK_CHANGED;
+            }
+        }
+    }
+
+    set->changed_count = 0;
+    set->removed_count = 0;
+    set->flags &= ~(SPS_CHANGES_STALE | SPS_CHANGES_LOST);
+}
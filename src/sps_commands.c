@@ -0,0 +1,256 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sps.h"
+#include "sps_internal.h"
+
+/** @brief Number of bits sorted per radix pass when grouping commands */
+#define SPS_COMMAND_RADIX_BITS (8U)
+
+/** @brief Number of buckets per radix pass when grouping commands */
+#define SPS_COMMAND_RADIX_BUCKETS (1U << SPS_COMMAND_RADIX_BITS)
+
+static inline sps_command_t *sps_command_at(const sps_commands_t *commands, uint32_t slot) {
+    return (sps_command_t *)(void *)(commands->records + (size_t)slot * commands->record_size);
+}
+
+static inline uint8_t *sps_command_payload(sps_command_t *command) {
+    return (uint8_t *)(command + 1);
+}
+
+sps_commands_t *sps_commands_new(sparse_set_t *set, size_t capacity) {
+    if (set == NULL || capacity == 0 || capacity > SPARSE_SET_MAX) {
+        sps_error("invalid arguments");
+        return NULL;
+    }
+
+    size_t align       = _Alignof(sps_command_t);
+    size_t record_size = (sizeof(sps_command_t) + set->component_size + align - 1) & ~(align - 1);
+    if (capacity > SIZE_MAX / record_size || capacity > SIZE_MAX / (4 * sizeof(uint32_t))) {
+        sps_error("command buffer is too large");
+        return NULL;
+    }
+
+    sps_commands_t *commands = sps_mem_alloc(&set->allocator, sizeof(*commands));
+    if (commands == NULL) {
+        sps_error("failed to allocate command buffer");
+        return NULL;
+    }
+
+    commands->set         = set;
+    commands->record_size = record_size;
+    commands->capacity    = (uint32_t)capacity;
+    commands->records     = sps_mem_alloc(&set->allocator, capacity * record_size);
+    commands->order       = sps_mem_alloc(&set->allocator, 4 * capacity * sizeof(uint32_t));
+    atomic_init(&commands->reserved, 0);
+
+    if (commands->records == NULL || commands->order == NULL) {
+        sps_error("failed to allocate command buffer");
+        sps_commands_free(commands);
+        return NULL;
+    }
+
+    return commands;
+}
+
+static sps_command_t *sps_command_claim(sps_commands_t *commands, uint32_t index, sps_command_op_t op) {
+    if (commands == NULL || index == SPARSE_SET_MAX) {
+        sps_error("invalid arguments");
+        return NULL;
+    }
+
+    // Slots past the capacity are never handed out, the counter may overshoot
+    size_t slot = atomic_fetch_add_explicit(&commands->reserved, 1, memory_order_relaxed);
+    if (slot >= commands->capacity) {
+        return NULL;
+    }
+
+    sps_command_t *command = sps_command_at(commands, (uint32_t)slot);
+    command->index         = index;
+    command->op            = (uint32_t)op;
+    return command;
+}
+
+bool sps_defer_add(sps_commands_t *commands, uint32_t index, const void *component) {
+    if (component == NULL) {
+        sps_error("invalid arguments");
+        return false;
+    }
+
+    sps_command_t *command = sps_command_claim(commands, index, SPS_COMMAND_ADD);
+    if (command == NULL) {
+        return false;
+    }
+
+    memcpy(sps_command_payload(command), component, commands->set->component_size);
+    return true;
+}
+
+bool sps_defer_add_or_replace(sps_commands_t *commands, uint32_t index, const void *component) {
+    if (component == NULL) {
+        sps_error("invalid arguments");
+        return false;
+    }
+
+    sps_command_t *command = sps_command_claim(commands, index, SPS_COMMAND_ADD_OR_REPLACE);
+    if (command == NULL) {
+        return false;
+    }
+
+    memcpy(sps_command_payload(command), component, commands->set->component_size);
+    return true;
+}
+
+bool sps_defer_remove(sps_commands_t *commands, uint32_t index) {
+    return sps_command_claim(commands, index, SPS_COMMAND_REMOVE) != NULL;
+}
+
+/**
+ * Stable LSD radix sort of the record slots by entity index, so commands of
+ * one entity stay in the order their slots were claimed.
+ */
+static uint32_t *sps_command_order(const sps_commands_t *commands, uint32_t n) {
+    uint32_t *keys       = commands->order;
+    uint32_t *order      = keys + n;
+    uint32_t *temp_keys  = order + n;
+    uint32_t *temp_order = temp_keys + n;
+
+    uint32_t any = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        keys[i]  = sps_command_at(commands, i)->index;
+        order[i] = i;
+        any |= keys[i];
+    }
+
+    for (uint32_t shift = 0; shift < 32 && (any >> shift) != 0; shift += SPS_COMMAND_RADIX_BITS) {
+        uint32_t counts[SPS_COMMAND_RADIX_BUCKETS] = {0};
+        for (uint32_t i = 0; i < n; i++) {
+            counts[(keys[i] >> shift) & (SPS_COMMAND_RADIX_BUCKETS - 1)]++;
+        }
+
+        uint32_t offset = 0;
+        for (uint32_t bucket = 0; bucket < SPS_COMMAND_RADIX_BUCKETS; bucket++) {
+            uint32_t count = counts[bucket];
+            counts[bucket] = offset;
+            offset += count;
+        }
+
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t dst    = counts[(keys[i] >> shift) & (SPS_COMMAND_RADIX_BUCKETS - 1)]++;
+            temp_keys[dst]  = keys[i];
+            temp_order[dst] = order[i];
+        }
+
+        uint32_t *swap = keys;
+        keys           = temp_keys;
+        temp_keys      = swap;
+        swap           = order;
+        order          = temp_order;
+        temp_order     = swap;
+    }
+
+    return order;
+}
+
+size_t sps_flush(sps_commands_t *commands) {
+    if (commands == NULL) {
+        sps_error("invalid arguments");
+        return 0;
+    }
+
+    size_t reserved = atomic_load_explicit(&commands->reserved, memory_order_acquire);
+    uint32_t n      = reserved < commands->capacity ? (uint32_t)reserved : commands->capacity;
+    if (n == 0) {
+        return 0;
+    }
+
+    SPS_ZONE_BEGIN(zone, "sps_flush");
+    sparse_set_t *set     = commands->set;
+    const uint32_t *order = sps_command_order(commands, n);
+
+    for (uint32_t i = 0; i < n;) {
+        if (i + SPS_PREFETCH_DISTANCE < n) {
+            sps_prefetch_slot(set, sps_command_at(commands, order[i + SPS_PREFETCH_DISTANCE])->index);
+        }
+
+        // Fold every command of the entity into its final state
+        uint32_t index = sps_command_at(commands, order[i])->index;
+        bool present   = sps_lookup(set, index) != SPARSE_SET_MAX;
+        bool exists    = present;
+        uint8_t *value = NULL;
+
+        for (; i < n && sps_command_at(commands, order[i])->index == index; i++) {
+            sps_command_t *command = sps_command_at(commands, order[i]);
+            switch ((sps_command_op_t)command->op) {
+                case SPS_COMMAND_ADD:
+                    if (exists) {
+                        sps_error("sparse set is already set at index");
+                        break;
+                    }
+                    exists = true;
+                    value  = sps_command_payload(command);
+                    break;
+                case SPS_COMMAND_ADD_OR_REPLACE:
+                    exists = true;
+                    value  = sps_command_payload(command);
+                    break;
+                case SPS_COMMAND_REMOVE:
+                    if (!exists) {
+                        sps_error("sparse index is not in use");
+                        break;
+                    }
+                    exists = false;
+                    value  = NULL;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        if (present && !exists) {
+            sps_remove(set, index);
+        } else if (exists && value != NULL) {
+            sps_add_or_replace(set, index, value);
+        }
+    }
+
+    atomic_store_explicit(&commands->reserved, 0, memory_order_release);
+    SPS_ZONE_END(zone);
+    return n;
+}
+
+void sps_commands_replay(sps_commands_t *commands, sparse_set_t *set) {
+    size_t reserved = atomic_load_explicit(&commands->reserved, memory_order_acquire);
+    uint32_t n      = reserved < commands->capacity ? (uint32_t)reserved : commands->capacity;
+
+    for (uint32_t i = 0; i < n; i++) {
+        sps_command_t *command = sps_command_at(commands, i);
+        switch ((sps_command_op_t)command->op) {
+            case SPS_COMMAND_ADD:
+                sps_add(set, command->index, sps_command_payload(command));
+                break;
+            case SPS_COMMAND_ADD_OR_REPLACE:
+                sps_add_or_replace(set, command->index, sps_command_payload(command));
+                break;
+            case SPS_COMMAND_REMOVE:
+                sps_remove(set, command->index);
+                break;
+            default:
+                break;
+        }
+    }
+
+    atomic_store_explicit(&commands->reserved, 0, memory_order_release);
+}
+
+void sps_commands_free(sps_commands_t *commands) {
+    if (commands == NULL) {
+        return;
+    }
+
+    const sps_allocator_t *allocator = &commands->set->allocator;
+    sps_mem_free(allocator, commands->records, commands->capacity * commands->record_size);
+    sps_mem_free(allocator, commands->order, 4 * (size_t)commands->capacity * sizeof(uint32_t));
+    sps_mem_free(allocator, commands, sizeof(*commands));
+}
@@ -0,0 +1,132 @@
+#include <stdint.h>
+
+#include "sps.h"
+#include "sps_internal.h"
+
+static bool sps_group_contains(const sps_group_t *group, uint32_t index) {
+    for (uint32_t s = 0; s < group->set_count; s++) {
+        uint32_t dense_idx = sps_lookup(group->sets[s], index);
+        if (dense_idx == SPARSE_SET_MAX || dense_idx < group->size) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void sps_group_join(sps_group_t *group, uint32_t index) {
+    if (!sps_group_contains(group, index)) {
+        return;
+    }
+
+    for (uint32_t s = 0; s < group->set_count; s++) {
+        sparse_set_t *set = group->sets[s];
+        sps_swap(set, sps_lookup(set, index), group->size);
+    }
+    group->size++;
+}
+
+void sps_group_leave(sps_group_t *group, uint32_t index) {
+    // The entity is in the prefix, so it is in every member
+    group->size--;
+    for (uint32_t s = 0; s < group->set_count; s++) {
+        sparse_set_t *set = group->sets[s];
+        sps_swap(set, sps_lookup(set, index), group->size);
+    }
+}
+
+sps_group_t *sps_group_new(sparse_set_t *const *sets, size_t set_count) {
+    if (sets == NULL || set_count == 0 || set_count > SPS_GROUP_MAX_SETS) {
+        sps_error("invalid arguments");
+        return NULL;
+    }
+
+    for (size_t i = 0; i < set_count; i++) {
+        if (sets[i] == NULL || sets[i]->group != NULL) {
+            sps_error("sparse set is invalid or already owned");
+            return NULL;
+        }
+
+        if (sets[i]->flags & SPS_READ_ONLY) {
+            sps_error("cannot group a read-only set");
+            return NULL;
+        }
+
+        if (sets[i]->flags & SPS_STABLE_REMOVE) {
+            sps_error("cannot group a set with stable removal");
+            return NULL;
+        }
+
+        sps_assert_unpartitioned(sets[i]);
+
+        for (size_t j = 0; j < i; j++) {
+            if (sets[j] == sets[i]) {
+                sps_error("sparse set appears twice in group");
+                return NULL;
+            }
+        }
+    }
+
+    sps_group_t *group = sps_mem_alloc(&sets[0]->allocator, sizeof(*group));
+    if (group == NULL) {
+        sps_error("failed to allocate group");
+        return NULL;
+    }
+
+    // Walk the smallest member and pull every shared entity to the front
+    const sparse_set_t *driver = sets[0];
+    for (size_t i = 0; i < set_count; i++) {
+        group->sets[i] = sets[i];
+        if (sets[i]->count < driver->count) driver = sets[i];
+    }
+    group->set_count = (uint32_t)set_count;
+    group->size      = 0;
+
+    for (uint32_t pos = 0; pos < driver->count; pos++) {
+        sps_group_join(group, driver->dense[pos]);
+    }
+
+    for (size_t i = 0; i < set_count; i++) {
+        sets[i]->group = group;
+        sets[i]->flags |= SPS_OWNED;
+    }
+
+    return group;
+}
+
+size_t sps_group_size(const sps_group_t *group) {
+    if (group == NULL) {
+        sps_error("group cannot be NULL");
+        return 0;
+    }
+
+    return group->size;
+}
+
+sparse_set_span_t sps_group_span(const sps_group_t *group, size_t set) {
+    if (group == NULL || set >= group->set_count) {
+        sps_error("invalid arguments");
+        return (sparse_set_span_t){0};
+    }
+
+    sparse_set_t *member = group->sets[set];
+    return (sparse_set_span_t){
+        .entities   = member->dense,
+        .components = member->columns == NULL && !(member->flags & SPS_PAGED) ? member->components : NULL,
+        .begin      = 0,
+        .count      = group->size,
+    };
+}
+
+void sps_group_free(sps_group_t *group) {
+    if (group == NULL) {
+        return;
+    }
+
+    for (uint32_t s = 0; s < group->set_count; s++) {
+        group->sets[s]->group = NULL;
+        group->sets[s]->flags &= ~SPS_OWNED;
+    }
+
+    sps_mem_free(&group->sets[0]->allocator, group, sizeof(*group));
+}
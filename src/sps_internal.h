@@ -0,0 +1,541 @@
+/**
+ * @file sps_internal.h
+ * @brief Helpers shared between the translation units of the library
+ */
+
+#ifndef SPS_INTERNAL_H_
+#define SPS_INTERNAL_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sps.h"
+
+#ifdef SPS_ZONE_HEADER
+#include SPS_ZONE_HEADER
+#endif
+
+#ifndef NDEBUG
+#define sps_error(msg)                                            \
+    do {                                                          \
+        fprintf(stderr,                                           \
+                "sparse set assertion error in %s (%s:%d): %s\n", \
+                __func__,                                         \
+                __FILE_NAME__,                                    \
+                __LINE__,                                         \
+                (msg));                                           \
+        abort();                                                  \
+    } while (0)
+#else
+#define sps_error(msg) (void)msg
+#endif
+
+#ifndef NDEBUG
+#define sps_assert_unpartitioned(set)                                   \
+    do {                                                                \
+        if ((set)->partitioned > 0) {                                   \
+            sps_error("structural change while the set is partitioned"); \
+        }                                                               \
+    } while (0)
+#else
+#define sps_assert_unpartitioned(set) ((void)(set))
+#endif
+
+#define SPS_PAGE_MASK (SPS_PAGE_SIZE - 1U)
+
+#ifndef SPS_ZONE_BEGIN
+/**
+ * @brief Open a profiler zone around a sort or bulk operation
+ *
+ * Expands to nothing unless SPS_ZONE_HEADER names a header that defines
+ * SPS_ZONE_BEGIN(zone, name) and SPS_ZONE_END(zone), for example on top of
+ * TracyCZoneN and TracyCZoneEnd. The zone ends in the same scope it began.
+ */
+#define SPS_ZONE_BEGIN(zone, name) ((void)0)
+#define SPS_ZONE_END(zone) ((void)0)
+#endif
+
+#ifdef SPS_ENABLE_STATS
+/** Add to a counter that only calls modifying the set write, a plain load and store is enough */
+static inline void sps_counter_add(_Atomic uint64_t *counter, uint64_t n) {
+    uint64_t value = atomic_load_explicit(counter, memory_order_relaxed);
+    atomic_store_explicit(counter, value + n, memory_order_relaxed);
+}
+
+/** @brief Add n to a usage counter of a set, from a call that modifies the set */
+#define SPS_STAT_ADD(set, field, n) sps_counter_add(&(set)->stats.field, (uint64_t)(n))
+
+/** @brief Count n lookups of which found hit, readers may be counting at the same time */
+#define SPS_STAT_LOOKUPS(set, n, found)                                                      \
+    do {                                                                                     \
+        atomic_fetch_add_explicit(&(set)->stats.gets, (uint64_t)(n), memory_order_relaxed); \
+        if ((uint64_t)(n) != (uint64_t)(found)) {                                            \
+            atomic_fetch_add_explicit(&(set)->stats.misses,                                  \
+                                      (uint64_t)(n) - (uint64_t)(found),                     \
+                                      memory_order_relaxed);                                 \
+        }                                                                                    \
+    } while (0)
+
+/** @brief Count a lookup and whether it missed */
+#define SPS_STAT_LOOKUP(set, found) SPS_STAT_LOOKUPS(set, 1U, (found) ? 1U : 0U)
+
+/** @brief Raise the peak count to the current count */
+#define SPS_STAT_PEAK(set)                                                                \
+    do {                                                                                  \
+        _Atomic uint32_t *peak_ = &(set)->stats.peak_count;                               \
+        if ((set)->count > atomic_load_explicit(peak_, memory_order_relaxed)) {           \
+            atomic_store_explicit(peak_, (set)->count, memory_order_relaxed);             \
+        }                                                                                 \
+    } while (0)
+
+static inline uint64_t sps_stats_clock(void) {
+    struct timespec now;
+    if (timespec_get(&now, TIME_UTC) == 0) {
+        return 0;
+    }
+    return (uint64_t)now.tv_sec * 1000000000U + (uint64_t)now.tv_nsec;
+}
+
+/** Count a sort that started at the given sps_stats_clock reading */
+static inline void sps_stats_sorted(sparse_set_t *set, uint64_t start) {
+    if (set != NULL) {
+        sps_counter_add(&set->stats.sorts, 1);
+        sps_counter_add(&set->stats.sort_ns, sps_stats_clock() - start);
+    }
+}
+#else
+#define SPS_STAT_ADD(set, field, n) ((void)0)
+#define SPS_STAT_LOOKUPS(set, n, found) ((void)0)
+#define SPS_STAT_LOOKUP(set, found) ((void)0)
+#define SPS_STAT_PEAK(set) ((void)0)
+
+static inline uint64_t sps_stats_clock(void) {
+    return 0;
+}
+
+static inline void sps_stats_sorted(sparse_set_t *set, uint64_t start) {
+    (void)set;
+    (void)start;
+}
+#endif
+
+/** @brief Alignment requested for every block */
+#define SPS_ALLOC_ALIGN (_Alignof(max_align_t))
+
+/** @brief Alignment of a set itself, the size of a cache line */
+#define SPS_SET_ALIGN (64U)
+
+/** @brief Allocator of sets created without one, backed by malloc and free */
+extern const sps_allocator_t sps_default_allocator;
+
+static inline void *sps_mem_alloc_aligned(const sps_allocator_t *allocator,
+                                          size_t size,
+                                          size_t align) {
+    return allocator->alloc(size, align, allocator->ctx);
+}
+
+static inline void *sps_mem_alloc(const sps_allocator_t *allocator, size_t size) {
+    return sps_mem_alloc_aligned(allocator, size, SPS_ALLOC_ALIGN);
+}
+
+static inline void sps_mem_free(const sps_allocator_t *allocator, void *ptr, size_t size) {
+    if (ptr != NULL) {
+        allocator->release(ptr, size, allocator->ctx);
+    }
+}
+
+static inline void *sps_mem_realloc_aligned(const sps_allocator_t *allocator,
+                                            void *ptr,
+                                            size_t old_size,
+                                            size_t new_size,
+                                            size_t align) {
+    if (ptr == NULL) {
+        return sps_mem_alloc_aligned(allocator, new_size, align);
+    }
+
+    if (allocator->resize != NULL) {
+        return allocator->resize(ptr, old_size, new_size, align, allocator->ctx);
+    }
+
+    void *resized = sps_mem_alloc_aligned(allocator, new_size, align);
+    if (resized != NULL) {
+        memcpy(resized, ptr, old_size < new_size ? old_size : new_size);
+        sps_mem_free(allocator, ptr, old_size);
+    }
+    return resized;
+}
+
+static inline void *sps_mem_realloc(const sps_allocator_t *allocator,
+                                    void *ptr,
+                                    size_t old_size,
+                                    size_t new_size) {
+    return sps_mem_realloc_aligned(allocator, ptr, old_size, new_size, SPS_ALLOC_ALIGN);
+}
+
+// Sparse slots hold the dense position plus one, so a zero-filled page reads as empty.
+// Every unmapped slot of the page directory points at this page, which is never written.
+extern sps_slot_t sps_empty_page[SPS_PAGE_SIZE];
+
+static inline sps_slot_t sps_slot(const sparse_set_t *set, uint32_t index) {
+    uint32_t page = index >> SPS_PAGE_BITS;
+    if (page >= set->page_count) {
+        return sps_empty_page[0];
+    }
+
+    return set->sparse[page][index & SPS_PAGE_MASK];
+}
+
+static inline uint32_t sps_lookup(const sparse_set_t *set, uint32_t index) {
+    // An empty slot wraps around to SPARSE_SET_MAX
+    return sps_slot(set, index).dense - 1U;
+}
+
+static inline uint32_t sps_lookup_handle(const sparse_set_t *set, sps_handle_t handle) {
+    // Position and generation share one slot, so the check costs no extra cache line
+    sps_slot_t slot = sps_slot(set, sps_handle_index(handle));
+    return slot.generation == sps_handle_generation(handle) ? slot.dense - 1U : SPARSE_SET_MAX;
+}
+
+static inline void sps_link(sparse_set_t *set, uint32_t index, uint32_t dense_idx) {
+    set->sparse[index >> SPS_PAGE_BITS][index & SPS_PAGE_MASK].dense = dense_idx + 1U;
+}
+
+static inline void sps_unlink(sparse_set_t *set, uint32_t index) {
+    set->sparse[index >> SPS_PAGE_BITS][index & SPS_PAGE_MASK] = (sps_slot_t){0};
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SPS_PREFETCH(addr) __builtin_prefetch((addr))
+#else
+#define SPS_PREFETCH(addr) ((void)(addr))
+#endif
+
+/** @brief Number of elements batch operations look ahead when prefetching */
+#define SPS_PREFETCH_DISTANCE (8U)
+
+static inline void sps_prefetch_slot(const sparse_set_t *set, uint32_t index) {
+    uint32_t page = index >> SPS_PAGE_BITS;
+    if (page < set->page_count) {
+        SPS_PREFETCH(&set->sparse[page][index & SPS_PAGE_MASK]);
+    }
+}
+
+static inline void *sps_component(const sparse_set_t *set, uint32_t dense_idx) {
+    if (set->flags & SPS_PAGED) {
+        uint32_t mask = (1U << set->block_bits) - 1U;
+        return set->blocks[dense_idx >> set->block_bits] +
+               ((size_t)(dense_idx & mask) * set->component_size);
+    }
+
+    return set->components + ((size_t)dense_idx * set->component_size);
+}
+
+/** Components from a dense position to the end of its block, unbounded when not paged */
+static inline uint32_t sps_block_room(const sparse_set_t *set, uint32_t dense_idx) {
+    if (!(set->flags & SPS_PAGED)) {
+        return UINT32_MAX;
+    }
+
+    uint32_t mask = (1U << set->block_bits) - 1U;
+    return mask + 1U - (dense_idx & mask);
+}
+
+/** Copy n components starting at a dense position out to a packed array, AoS sets only */
+static inline void sps_gather(const sparse_set_t *set, uint32_t begin, uint32_t n, void *out) {
+    uint8_t *to = out;
+    while (n > 0) {
+        uint32_t len = sps_block_room(set, begin);
+        if (len > n) len = n;
+
+        memcpy(to, sps_component(set, begin), (size_t)len * set->component_size);
+        to += (size_t)len * set->component_size;
+        begin += len;
+        n -= len;
+    }
+}
+
+/** Copy n packed components into the storage starting at a dense position, AoS sets only */
+static inline void sps_scatter(sparse_set_t *set, uint32_t begin, uint32_t n, const void *in) {
+    const uint8_t *from = in;
+    while (n > 0) {
+        uint32_t len = sps_block_room(set, begin);
+        if (len > n) len = n;
+
+        memcpy(sps_component(set, begin), from, (size_t)len * set->component_size);
+        from += (size_t)len * set->component_size;
+        begin += len;
+        n -= len;
+    }
+}
+
+/** Length of the first run of live entries at or after *at, which is moved to its start */
+static inline uint32_t sps_live_run(const sparse_set_t *set, uint32_t *at) {
+    while (*at < set->count && set->dense[*at] == SPS_TOMBSTONE) {
+        (*at)++;
+    }
+
+    uint32_t end = *at;
+    while (end < set->count && set->dense[end] != SPS_TOMBSTONE) {
+        end++;
+    }
+    return end - *at;
+}
+
+/**
+ * Pointer handed to callers for the component at a dense position: the
+ * component itself, or its element of the first column for SoA sets.
+ */
+static inline void *sps_element(const sparse_set_t *set, uint32_t dense_idx) {
+    if (set->columns != NULL) {
+        return set->columns[0].data + ((size_t)dense_idx * set->columns[0].size);
+    }
+
+    return sps_component(set, dense_idx);
+}
+
+/** Copy a whole component into the storage at a dense position */
+static inline void sps_store(sparse_set_t *set, uint32_t dense_idx, const void *component) {
+    if (set->columns == NULL) {
+        memcpy(sps_component(set, dense_idx), component, set->component_size);
+        return;
+    }
+
+    for (uint32_t i = 0; i < set->column_count; i++) {
+        const sps_column_t *column = &set->columns[i];
+        memcpy(column->data + (size_t)dense_idx * column->size,
+               (const uint8_t *)component + column->offset,
+               column->size);
+    }
+}
+
+/** Copy the component at a dense position out to a whole component */
+static inline void sps_load(const sparse_set_t *set, uint32_t dense_idx, void *component) {
+    if (set->columns == NULL) {
+        memcpy(component, sps_component(set, dense_idx), set->component_size);
+        return;
+    }
+
+    for (uint32_t i = 0; i < set->column_count; i++) {
+        const sps_column_t *column = &set->columns[i];
+        memcpy((uint8_t *)component + column->offset,
+               column->data + (size_t)dense_idx * column->size,
+               column->size);
+    }
+}
+
+/** Move n components between dense positions, the ranges may overlap */
+static inline void sps_move(sparse_set_t *set, uint32_t dst, uint32_t src, uint32_t n) {
+    if (set->flags & SPS_PAGED) {
+        SPS_STAT_ADD(set, bytes_moved, (size_t)n * set->component_size);
+
+        // Pieces are copied from the end the move goes away from, so every
+        // source byte is read before it is overwritten
+        uint32_t mask = (1U << set->block_bits) - 1U;
+        while (n > 0) {
+            uint32_t len = n;
+            uint32_t to, from;
+            if (dst <= src) {
+                to   = dst;
+                from = src;
+                if (len > sps_block_room(set, to)) len = sps_block_room(set, to);
+                if (len > sps_block_room(set, from)) len = sps_block_room(set, from);
+                dst += len;
+                src += len;
+            } else {
+                to   = dst + n - 1U;
+                from = src + n - 1U;
+                if (len > (to & mask) + 1U) len = (to & mask) + 1U;
+                if (len > (from & mask) + 1U) len = (from & mask) + 1U;
+                to -= len - 1U;
+                from -= len - 1U;
+            }
+
+            memmove(sps_component(set, to),
+                    sps_component(set, from),
+                    (size_t)len * set->component_size);
+            n -= len;
+        }
+        return;
+    }
+
+    if (set->columns == NULL) {
+        memmove(sps_component(set, dst), sps_component(set, src), (size_t)n * set->component_size);
+        SPS_STAT_ADD(set, bytes_moved, (size_t)n * set->component_size);
+        return;
+    }
+
+    for (uint32_t i = 0; i < set->column_count; i++) {
+        const sps_column_t *column = &set->columns[i];
+        memmove(column->data + (size_t)dst * column->size,
+                column->data + (size_t)src * column->size,
+                (size_t)n * column->size);
+        SPS_STAT_ADD(set, bytes_moved, (size_t)n * column->size);
+    }
+}
+
+/** @brief Slot mark: the component may be out of order since the last sort */
+#define SPS_MARK_UNSORTED (1U << 0)
+
+/** @brief Slot mark: the component was added since the last change clear */
+#define SPS_MARK_ADDED (SPS_CHANGE_ADDED << 1)
+
+/** @brief Slot mark: the component was modified since the last change clear */
+#define SPS_MARK_MODIFIED (SPS_CHANGE_MODIFIED << 1)
+
+/** @brief Slot marks of a component that is on the change list */
+#define SPS_MARK_CHANGED (SPS_MARK_ADDED | SPS_MARK_MODIFIED)
+
+/** @brief Slot mark: the component was already visited while compacting the change list */
+#define SPS_MARK_SEEN (1U << 3)
+
+/**
+ * @brief Allocate the per-slot marks array if it does not exist yet
+ *
+ * @param set Set to prepare
+ * @return false on allocation failure
+ */
+bool sps_alloc_marks(sparse_set_t *set);
+
+/**
+ * @brief Record that the component at a dense position may be out of order
+ *
+ * Does nothing unless SPS_TRACK_ORDER is enabled. Falls back to flagging the
+ * whole set with SPS_ORDER_STALE once more entries are dirty than are alive.
+ *
+ * @param set Set owning the component
+ * @param dense_idx Dense position of the component
+ */
+void sps_mark_unsorted(sparse_set_t *set, uint32_t dense_idx);
+
+/**
+ * @brief Record that the component at a dense position was added or modified
+ *
+ * Does nothing unless SPS_TRACK_CHANGES is enabled.
+ *
+ * @param set Set owning the component
+ * @param dense_idx Dense position of the component
+ * @param mark SPS_MARK_ADDED or SPS_MARK_MODIFIED
+ */
+void sps_mark_changed(sparse_set_t *set, uint32_t dense_idx, uint8_t mark);
+
+/**
+ * @brief Record that the component at a dense position is about to be removed
+ *
+ * Does nothing unless SPS_TRACK_CHANGES is enabled.
+ *
+ * @param set Set owning the component
+ * @param dense_idx Dense position of the component
+ */
+void sps_mark_removed(sparse_set_t *set, uint32_t dense_idx);
+
+/**
+ * @brief Link every entity of the dense array into an empty sparse array
+ *
+ * @param set Set whose first count dense entries are filled in
+ * @param generations Generation of each dense entry as packed uint32_t, need not
+ *        be aligned, or NULL for all zero
+ * @return false if an entity is invalid or repeated, or on allocation failure
+ */
+bool sps_rebuild_sparse(sparse_set_t *set, const uint8_t *generations);
+
+/**
+ * @brief Apply the set's sps_advice_t to its dense storage again
+ *
+ * @param set Set whose dense storage was just allocated or grown
+ * @return false if the platform does not support or refused the hint
+ */
+bool sps_advise_storage(sparse_set_t *set);
+
+/**
+ * @brief Release the file mapping backing a read-only set
+ *
+ * Clears the dense, component and column pointers that pointed into it.
+ *
+ * @param set Set created by sps_map_file
+ */
+void sps_unmap(sparse_set_t *set);
+
+/**
+ * @brief Exchange the components and entities at two dense positions
+ *
+ * Both positions are reported as possibly out of order.
+ *
+ * @param set Set to modify
+ * @param a First dense position
+ * @param b Second dense position
+ */
+void sps_swap(sparse_set_t *set, uint32_t a, uint32_t b);
+
+/**
+ * @brief Move an entity into a group's prefix if every member now holds it
+ *
+ * @param group Group to update
+ * @param index Entity index that was just added to a member
+ */
+void sps_group_join(sps_group_t *group, uint32_t index);
+
+/**
+ * @brief Move an entity out of a group's prefix before it is removed from a member
+ *
+ * @param group Group to update
+ * @param index Entity index about to be removed from a member
+ */
+void sps_group_leave(sps_group_t *group, uint32_t index);
+
+/** @brief Deferred operation kinds recorded in a command buffer */
+typedef enum sps_command_op {
+    SPS_COMMAND_ADD,
+    SPS_COMMAND_ADD_OR_REPLACE,
+    SPS_COMMAND_REMOVE,
+} sps_command_op_t;
+
+/** @brief Header of a recorded command, followed by the component for adds */
+typedef struct sps_command {
+    uint32_t index; /**< Entity index the command applies to */
+    uint32_t op;    /**< One of sps_command_op_t */
+} sps_command_t;
+
+struct sps_commands {
+    sparse_set_t *set;       /**< Set the commands apply to */
+    uint8_t *records;        /**< capacity records of record_size bytes */
+    size_t record_size;      /**< Header plus component, padded to the header alignment */
+    uint32_t capacity;       /**< Number of records allocated */
+    uint32_t *order;         /**< Radix sort scratch, 4 * capacity entries */
+    atomic_size_t reserved;  /**< Number of record slots claimed so far */
+};
+
+/**
+ * @brief Apply the recorded commands one by one in slot order and clear them
+ *
+ * Unlike sps_flush nothing is folded, so a set that went through the same
+ * operations before ends up with the same dense order.
+ *
+ * @param commands Command buffer to apply
+ * @param set Set to apply the commands to
+ */
+void sps_commands_replay(sps_commands_t *commands, sparse_set_t *set);
+
+/** @brief Keeps a frequently written counter on a cache line of its own */
+typedef struct sps_indicator {
+    _Alignas(64) atomic_size_t readers; /**< Readers that arrived on this indicator */
+} sps_indicator_t;
+
+struct sps_shared {
+    sparse_set_t *instances[2];    /**< Published and writer instance */
+    sps_commands_t *log;           /**< Changes not yet applied to the published instance */
+    atomic_uint left_right;        /**< Instance new readers use */
+    atomic_uint version;           /**< Indicator new readers arrive on */
+    sps_indicator_t indicators[2]; /**< Reader counts per version */
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SPS_SPIN_PAUSE() __builtin_ia32_pause()
+#else
+#define SPS_SPIN_PAUSE() ((void)0)
+#endif
+
+#endif  // SPS_INTERNAL_H_
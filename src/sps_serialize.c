@@ -0,0 +1,401 @@
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#define SPS_HAVE_MMAP 1
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(SPS_HAVE_MMAP)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "sps.h"
+#include "sps_internal.h"
+
+/** @brief First word of the format, "SPS1" when read in little endian byte order */
+#define SPS_FORMAT_MAGIC (0x31535053U)
+
+/** @brief Header flag: a generations array follows the dense array */
+#define SPS_FORMAT_GENERATIONS (1U << 0)
+
+/** @brief Header flag: the storage arrays are the columns of a structure-of-arrays set */
+#define SPS_FORMAT_COLUMNS (1U << 1)
+
+typedef struct sps_format_header {
+    uint32_t magic;              /**< SPS_FORMAT_MAGIC in host byte order */
+    uint32_t version;            /**< SPS_FORMAT_VERSION */
+    uint32_t flags;              /**< SPS_FORMAT_* bits */
+    uint32_t count;              /**< Number of entities */
+    uint64_t component_size;     /**< Size of a whole component in bytes */
+    uint64_t size;               /**< Size of the serialized set in bytes */
+    uint64_t dense_offset;       /**< Start of the dense array */
+    uint64_t generations_offset; /**< Start of the generations array, or 0 */
+    uint64_t array_count;        /**< Number of storage arrays following the header */
+} sps_format_header_t;
+
+typedef struct sps_format_array {
+    uint64_t field_offset; /**< Byte offset of the stored field within the component */
+    uint64_t element_size; /**< Size of one element in bytes */
+    uint64_t data_offset;  /**< Start of the array */
+} sps_format_array_t;
+
+static size_t sps_format_align(size_t offset) {
+    return (offset + SPS_FORMAT_ALIGN - 1U) & ~(size_t)(SPS_FORMAT_ALIGN - 1U);
+}
+
+static bool sps_has_generations(const sparse_set_t *set) {
+    for (uint32_t i = 0; i < set->count; i++) {
+        if (set->dense[i] != SPS_TOMBSTONE && sps_slot(set, set->dense[i]).generation != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Describe storage array i of a set: the component array, or column i */
+static sps_format_array_t sps_format_array(const sparse_set_t *set, uint32_t i) {
+    if (set->columns == NULL) {
+        return (sps_format_array_t){.field_offset = 0, .element_size = set->component_size};
+    }
+
+    return (sps_format_array_t){
+        .field_offset = set->columns[i].offset,
+        .element_size = set->columns[i].size,
+    };
+}
+
+static size_t sps_format_size(const sparse_set_t *set, bool generations) {
+    uint32_t arrays = set->columns != NULL ? set->column_count : 1;
+    size_t count    = set->count - set->tombstones;
+    size_t size     = sizeof(sps_format_header_t) + arrays * sizeof(sps_format_array_t);
+
+    size = sps_format_align(size) + count * sizeof(*set->dense);
+    if (generations) {
+        size = sps_format_align(size) + count * sizeof(uint32_t);
+    }
+
+    for (uint32_t i = 0; i < arrays; i++) {
+        size = sps_format_align(size) + count * sps_format_array(set, i).element_size;
+    }
+    return size;
+}
+
+/** Zero the padding up to the next aligned offset and return that offset */
+static size_t sps_format_pad(uint8_t *out, size_t *at) {
+    size_t aligned = sps_format_align(*at);
+    memset(out + *at, 0, aligned - *at);
+    *at = aligned;
+    return aligned;
+}
+
+size_t sps_serialized_size(const sparse_set_t *set) {
+    if (set == NULL) {
+        sps_error("set cannot be NULL");
+        return 0;
+    }
+
+    return sps_format_size(set, sps_has_generations(set));
+}
+
+size_t sps_serialize(const sparse_set_t *set, void *buffer, size_t size) {
+    if (set == NULL || buffer == NULL) {
+        sps_error("invalid arguments");
+        return 0;
+    }
+
+    bool generations = sps_has_generations(set);
+    size_t total     = sps_format_size(set, generations);
+    if (size < total) {
+        return 0;
+    }
+
+    uint8_t *out    = buffer;
+    uint32_t arrays = set->columns != NULL ? set->column_count : 1;
+    size_t at       = sizeof(sps_format_header_t) + arrays * sizeof(sps_format_array_t);
+
+    sps_format_header_t header = {
+        .magic          = SPS_FORMAT_MAGIC,
+        .version        = SPS_FORMAT_VERSION,
+        .flags          = set->columns != NULL ? SPS_FORMAT_COLUMNS : 0,
+        .count          = set->count - set->tombstones,
+        .component_size = set->component_size,
+        .size           = total,
+        .array_count    = arrays,
+    };
+
+    // Tombstones are left out, the output is that of the compacted set
+    header.dense_offset = sps_format_pad(out, &at);
+    for (uint32_t run = 0, len; (len = sps_live_run(set, &run)) > 0; run += len) {
+        memcpy(out + at, set->dense + run, (size_t)len * sizeof(*set->dense));
+        at += (size_t)len * sizeof(*set->dense);
+    }
+
+    if (generations) {
+        header.flags |= SPS_FORMAT_GENERATIONS;
+        header.generations_offset = sps_format_pad(out, &at);
+        for (uint32_t i = 0; i < set->count; i++) {
+            if (set->dense[i] == SPS_TOMBSTONE) {
+                continue;
+            }
+
+            uint32_t generation = sps_slot(set, set->dense[i]).generation;
+            memcpy(out + at, &generation, sizeof(generation));
+            at += sizeof(generation);
+        }
+    }
+
+    // The array table is written after the data, once the offsets are known
+    for (uint32_t i = 0; i < arrays; i++) {
+        sps_format_array_t array = sps_format_array(set, i);
+        const uint8_t *data      = set->columns != NULL ? set->columns[i].data : set->components;
+
+        array.data_offset = sps_format_pad(out, &at);
+        for (uint32_t run = 0, len; (len = sps_live_run(set, &run)) > 0; run += len) {
+            if (set->columns == NULL) {
+                sps_gather(set, run, len, out + at);
+            } else {
+                memcpy(out + at, data + (size_t)run * array.element_size, (size_t)len * array.element_size);
+            }
+            at += (size_t)len * array.element_size;
+        }
+
+        memcpy(out + sizeof(header) + i * sizeof(array), &array, sizeof(array));
+    }
+
+    memcpy(out, &header, sizeof(header));
+    return total;
+}
+
+static bool sps_format_fits(size_t size, uint64_t offset, uint64_t length) {
+    return offset % SPS_FORMAT_ALIGN == 0 && offset <= size && length <= size - offset;
+}
+
+/** Validate a serialized set, returning false for anything sps_serialize cannot have written */
+static bool sps_format_read(const uint8_t *data, size_t size, sps_format_header_t *header) {
+    if (size < sizeof(*header)) {
+        return false;
+    }
+
+    memcpy(header, data, sizeof(*header));
+    if (header->magic != SPS_FORMAT_MAGIC || header->version != SPS_FORMAT_VERSION ||
+        header->size > size || header->size < sizeof(*header) || header->count == SPARSE_SET_MAX ||
+        header->component_size == 0 || header->component_size > SIZE_MAX ||
+        header->array_count == 0 || header->array_count > UINT32_MAX) {
+        return false;
+    }
+
+    size = (size_t)header->size;
+    if (!(header->flags & SPS_FORMAT_COLUMNS) && header->array_count != 1) {
+        return false;
+    }
+
+    if (header->array_count > (size - sizeof(*header)) / sizeof(sps_format_array_t)) {
+        return false;
+    }
+
+    uint64_t count = header->count;
+    if (!sps_format_fits(size, header->dense_offset, count * sizeof(uint32_t))) {
+        return false;
+    }
+
+    if ((header->flags & SPS_FORMAT_GENERATIONS) &&
+        !sps_format_fits(size, header->generations_offset, count * sizeof(uint32_t))) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < header->array_count; i++) {
+        sps_format_array_t array;
+        memcpy(&array, data + sizeof(*header) + i * sizeof(array), sizeof(array));
+
+        if (array.element_size == 0 || array.field_offset > header->component_size ||
+            header->component_size - array.field_offset < array.element_size ||
+            array.element_size > UINT64_MAX / (count + 1) ||
+            !sps_format_fits(size, array.data_offset, count * array.element_size)) {
+            return false;
+        }
+
+        if (!(header->flags & SPS_FORMAT_COLUMNS) && array.element_size != header->component_size) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static sps_format_array_t sps_format_array_at(const uint8_t *data, uint32_t i) {
+    sps_format_array_t array;
+    memcpy(&array, data + sizeof(sps_format_header_t) + (size_t)i * sizeof(array), sizeof(array));
+    return array;
+}
+
+/**
+ * Create an empty set with the layout of a validated serialized set. The
+ * set gets initial_capacity slots of storage.
+ */
+static sparse_set_t *sps_format_new(const uint8_t *data,
+                                    const sps_format_header_t *header,
+                                    size_t initial_capacity,
+                                    const sps_allocator_t *allocator) {
+    if (!(header->flags & SPS_FORMAT_COLUMNS)) {
+        return sps_new_desc(&(sps_desc_t){
+            .component_size   = (size_t)header->component_size,
+            .initial_capacity = initial_capacity,
+            .allocator        = allocator,
+        });
+    }
+
+    const sps_allocator_t *fields_allocator = allocator != NULL ? allocator : &sps_default_allocator;
+    size_t field_count                      = (size_t)header->array_count;
+
+    sps_field_t *fields = sps_mem_alloc(fields_allocator, field_count * sizeof(*fields));
+    if (fields == NULL) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < field_count; i++) {
+        sps_format_array_t array = sps_format_array_at(data, (uint32_t)i);
+        fields[i] = (sps_field_t){.offset = (size_t)array.field_offset, .size = (size_t)array.element_size};
+    }
+
+    sparse_set_t *set = sps_new_desc(&(sps_desc_t){
+        .component_size   = (size_t)header->component_size,
+        .initial_capacity = initial_capacity,
+        .fields           = fields,
+        .field_count      = field_count,
+        .allocator        = allocator,
+    });
+
+    sps_mem_free(fields_allocator, fields, field_count * sizeof(*fields));
+    return set;
+}
+
+sparse_set_t *sps_deserialize(const void *data, size_t size, const sps_allocator_t *allocator) {
+    if (data == NULL) {
+        sps_error("invalid arguments");
+        return NULL;
+    }
+
+    const uint8_t *in = data;
+    sps_format_header_t header;
+    if (!sps_format_read(in, size, &header)) {
+        sps_error("malformed serialized set");
+        return NULL;
+    }
+
+    sparse_set_t *set = sps_format_new(in, &header, header.count, allocator);
+    if (set == NULL) {
+        sps_error("failed to allocate sparse set");
+        return NULL;
+    }
+
+    if (header.count > 0) {
+        memcpy(set->dense, in + header.dense_offset, (size_t)header.count * sizeof(*set->dense));
+        for (uint32_t i = 0; i < (uint32_t)header.array_count; i++) {
+            sps_format_array_t array = sps_format_array_at(in, i);
+            uint8_t *storage         = set->columns != NULL ? set->columns[i].data : set->components;
+            memcpy(storage, in + array.data_offset, (size_t)(header.count * array.element_size));
+        }
+    }
+    set->count = header.count;
+
+    const uint8_t *generations = (header.flags & SPS_FORMAT_GENERATIONS) ? in + header.generations_offset : NULL;
+    if (!sps_rebuild_sparse(set, generations)) {
+        sps_error("serialized set holds an invalid entity");
+        sps_free(set);
+        return NULL;
+    }
+
+    return set;
+}
+
+sparse_set_t *sps_map_file(const char *path, const sps_allocator_t *allocator) {
+    if (path == NULL) {
+        sps_error("invalid arguments");
+        return NULL;
+    }
+
+#if defined(SPS_HAVE_MMAP)
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0 || (uintmax_t)info.st_size > SIZE_MAX) {
+        close(fd);
+        return NULL;
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    size_t size   = (size_t)info.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    const uint8_t *in = mapping;
+    sps_format_header_t header;
+    if (!sps_format_read(in, size, &header)) {
+        sps_error("malformed serialized set");
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    sparse_set_t *set = sps_format_new(in, &header, 0, allocator);
+    if (set == NULL) {
+        sps_error("failed to allocate sparse set");
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    // Page aligned mapping plus aligned offsets keeps every array aligned
+    set->mapping      = mapping;
+    set->mapping_size = size;
+    set->dense        = (uint32_t *)(void *)(uintptr_t)(in + header.dense_offset);
+    for (uint32_t i = 0; i < (uint32_t)header.array_count; i++) {
+        uint8_t *storage = (uint8_t *)(uintptr_t)(in + sps_format_array_at(in, i).data_offset);
+        if (set->columns != NULL) {
+            set->columns[i].data = storage;
+        } else {
+            set->components = storage;
+        }
+    }
+
+    set->count        = header.count;
+    set->capacity     = header.count;
+    set->max_capacity = header.count;
+    set->flags |= SPS_READ_ONLY;
+
+    const uint8_t *generations = (header.flags & SPS_FORMAT_GENERATIONS) ? in + header.generations_offset : NULL;
+    if (!sps_rebuild_sparse(set, generations)) {
+        sps_error("serialized set holds an invalid entity");
+        sps_free(set);
+        return NULL;
+    }
+
+    return set;
+#else
+    (void)allocator;
+    sps_error("file mapping is not supported on this platform");
+    return NULL;
+#endif
+}
+
+void sps_unmap(sparse_set_t *set) {
+#if defined(SPS_HAVE_MMAP)
+    munmap(set->mapping, set->mapping_size);
+#endif
+
+    set->mapping      = NULL;
+    set->mapping_size = 0;
+    set->dense        = NULL;
+    set->components   = NULL;
+    for (uint32_t i = 0; i < set->column_count; i++) {
+        set->columns[i].data = NULL;
+    }
+}
@@ -0,0 +1,174 @@
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "sps.h"
+#include "sps_internal.h"
+
+sps_shared_t *sps_shared_new(const sps_desc_t *desc, size_t log_capacity) {
+    if (desc == NULL || log_capacity == 0) {
+        sps_error("invalid arguments");
+        return NULL;
+    }
+
+    // A workspace cannot be shared by the two instances
+    sps_desc_t instance_desc     = *desc;
+    instance_desc.workspace      = NULL;
+    instance_desc.workspace_size = 0;
+
+    sparse_set_t *first = sps_new_desc(&instance_desc);
+    if (first == NULL) {
+        return NULL;
+    }
+
+    sps_shared_t *shared = sps_mem_alloc(&first->allocator, sizeof(*shared));
+    if (shared == NULL) {
+        sps_error("failed to allocate shared set");
+        sps_free(first);
+        return NULL;
+    }
+
+    shared->instances[0] = first;
+    shared->instances[1] = sps_new_desc(&instance_desc);
+    shared->log          = sps_commands_new(first, log_capacity);
+    atomic_init(&shared->left_right, 0);
+    atomic_init(&shared->version, 0);
+    atomic_init(&shared->indicators[0].readers, 0);
+    atomic_init(&shared->indicators[1].readers, 0);
+
+    if (shared->instances[1] == NULL || shared->log == NULL) {
+        sps_shared_free(shared);
+        return NULL;
+    }
+
+    return shared;
+}
+
+/**
+ * Instance the writer changes, the one readers are not directed to. Only
+ * the writer stores left_right, so a relaxed load is enough here.
+ */
+static sparse_set_t *sps_shared_writer(sps_shared_t *shared) {
+    return shared->instances[1U - atomic_load_explicit(&shared->left_right, memory_order_relaxed)];
+}
+
+/**
+ * Make room for one more log entry, publishing a full log first.
+ */
+static void sps_shared_reserve_log(sps_shared_t *shared) {
+    sps_commands_t *log = shared->log;
+    if (atomic_load_explicit(&log->reserved, memory_order_relaxed) >= log->capacity) {
+        sps_shared_publish(shared);
+    }
+}
+
+bool sps_shared_add(sps_shared_t *shared, uint32_t index, void *component) {
+    if (shared == NULL || component == NULL || index == SPARSE_SET_MAX) {
+        sps_error("invalid arguments");
+        return false;
+    }
+
+    // An index already present is a normal false result, not an error
+    sps_shared_reserve_log(shared);
+    sparse_set_t *writer = sps_shared_writer(shared);
+    if (sps_lookup(writer, index) != SPARSE_SET_MAX || sps_add(writer, index, component) == NULL) {
+        return false;
+    }
+
+    return sps_defer_add(shared->log, index, component);
+}
+
+bool sps_shared_add_or_replace(sps_shared_t *shared, uint32_t index, void *component) {
+    if (shared == NULL || component == NULL || index == SPARSE_SET_MAX) {
+        sps_error("invalid arguments");
+        return false;
+    }
+
+    sps_shared_reserve_log(shared);
+    if (sps_add_or_replace(sps_shared_writer(shared), index, component) == NULL) {
+        return false;
+    }
+
+    return sps_defer_add_or_replace(shared->log, index, component);
+}
+
+bool sps_shared_remove(sps_shared_t *shared, uint32_t index) {
+    if (shared == NULL || index == SPARSE_SET_MAX) {
+        sps_error("invalid arguments");
+        return false;
+    }
+
+    sps_shared_reserve_log(shared);
+    sparse_set_t *writer = sps_shared_writer(shared);
+    if (sps_lookup(writer, index) == SPARSE_SET_MAX) {
+        return false;
+    }
+
+    sps_remove(writer, index);
+    return sps_defer_remove(shared->log, index);
+}
+
+static void sps_shared_drain(sps_shared_t *shared, uint32_t version) {
+    while (atomic_load(&shared->indicators[version].readers) != 0) {
+        SPS_SPIN_PAUSE();
+    }
+}
+
+void sps_shared_publish(sps_shared_t *shared) {
+    if (shared == NULL) {
+        sps_error("invalid arguments");
+        return;
+    }
+
+    if (atomic_load_explicit(&shared->log->reserved, memory_order_relaxed) == 0) {
+        return;
+    }
+
+    // Direct new readers to the written instance
+    uint32_t retired = atomic_load(&shared->left_right);
+    atomic_store(&shared->left_right, 1U - retired);
+
+    // Readers that arrived before the switch may still be on the retired
+    // instance; flip the version so they can be waited out without new
+    // readers keeping the count up
+    uint32_t previous = atomic_load(&shared->version);
+    uint32_t next     = 1U - previous;
+    sps_shared_drain(shared, next);
+    atomic_store(&shared->version, next);
+    sps_shared_drain(shared, previous);
+
+    // Nobody reads the retired instance anymore, bring it up to date
+    sps_commands_replay(shared->log, shared->instances[retired]);
+}
+
+sparse_set_t *sps_read_begin(sps_shared_t *shared, uint32_t *token) {
+    if (shared == NULL || token == NULL) {
+        sps_error("invalid arguments");
+        return NULL;
+    }
+
+    uint32_t version = atomic_load(&shared->version);
+    atomic_fetch_add(&shared->indicators[version].readers, 1);
+    *token = version;
+    return shared->instances[atomic_load(&shared->left_right)];
+}
+
+void sps_read_end(sps_shared_t *shared, uint32_t token) {
+    if (shared == NULL || token > 1) {
+        sps_error("invalid arguments");
+        return;
+    }
+
+    atomic_fetch_sub_explicit(&shared->indicators[token].readers, 1, memory_order_release);
+}
+
+void sps_shared_free(sps_shared_t *shared) {
+    if (shared == NULL) {
+        return;
+    }
+
+    sparse_set_t *first = shared->instances[0];
+    sps_commands_free(shared->log);
+    sps_free(shared->instances[1]);
+    sps_mem_free(&first->allocator, shared, sizeof(*shared));
+    sps_free(first);
+}
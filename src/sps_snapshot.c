@@ -0,0 +1,448 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "sps.h"
+#include "sps_internal.h"
+
+/** @brief First word of a snapshot, "SPSS" when read in little endian byte order */
+#define SPS_SNAPSHOT_MAGIC (0x53535053U)
+
+/** @brief Arrays every snapshot holds before the component storage: dense and generations */
+#define SPS_SNAPSHOT_ID_ARRAYS (2U)
+
+/** @brief Shortest zero run that ends a literal, shorter runs cost less inside it */
+#define SPS_DELTA_MIN_RUN (sizeof(sps_delta_token_t))
+
+typedef struct sps_snapshot_header {
+    uint32_t magic;       /**< SPS_SNAPSHOT_MAGIC in host byte order */
+    uint32_t count;       /**< Number of entities */
+    uint32_t array_count; /**< Number of storage arrays, 1 for AoS or the column count */
+    uint32_t row_size;    /**< Bytes stored per entity over all arrays */
+} sps_snapshot_header_t;
+
+/** @brief Delta token: zero_run unchanged bytes, then literal_len XORed bytes */
+typedef struct sps_delta_token {
+    uint32_t zero_run;
+    uint32_t literal_len;
+} sps_delta_token_t;
+
+/** Element sizes of the arrays follow the header, so the layout is self describing */
+static size_t sps_snapshot_header_size(uint32_t array_count) {
+    return sizeof(sps_snapshot_header_t) + (size_t)array_count * sizeof(uint32_t);
+}
+
+static uint32_t sps_storage_count(const sparse_set_t *set) {
+    return set->columns != NULL ? set->column_count : 1;
+}
+
+static size_t sps_storage_size(const sparse_set_t *set, uint32_t i) {
+    return set->columns != NULL ? set->columns[i].size : set->component_size;
+}
+
+static uint8_t *sps_storage(const sparse_set_t *set, uint32_t i) {
+    return set->columns != NULL ? set->columns[i].data : set->components;
+}
+
+/** Element size of array i of a validated snapshot, counting dense and generations */
+static size_t sps_snapshot_element(const uint8_t *snapshot, uint32_t i) {
+    if (i < SPS_SNAPSHOT_ID_ARRAYS) {
+        return sizeof(uint32_t);
+    }
+
+    uint32_t size;
+    memcpy(&size,
+           snapshot + sizeof(sps_snapshot_header_t) + (size_t)(i - SPS_SNAPSHOT_ID_ARRAYS) * sizeof(size),
+           sizeof(size));
+    return size;
+}
+
+/** Validate a snapshot and return its size, or 0 if it is malformed */
+static size_t sps_snapshot_read(const uint8_t *snapshot, size_t size, sps_snapshot_header_t *header) {
+    if (snapshot == NULL || size < sizeof(*header)) {
+        return 0;
+    }
+
+    memcpy(header, snapshot, sizeof(*header));
+    if (header->magic != SPS_SNAPSHOT_MAGIC || header->array_count == 0 ||
+        header->array_count > (size - sizeof(*header)) / sizeof(uint32_t)) {
+        return 0;
+    }
+
+    uint64_t row_size = 0;
+    for (uint32_t i = 0; i < header->array_count + SPS_SNAPSHOT_ID_ARRAYS; i++) {
+        row_size += sps_snapshot_element(snapshot, i);
+    }
+
+    size_t header_size = sps_snapshot_header_size(header->array_count);
+    if (row_size != header->row_size || (uint64_t)header->count * row_size > size - header_size) {
+        return 0;
+    }
+
+    return header_size + (size_t)header->count * row_size;
+}
+
+static bool sps_snapshot_same_layout(const uint8_t *a, const uint8_t *b, uint32_t array_count) {
+    return memcmp(a + sizeof(sps_snapshot_header_t),
+                  b + sizeof(sps_snapshot_header_t),
+                  (size_t)array_count * sizeof(uint32_t)) == 0;
+}
+
+static size_t sps_row_size(const sparse_set_t *set) {
+    size_t row_size = SPS_SNAPSHOT_ID_ARRAYS * sizeof(uint32_t);
+    for (uint32_t i = 0; i < sps_storage_count(set); i++) {
+        row_size += sps_storage_size(set, i);
+    }
+    return row_size;
+}
+
+size_t sps_snapshot_size(const sparse_set_t *set) {
+    if (set == NULL) {
+        sps_error("set cannot be NULL");
+        return 0;
+    }
+
+    size_t count = set->count - set->tombstones;
+    return sps_snapshot_header_size(sps_storage_count(set)) + count * sps_row_size(set);
+}
+
+size_t sps_snapshot(const sparse_set_t *set, void *buffer, size_t size) {
+    if (set == NULL || buffer == NULL) {
+        sps_error("invalid arguments");
+        return 0;
+    }
+
+    size_t total = sps_snapshot_size(set);
+    if (total == 0 || size < total) {
+        return 0;
+    }
+
+    uint8_t *out    = buffer;
+    uint32_t arrays = sps_storage_count(set);
+    uint32_t count  = set->count - set->tombstones;
+
+    sps_snapshot_header_t header = {
+        .magic       = SPS_SNAPSHOT_MAGIC,
+        .count       = count,
+        .array_count = arrays,
+        .row_size    = (uint32_t)sps_row_size(set),
+    };
+    memcpy(out, &header, sizeof(header));
+
+    size_t at = sizeof(header);
+    for (uint32_t i = 0; i < arrays; i++) {
+        uint32_t element = (uint32_t)sps_storage_size(set, i);
+        memcpy(out + at, &element, sizeof(element));
+        at += sizeof(element);
+    }
+
+    // Only the live entries of each array are copied, tombstones are left out
+    for (uint32_t run = 0, len; (len = sps_live_run(set, &run)) > 0; run += len) {
+        memcpy(out + at, set->dense + run, (size_t)len * sizeof(*set->dense));
+        at += (size_t)len * sizeof(*set->dense);
+    }
+
+    for (uint32_t i = 0; i < set->count; i++) {
+        if (set->dense[i] == SPS_TOMBSTONE) {
+            continue;
+        }
+
+        uint32_t generation = sps_slot(set, set->dense[i]).generation;
+        memcpy(out + at, &generation, sizeof(generation));
+        at += sizeof(generation);
+    }
+
+    for (uint32_t i = 0; i < arrays; i++) {
+        size_t element = sps_storage_size(set, i);
+        for (uint32_t run = 0, len; (len = sps_live_run(set, &run)) > 0; run += len) {
+            if (set->columns == NULL) {
+                sps_gather(set, run, len, out + at);
+            } else {
+                memcpy(out + at, sps_storage(set, i) + (size_t)run * element, (size_t)len * element);
+            }
+            at += (size_t)len * element;
+        }
+    }
+
+    return total;
+}
+
+bool sps_restore(sparse_set_t *set, const void *snapshot, size_t size) {
+    if (set == NULL || snapshot == NULL) {
+        sps_error("invalid arguments");
+        return false;
+    }
+
+    sps_assert_unpartitioned(set);
+
+    if (set->flags & (SPS_OWNED | SPS_READ_ONLY)) {
+        sps_error("cannot restore a set owned by a group or read-only");
+        return false;
+    }
+
+    const uint8_t *in = snapshot;
+    sps_snapshot_header_t header;
+    if (sps_snapshot_read(in, size, &header) == 0 || header.array_count != sps_storage_count(set)) {
+        sps_error("malformed snapshot");
+        return false;
+    }
+
+    for (uint32_t i = 0; i < header.array_count; i++) {
+        if (sps_snapshot_element(in, i + SPS_SNAPSHOT_ID_ARRAYS) != sps_storage_size(set, i)) {
+            sps_error("snapshot was taken from a set of another layout");
+            return false;
+        }
+    }
+
+    if (header.count > set->capacity && !sps_reserve(set, header.count)) {
+        sps_error("failed to grow sparse set");
+        return false;
+    }
+
+    // Only the slots of the entities present now are cleared, the pages stay mapped
+    for (uint32_t i = 0; i < set->count; i++) {
+        if (set->dense[i] != SPS_TOMBSTONE) sps_unlink(set, set->dense[i]);
+    }
+    set->tombstones = 0;
+
+    uint32_t count = header.count;
+    size_t at      = sps_snapshot_header_size(header.array_count);
+    if (count > 0) {
+        memcpy(set->dense, in + at, (size_t)count * sizeof(*set->dense));
+    }
+    at += (size_t)count * sizeof(*set->dense);
+
+    const uint8_t *generations = in + at;
+    at += (size_t)count * sizeof(uint32_t);
+
+    for (uint32_t i = 0; i < header.array_count; i++) {
+        size_t length = (size_t)count * sps_storage_size(set, i);
+        if (length > 0 && set->columns == NULL) {
+            sps_scatter(set, 0, count, in + at);
+        } else if (length > 0) {
+            memcpy(sps_storage(set, i), in + at, length);
+        }
+        at += length;
+    }
+
+    set->count = count;
+    if (!sps_rebuild_sparse(set, generations)) {
+        sps_error("snapshot holds an invalid entity");
+        for (uint32_t i = 0; i < set->count; i++) {
+            if (sps_lookup(set, set->dense[i]) == i) sps_unlink(set, set->dense[i]);
+        }
+        set->count = 0;
+        return false;
+    }
+
+    // Tracked state of the replaced components no longer applies
+    if (set->marks != NULL) {
+        uint8_t mark = (set->flags & SPS_TRACK_CHANGES) ? SPS_MARK_MODIFIED : 0;
+        memset(set->marks, mark, (size_t)count * sizeof(*set->marks));
+    }
+
+    if (set->flags & SPS_TRACK_ORDER) {
+        set->dirty_count = 0;
+        set->flags |= SPS_ORDER_STALE;
+    }
+
+    if (set->flags & SPS_TRACK_CHANGES) {
+        set->changed_count = 0;
+        set->removed_count = 0;
+        set->flags &= ~SPS_CHANGES_STALE;
+        set->flags |= SPS_CHANGES_LOST;
+    }
+
+    return true;
+}
+
+size_t sps_delta_bound(size_t snapshot_size) {
+    // Every literal is followed by a run of at least SPS_DELTA_MIN_RUN zeros, save the last
+    return snapshot_size + sizeof(sps_delta_token_t) * (snapshot_size / (SPS_DELTA_MIN_RUN + 1) + 2);
+}
+
+typedef struct sps_delta_writer {
+    uint8_t *out;       /**< Delta being written */
+    size_t size;        /**< Size of out in bytes */
+    size_t at;          /**< Bytes written so far */
+    size_t token;       /**< Offset of the open token, or SIZE_MAX */
+    uint32_t zero_run;  /**< Zero bytes not yet written */
+    uint32_t literal;   /**< Length of the open token's literal */
+} sps_delta_writer_t;
+
+static bool sps_delta_open(sps_delta_writer_t *writer) {
+    if (writer->size - writer->at < sizeof(sps_delta_token_t)) {
+        return false;
+    }
+
+    writer->token = writer->at;
+    writer->at += sizeof(sps_delta_token_t);
+    memcpy(writer->out + writer->token, &writer->zero_run, sizeof(writer->zero_run));
+    writer->zero_run = 0;
+    writer->literal  = 0;
+    return true;
+}
+
+static void sps_delta_close(sps_delta_writer_t *writer) {
+    if (writer->token != SIZE_MAX) {
+        memcpy(writer->out + writer->token + sizeof(uint32_t), &writer->literal, sizeof(writer->literal));
+        writer->token = SIZE_MAX;
+    }
+}
+
+static bool sps_delta_put(sps_delta_writer_t *writer, uint8_t byte) {
+    if (byte == 0 && writer->zero_run < UINT32_MAX) {
+        // A long enough run pays for a token of its own
+        if (++writer->zero_run == SPS_DELTA_MIN_RUN) {
+            sps_delta_close(writer);
+        }
+        return true;
+    }
+
+    if (writer->token == SIZE_MAX || writer->zero_run == UINT32_MAX ||
+        writer->literal > UINT32_MAX - writer->zero_run - 1U) {
+        sps_delta_close(writer);
+        if (!sps_delta_open(writer)) {
+            return false;
+        }
+    }
+
+    // Zeros too short to end the literal are carried inside it
+    if (writer->size - writer->at < (size_t)writer->zero_run + 1) {
+        return false;
+    }
+    memset(writer->out + writer->at, 0, writer->zero_run);
+    writer->at += writer->zero_run;
+    writer->literal += writer->zero_run + 1;
+    writer->zero_run = 0;
+    writer->out[writer->at++] = byte;
+    return true;
+}
+
+size_t sps_delta_encode(const void *base,
+                        size_t base_size,
+                        const void *snapshot,
+                        size_t size,
+                        void *out,
+                        size_t out_size) {
+    sps_snapshot_header_t from;
+    sps_snapshot_header_t to;
+    size_t total = sps_snapshot_read(snapshot, size, &to);
+    if (out == NULL || total == 0 || sps_snapshot_read(base, base_size, &from) == 0 ||
+        from.array_count != to.array_count || !sps_snapshot_same_layout(base, snapshot, to.array_count)) {
+        sps_error("invalid arguments");
+        return 0;
+    }
+
+    // The target header is stored as is, it describes how the rest is split into arrays
+    size_t header_size = sps_snapshot_header_size(to.array_count);
+    if (out_size < header_size) {
+        return 0;
+    }
+    memcpy(out, snapshot, header_size);
+
+    sps_delta_writer_t writer = {.out = out, .size = out_size, .at = header_size, .token = SIZE_MAX};
+    const uint8_t *next       = (const uint8_t *)snapshot + header_size;
+    const uint8_t *prev       = (const uint8_t *)base + header_size;
+
+    // Arrays are XORed against the same array of the base, which is zero past its count
+    for (uint32_t a = 0; a < to.array_count + SPS_SNAPSHOT_ID_ARRAYS; a++) {
+        size_t element = sps_snapshot_element(snapshot, a);
+        size_t length  = (size_t)to.count * element;
+        size_t common  = (size_t)(from.count < to.count ? from.count : to.count) * element;
+
+        for (size_t i = 0; i < length; i++) {
+            uint8_t byte = i < common ? (uint8_t)(next[i] ^ prev[i]) : next[i];
+            if (!sps_delta_put(&writer, byte)) {
+                return 0;
+            }
+        }
+
+        next += length;
+        prev += (size_t)from.count * element;
+    }
+
+    sps_delta_close(&writer);
+    if (writer.zero_run > 0) {
+        if (!sps_delta_open(&writer)) {
+            return 0;
+        }
+        sps_delta_close(&writer);
+    }
+
+    return writer.at;
+}
+
+size_t sps_delta_decode(const void *base,
+                        size_t base_size,
+                        const void *delta,
+                        size_t delta_size,
+                        void *out,
+                        size_t out_size) {
+    sps_snapshot_header_t from;
+    sps_snapshot_header_t to;
+    if (base == NULL || delta == NULL || out == NULL || sps_snapshot_read(base, base_size, &from) == 0 ||
+        delta_size < sizeof(to)) {
+        sps_error("invalid arguments");
+        return 0;
+    }
+
+    // The header is checked like a full snapshot, with the arrays assumed present
+    memcpy(&to, delta, sizeof(to));
+    size_t header_size = sps_snapshot_header_size(to.array_count);
+    if (to.magic != SPS_SNAPSHOT_MAGIC || to.array_count != from.array_count || delta_size < header_size ||
+        !sps_snapshot_same_layout(base, delta, to.array_count) || to.row_size != from.row_size) {
+        sps_error("malformed delta");
+        return 0;
+    }
+
+    size_t total = header_size + (size_t)to.count * to.row_size;
+    if (out_size < total) {
+        return 0;
+    }
+    memcpy(out, delta, header_size);
+
+    const uint8_t *in   = delta;
+    const uint8_t *prev = (const uint8_t *)base + header_size;
+    uint8_t *next       = (uint8_t *)out + header_size;
+    size_t at           = header_size;
+    uint32_t zero_run   = 0;
+    uint32_t literal    = 0;
+
+    for (uint32_t a = 0; a < to.array_count + SPS_SNAPSHOT_ID_ARRAYS; a++) {
+        size_t element = sps_snapshot_element(base, a);
+        size_t length  = (size_t)to.count * element;
+        size_t common  = (size_t)(from.count < to.count ? from.count : to.count) * element;
+
+        for (size_t i = 0; i < length; i++) {
+            while (zero_run == 0 && literal == 0) {
+                sps_delta_token_t token;
+                if (delta_size - at < sizeof(token)) {
+                    sps_error("truncated delta");
+                    return 0;
+                }
+                memcpy(&token, in + at, sizeof(token));
+                at += sizeof(token);
+                zero_run = token.zero_run;
+                literal  = token.literal_len;
+                if (delta_size - at < literal) {
+                    sps_error("truncated delta");
+                    return 0;
+                }
+            }
+
+            uint8_t byte = 0;
+            if (zero_run > 0) {
+                zero_run--;
+            } else {
+                byte = in[at++];
+                literal--;
+            }
+            next[i] = i < common ? (uint8_t)(byte ^ prev[i]) : byte;
+        }
+
+        next += length;
+        prev += (size_t)from.count * element;
+    }
+
+    return total;
+}
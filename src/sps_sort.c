@@ -0,0 +1,1065 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "sps.h"
+#include "sps_internal.h"
+
+/** @brief Length of the runs sorted by insertion before merging starts */
+#define SPS_SORT_RUN (16U)
+
+/** @brief Number of bits sorted per radix pass */
+#define SPS_RADIX_BITS (8U)
+
+/** @brief Fewest components a task of sps_sort_parallel is given */
+#define SPS_SORT_TASK_MIN (4096U)
+
+/** @brief Most tasks sps_sort_parallel splits a sort into */
+#define SPS_SORT_MAX_TASKS (64U)
+
+/** @brief Number of buckets per radix pass */
+#define SPS_RADIX_BUCKETS (1U << SPS_RADIX_BITS)
+
+/** @brief Number of radix passes needed for a 32-bit key */
+#define SPS_RADIX_PASSES (32U / SPS_RADIX_BITS)
+
+/**
+ * Comparator bound to a set. Components of a structure-of-arrays set are
+ * gathered into the two buffers before each comparison.
+ */
+typedef struct sps_comparer {
+    const sparse_set_t *set;
+    sps_sort_func_t compare;
+    void *context;
+    uint8_t *lhs; /**< Gather buffer of one component, SoA sets only */
+    uint8_t *rhs; /**< Gather buffer of one component, SoA sets only */
+#ifdef SPS_ENABLE_STATS
+    _Atomic uint64_t *comparisons; /**< Comparison counter of the set or of the task */
+#endif
+} sps_comparer_t;
+
+static inline int sps_compare_at(const sps_comparer_t *cmp, uint32_t a, uint32_t b) {
+    const sparse_set_t *set = cmp->set;
+#ifdef SPS_ENABLE_STATS
+    sps_counter_add(cmp->comparisons, 1);
+#endif
+    if (set->columns == NULL) {
+        return cmp->compare(sps_component(set, a), sps_component(set, b), cmp->context);
+    }
+
+    sps_load(set, a, cmp->lhs);
+    sps_load(set, b, cmp->rhs);
+    return cmp->compare(cmp->lhs, cmp->rhs, cmp->context);
+}
+
+static void sps_insertion_sort(const sps_comparer_t *cmp, uint32_t *order, uint32_t n) {
+    for (uint32_t i = 1; i < n; i++) {
+        uint32_t key = order[i];
+        uint32_t j   = i;
+
+        // Move elements that are greater than key to one position ahead
+        while (j > 0 && sps_compare_at(cmp, order[j - 1], key) > 0) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = key;
+    }
+}
+
+static void sps_merge(const sps_comparer_t *cmp,
+                      const uint32_t *src,
+                      uint32_t *dst,
+                      uint32_t lo,
+                      uint32_t mid,
+                      uint32_t hi) {
+    uint32_t left  = lo;
+    uint32_t right = mid;
+    uint32_t out   = lo;
+
+    // Taking from the left on ties keeps the merge stable
+    while (left < mid && right < hi) {
+        if (sps_compare_at(cmp, src[left], src[right]) <= 0) {
+            dst[out++] = src[left++];
+        } else {
+            dst[out++] = src[right++];
+        }
+    }
+
+    memcpy(dst + out, src + left, (mid - left) * sizeof(*dst));
+    out += mid - left;
+    memcpy(dst + out, src + right, (hi - right) * sizeof(*dst));
+}
+
+/**
+ * Stable bottom-up merge sort of n dense positions by the components they
+ * refer to. Returns whichever of the two buffers holds the result.
+ */
+static uint32_t *sps_sort_order(const sps_comparer_t *cmp,
+                                uint32_t *order,
+                                uint32_t *temp,
+                                uint32_t n) {
+    for (uint32_t lo = 0; lo < n; lo += SPS_SORT_RUN) {
+        uint32_t len = n - lo < SPS_SORT_RUN ? n - lo : SPS_SORT_RUN;
+        sps_insertion_sort(cmp, order + lo, len);
+    }
+
+    uint32_t *src = order;
+    uint32_t *dst = temp;
+    for (uint32_t width = SPS_SORT_RUN; width < n; width *= 2) {
+        for (uint32_t lo = 0; lo < n; lo += 2 * width) {
+            uint32_t mid = n - lo < width ? n : lo + width;
+            uint32_t hi  = n - mid < width ? n : mid + width;
+
+            // Runs that are already in order are copied without comparisons
+            if (mid == hi || sps_compare_at(cmp, src[mid - 1], src[mid]) <= 0) {
+                memcpy(dst + lo, src + lo, (hi - lo) * sizeof(*dst));
+            } else {
+                sps_merge(cmp, src, dst, lo, mid, hi);
+            }
+        }
+
+        uint32_t *swap = src;
+        src            = dst;
+        dst            = swap;
+    }
+
+    return src;
+}
+
+/**
+ * Move every element to its sorted position by following the cycles of the
+ * permutation, where order[i] is the old position of the element that ends
+ * up at position i. Only one component is held aside at a time. The order
+ * array is consumed.
+ */
+static void sps_apply_order(sparse_set_t *set, uint32_t *order, void *held) {
+    for (uint32_t start = 0; start < set->count; start++) {
+        if (order[start] == start) {
+            continue;
+        }
+
+        sps_load(set, start, held);
+        uint32_t held_index = set->dense[start];
+        uint8_t held_mark   = set->marks != NULL ? set->marks[start] : 0;
+
+        uint32_t pos = start;
+        while (order[pos] != start) {
+            uint32_t next = order[pos];
+            sps_move(set, pos, next, 1);
+            set->dense[pos] = set->dense[next];
+            sps_link(set, set->dense[pos], pos);
+            if (set->marks != NULL) set->marks[pos] = set->marks[next];
+
+            order[pos] = pos;
+            pos        = next;
+        }
+
+        sps_store(set, pos, held);
+        SPS_STAT_ADD(set, bytes_moved, set->component_size);
+        set->dense[pos] = held_index;
+        sps_link(set, held_index, pos);
+        if (set->marks != NULL) set->marks[pos] = held_mark;
+        order[pos] = pos;
+    }
+}
+
+/**
+ * Forget the recorded changes after the whole set has been sorted.
+ */
+static void sps_order_reset(sparse_set_t *set) {
+    if (!(set->flags & SPS_TRACK_ORDER)) {
+        return;
+    }
+
+    if (set->flags & SPS_ORDER_STALE) {
+        for (uint32_t i = 0; i < set->count; i++) {
+            set->marks[i] &= (uint8_t)~SPS_MARK_UNSORTED;
+        }
+    } else {
+        for (uint32_t i = 0; i < set->dirty_count; i++) {
+            uint32_t dense_idx = sps_lookup(set, set->dirty[i]);
+            if (dense_idx != SPARSE_SET_MAX) {
+                set->marks[dense_idx] &= (uint8_t)~SPS_MARK_UNSORTED;
+            }
+        }
+    }
+
+    set->dirty_count = 0;
+    set->flags &= ~SPS_ORDER_STALE;
+}
+
+static size_t sps_align_scratch(size_t size) {
+    return (size + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+}
+
+/**
+ * Bind a comparator to a set, taking its gather buffers from the two
+ * component sized slots at the start of buffers.
+ */
+static sps_comparer_t sps_comparer(sparse_set_t *set,
+                                   sps_sort_func_t compare,
+                                   void *context,
+                                   uint8_t *buffers) {
+    size_t component_bytes = sps_align_scratch(set->component_size);
+    if (set->columns != NULL) {
+        // Bytes between fields are never stored, keep them deterministic
+        memset(buffers, 0, 2 * component_bytes);
+    }
+
+    return (sps_comparer_t){
+        .set     = set,
+        .compare = compare,
+        .context = context,
+        .lhs     = buffers,
+        .rhs     = buffers + component_bytes,
+#ifdef SPS_ENABLE_STATS
+        .comparisons = &set->stats.comparisons,
+#endif
+    };
+}
+
+static void sps_sort_full(sparse_set_t *set, sps_sort_func_t compare, void *context) {
+    if (set == NULL || compare == NULL) {
+        sps_error("invalid arguments");
+        return;
+    }
+
+    if (set->flags & SPS_OWNED) {
+        sps_error("cannot sort a set owned by a group");
+        return;
+    }
+
+    if (set->flags & SPS_READ_ONLY) {
+        sps_error("cannot sort a read-only set");
+        return;
+    }
+
+    sps_assert_unpartitioned(set);
+
+    if (set->tombstones > 0) {
+        sps_compact(set);
+    }
+
+    if (set->count <= 1) {
+        sps_order_reset(set);
+        return;  // Already sorted or empty
+    }
+
+    // Two index buffers for the merge passes followed by room for one held
+    // component and the two gather buffers of the comparer
+    size_t index_bytes     = sps_align_scratch(2 * (size_t)set->count * sizeof(uint32_t));
+    size_t component_bytes = sps_align_scratch(set->component_size);
+
+    uint8_t *scratch = sps_workspace(set, index_bytes + 3 * component_bytes);
+    if (scratch == NULL) {
+        sps_error("failed to allocate sort workspace");
+        return;
+    }
+
+    uint32_t *buffers = (uint32_t *)(void *)scratch;
+    for (uint32_t i = 0; i < set->count; i++) {
+        buffers[i] = i;
+    }
+
+    sps_comparer_t cmp = sps_comparer(set, compare, context, scratch + index_bytes + component_bytes);
+    uint32_t *order    = sps_sort_order(&cmp, buffers, buffers + set->count, set->count);
+    sps_apply_order(set, order, scratch + index_bytes);
+    sps_order_reset(set);
+}
+
+void sps_sort(sparse_set_t *set, sps_sort_func_t compare, void *context) {
+    SPS_ZONE_BEGIN(zone, "sps_sort");
+    uint64_t start = sps_stats_clock();
+    sps_sort_full(set, compare, context);
+    sps_stats_sorted(set, start);
+    SPS_ZONE_END(zone);
+}
+
+/**
+ * State shared by the tasks of a parallel sort. Task t works on the dense
+ * positions from slice(t) up to slice(t + 1) in every phase.
+ */
+typedef struct sps_sort_job {
+    sparse_set_t *set;
+    sps_sort_func_t compare;
+    void *context;
+    uint32_t tasks;
+    uint32_t *src;       /**< Order read by the current phase */
+    uint32_t *dst;       /**< Order written by the current phase, then the gathered entities */
+    uint32_t run_count;  /**< Sorted runs in src, each starting at runs[i] */
+    uint8_t *buffers;    /**< Two comparer gather buffers per task */
+    uint8_t *rows;       /**< Gathered components, in sorted order */
+    uint8_t *marks;      /**< Gathered slot marks, or NULL */
+    uint32_t runs[SPS_SORT_MAX_TASKS + 1];
+#ifdef SPS_ENABLE_STATS
+    _Atomic uint64_t comparisons[SPS_SORT_MAX_TASKS];
+#endif
+} sps_sort_job_t;
+
+static uint32_t sps_job_slice(const sps_sort_job_t *job, size_t t) {
+    return (uint32_t)((uint64_t)job->set->count * t / job->tasks);
+}
+
+static sps_comparer_t sps_job_comparer(sps_sort_job_t *job, size_t t) {
+    size_t component_bytes = sps_align_scratch(job->set->component_size);
+    sps_comparer_t cmp =
+        sps_comparer(job->set, job->compare, job->context, job->buffers + t * 2 * component_bytes);
+#ifdef SPS_ENABLE_STATS
+    cmp.comparisons = &job->comparisons[t];
+#endif
+    return cmp;
+}
+
+/** Sort the slice of a task into a run of src */
+static void sps_sort_job_runs(void *task, size_t t) {
+    sps_sort_job_t *job = task;
+    sps_comparer_t cmp  = sps_job_comparer(job, t);
+    uint32_t lo         = sps_job_slice(job, t);
+    uint32_t hi         = sps_job_slice(job, t + 1);
+    for (uint32_t i = lo; i < hi; i++) {
+        job->src[i] = i;
+    }
+
+    uint32_t *sorted = sps_sort_order(&cmp, job->src + lo, job->dst + lo, hi - lo);
+    if (sorted != job->src + lo) {
+        memcpy(job->src + lo, sorted, (hi - lo) * sizeof(*sorted));
+    }
+}
+
+/**
+ * Number of elements the first k outputs of the stable merge of a and b
+ * take from a.
+ */
+static uint32_t sps_merge_split(const sps_comparer_t *cmp,
+                                const uint32_t *a,
+                                uint32_t a_len,
+                                const uint32_t *b,
+                                uint32_t b_len,
+                                uint32_t k) {
+    uint32_t lo = k > b_len ? k - b_len : 0;
+    uint32_t hi = k < a_len ? k : a_len;
+    while (lo < hi) {
+        // a[i] is among the first k if it is taken before b[k - i - 1], ties included
+        uint32_t i = lo + (hi - lo) / 2;
+        if (sps_compare_at(cmp, a[i], b[k - i - 1]) <= 0) {
+            lo = i + 1;
+        } else {
+            hi = i;
+        }
+    }
+
+    return lo;
+}
+
+/** Write the slice of a task of the round that merges pairs of runs from src into dst */
+static void sps_sort_job_merge(void *task, size_t t) {
+    sps_sort_job_t *job = task;
+    sps_comparer_t cmp  = sps_job_comparer(job, t);
+    uint32_t begin      = sps_job_slice(job, t);
+    uint32_t end        = sps_job_slice(job, t + 1);
+
+    for (uint32_t r = 0; r < job->run_count && job->runs[r] < end; r += 2) {
+        uint32_t lo  = job->runs[r];
+        uint32_t mid = job->runs[r + 1];
+        uint32_t hi  = job->runs[r + 2 <= job->run_count ? r + 2 : job->run_count];
+        uint32_t out = lo > begin ? lo : begin;
+        uint32_t top = hi < end ? hi : end;
+        if (out >= top) {
+            continue;
+        }
+
+        // Split both runs where the slice starts and ends in the merged output
+        const uint32_t *a = job->src + lo;
+        const uint32_t *b = job->src + mid;
+        uint32_t a_len    = mid - lo;
+        uint32_t b_len    = hi - mid;
+        uint32_t first     = sps_merge_split(&cmp, a, a_len, b, b_len, out - lo);
+        uint32_t last      = sps_merge_split(&cmp, a, a_len, b, b_len, top - lo);
+        uint32_t left      = lo + first;
+        uint32_t right     = mid + (out - lo - first);
+        uint32_t left_end  = lo + last;
+        uint32_t right_end = mid + (top - lo - last);
+
+        while (left < left_end && right < right_end) {
+            if (sps_compare_at(&cmp, job->src[left], job->src[right]) <= 0) {
+                job->dst[out++] = job->src[left++];
+            } else {
+                job->dst[out++] = job->src[right++];
+            }
+        }
+
+        memcpy(job->dst + out, job->src + left, (left_end - left) * sizeof(*job->dst));
+        out += left_end - left;
+        memcpy(job->dst + out, job->src + right, (right_end - right) * sizeof(*job->dst));
+    }
+}
+
+/** Copy the components, entities and marks of a slice out in sorted order */
+static void sps_sort_job_gather(void *task, size_t t) {
+    sps_sort_job_t *job     = task;
+    const sparse_set_t *set = job->set;
+    uint32_t end            = sps_job_slice(job, t + 1);
+    for (uint32_t i = sps_job_slice(job, t); i < end; i++) {
+        uint32_t from = job->src[i];
+        sps_load(set, from, job->rows + (size_t)i * set->component_size);
+        job->dst[i] = set->dense[from];
+        if (job->marks != NULL) job->marks[i] = set->marks[from];
+    }
+}
+
+/** Store the gathered slice back and relink its entities */
+static void sps_sort_job_store(void *task, size_t t) {
+    sps_sort_job_t *job = task;
+    sparse_set_t *set   = job->set;
+    uint32_t end        = sps_job_slice(job, t + 1);
+    for (uint32_t i = sps_job_slice(job, t); i < end; i++) {
+        sps_store(set, i, job->rows + (size_t)i * set->component_size);
+        set->dense[i] = job->dst[i];
+        sps_link(set, set->dense[i], i);
+        if (job->marks != NULL) set->marks[i] = job->marks[i];
+    }
+}
+
+static void sps_sort_tasks(sparse_set_t *set,
+                           sps_sort_func_t compare,
+                           void *context,
+                           const sps_scheduler_t *scheduler) {
+    if (set == NULL || compare == NULL) {
+        sps_error("invalid arguments");
+        return;
+    }
+
+    // Small sets and a single worker gain nothing from the extra passes
+    size_t tasks = scheduler != NULL && scheduler->run != NULL ? scheduler->workers : 1;
+    if (tasks > SPS_SORT_MAX_TASKS) tasks = SPS_SORT_MAX_TASKS;
+    if (tasks > set->count / SPS_SORT_TASK_MIN) tasks = set->count / SPS_SORT_TASK_MIN;
+    if (tasks <= 1 || (set->flags & (SPS_OWNED | SPS_READ_ONLY)) || set->partitioned > 0) {
+        sps_sort_full(set, compare, context);
+        return;
+    }
+
+    if (set->tombstones > 0) {
+        sps_compact(set);
+    }
+
+    // Two index buffers, the gather buffers of every comparer, the
+    // gathered marks and finally the gathered components
+    size_t n               = set->count;
+    size_t index_bytes     = sps_align_scratch(2 * n * sizeof(uint32_t));
+    size_t component_bytes = sps_align_scratch(set->component_size);
+    size_t buffer_bytes    = tasks * 2 * component_bytes;
+    size_t mark_bytes      = set->marks != NULL ? sps_align_scratch(n) : 0;
+    if (n > (SIZE_MAX - index_bytes - buffer_bytes - mark_bytes) / set->component_size) {
+        sps_sort_full(set, compare, context);
+        return;
+    }
+
+    uint8_t *scratch =
+        sps_workspace(set, index_bytes + buffer_bytes + mark_bytes + n * set->component_size);
+    if (scratch == NULL) {
+        sps_sort_full(set, compare, context);
+        return;
+    }
+
+    sps_sort_job_t job = {
+        .set       = set,
+        .compare   = compare,
+        .context   = context,
+        .tasks     = (uint32_t)tasks,
+        .src       = (uint32_t *)(void *)scratch,
+        .dst       = (uint32_t *)(void *)scratch + n,
+        .run_count = (uint32_t)tasks,
+        .buffers   = scratch + index_bytes,
+        .marks     = set->marks != NULL ? scratch + index_bytes + buffer_bytes : NULL,
+        .rows      = scratch + index_bytes + buffer_bytes + mark_bytes,
+    };
+    for (size_t t = 0; t <= tasks; t++) {
+        job.runs[t] = sps_job_slice(&job, t);
+    }
+
+    scheduler->run(sps_sort_job_runs, &job, tasks, scheduler->ctx);
+
+    // Each round halves the number of runs
+    while (job.run_count > 1) {
+        scheduler->run(sps_sort_job_merge, &job, tasks, scheduler->ctx);
+
+        uint32_t *swap = job.src;
+        job.src        = job.dst;
+        job.dst        = swap;
+
+        uint32_t merged = (job.run_count + 1) / 2;
+        for (uint32_t r = 0; r < merged; r++) {
+            job.runs[r] = job.runs[2 * r];
+        }
+        job.runs[merged] = (uint32_t)n;
+        job.run_count    = merged;
+    }
+
+    scheduler->run(sps_sort_job_gather, &job, tasks, scheduler->ctx);
+    scheduler->run(sps_sort_job_store, &job, tasks, scheduler->ctx);
+    SPS_STAT_ADD(set, bytes_moved, 2 * n * set->component_size);
+#ifdef SPS_ENABLE_STATS
+    for (size_t t = 0; t < tasks; t++) {
+        SPS_STAT_ADD(set, comparisons, atomic_load_explicit(&job.comparisons[t], memory_order_relaxed));
+    }
+#endif
+    sps_order_reset(set);
+}
+
+void sps_sort_parallel(sparse_set_t *set,
+                       sps_sort_func_t compare,
+                       void *context,
+                       const sps_scheduler_t *scheduler) {
+    SPS_ZONE_BEGIN(zone, "sps_sort_parallel");
+    uint64_t start = sps_stats_clock();
+    sps_sort_tasks(set, compare, context, scheduler);
+    sps_stats_sorted(set, start);
+    SPS_ZONE_END(zone);
+}
+
+/**
+ * Map a key to an unsigned integer whose natural order matches the order of
+ * the key type, so that a plain unsigned radix sort can be used for all types.
+ */
+static inline uint32_t sps_radix_key(const uint8_t *key, sps_key_type_t type) {
+    uint32_t bits;
+    memcpy(&bits, key, sizeof(bits));
+
+    switch (type) {
+        case SPS_KEY_U32:
+            return bits;
+        case SPS_KEY_I32:
+            return bits ^ 0x80000000U;
+        case SPS_KEY_F32:
+            // Negative floats order in reverse, positive ones just need the sign bit set
+            return (bits & 0x80000000U) ? ~bits : bits | 0x80000000U;
+        default:
+            return bits;
+    }
+}
+
+/**
+ * Stable LSD radix sort of the dense positions by their extracted key.
+ * Returns whichever of the two order buffers holds the result.
+ */
+static uint32_t *sps_radix_order(const sparse_set_t *set,
+                                 const uint8_t *key_base,
+                                 size_t key_stride,
+                                 sps_key_type_t type,
+                                 uint32_t *keys,
+                                 uint32_t *order,
+                                 uint32_t *temp_keys,
+                                 uint32_t *temp_order) {
+    uint32_t n = set->count;
+    uint32_t histogram[SPS_RADIX_PASSES][SPS_RADIX_BUCKETS];
+    memset(histogram, 0, sizeof(histogram));
+
+    // Extract keys and count every digit in a single pass over the components
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t key = sps_radix_key(key_base + (size_t)i * key_stride, type);
+        keys[i]      = key;
+        order[i]     = i;
+
+        for (uint32_t pass = 0; pass < SPS_RADIX_PASSES; pass++) {
+            histogram[pass][(key >> (pass * SPS_RADIX_BITS)) & (SPS_RADIX_BUCKETS - 1)]++;
+        }
+    }
+
+    for (uint32_t pass = 0; pass < SPS_RADIX_PASSES; pass++) {
+        uint32_t shift   = pass * SPS_RADIX_BITS;
+        uint32_t *counts = histogram[pass];
+
+        // A digit shared by every key leaves the order unchanged
+        if (counts[(keys[0] >> shift) & (SPS_RADIX_BUCKETS - 1)] == n) {
+            continue;
+        }
+
+        uint32_t offset = 0;
+        for (uint32_t bucket = 0; bucket < SPS_RADIX_BUCKETS; bucket++) {
+            uint32_t count = counts[bucket];
+            counts[bucket] = offset;
+            offset += count;
+        }
+
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t dst    = counts[(keys[i] >> shift) & (SPS_RADIX_BUCKETS - 1)]++;
+            temp_keys[dst]  = keys[i];
+            temp_order[dst] = order[i];
+        }
+
+        uint32_t *swap = keys;
+        keys           = temp_keys;
+        temp_keys      = swap;
+        swap           = order;
+        order          = temp_order;
+        temp_order     = swap;
+    }
+
+    return order;
+}
+
+static void sps_sort_keys(sparse_set_t *set, size_t key_offset, sps_key_type_t key_type) {
+    if (set == NULL || key_offset > set->component_size ||
+        set->component_size - key_offset < sizeof(uint32_t)) {
+        sps_error("invalid arguments");
+        return;
+    }
+
+    if (set->flags & SPS_OWNED) {
+        sps_error("cannot sort a set owned by a group");
+        return;
+    }
+
+    if (set->flags & SPS_READ_ONLY) {
+        sps_error("cannot sort a read-only set");
+        return;
+    }
+
+    sps_assert_unpartitioned(set);
+
+    if (set->tombstones > 0) {
+        sps_compact(set);
+    }
+
+    if (set->count <= 1) {
+        sps_order_reset(set);
+        return;  // Already sorted or empty
+    }
+
+    // Keys are read straight from the column holding them in SoA sets, and
+    // gathered into the workspace first from the blocks of a paged set
+    const uint8_t *key_base = NULL;
+    size_t key_stride       = set->component_size;
+    bool gather             = set->flags & SPS_PAGED;
+    if (gather) {
+        key_stride = sizeof(uint32_t);
+    } else if (set->columns == NULL) {
+        key_base = set->components + key_offset;
+    } else {
+        const sps_column_t *column = NULL;
+        for (uint32_t i = 0; i < set->column_count && column == NULL; i++) {
+            const sps_column_t *c = &set->columns[i];
+            if (key_offset >= c->offset && c->size >= sizeof(uint32_t) &&
+                key_offset - c->offset <= c->size - sizeof(uint32_t)) {
+                column = c;
+            }
+        }
+
+        if (column == NULL) {
+            sps_error("key is not inside a single field");
+            return;
+        }
+
+        key_base   = column->data + (key_offset - column->offset);
+        key_stride = column->size;
+    }
+
+    // Keys and positions, double buffered, then the gathered keys and room
+    // for one component
+    size_t n           = set->count;
+    size_t index_bytes = sps_align_scratch(4 * n * sizeof(uint32_t));
+    size_t key_bytes   = gather ? sps_align_scratch(n * sizeof(uint32_t)) : 0;
+
+    uint8_t *scratch = sps_workspace(set, index_bytes + key_bytes + set->component_size);
+    if (scratch == NULL) {
+        sps_error("failed to allocate sort workspace");
+        return;
+    }
+
+    if (gather) {
+        uint8_t *keys = scratch + index_bytes;
+        for (uint32_t i = 0; i < n; i++) {
+            memcpy(keys + (size_t)i * sizeof(uint32_t),
+                   (const uint8_t *)sps_component(set, i) + key_offset,
+                   sizeof(uint32_t));
+        }
+        key_base = keys;
+    }
+
+    uint32_t *buffers = (uint32_t *)(void *)scratch;
+    uint32_t *order   = sps_radix_order(
+        set, key_base, key_stride, key_type, buffers, buffers + n, buffers + 2 * n, buffers + 3 * n);
+    sps_apply_order(set, order, scratch + index_bytes + key_bytes);
+    sps_order_reset(set);
+}
+
+void sps_sort_by_key(sparse_set_t *set, size_t key_offset, sps_key_type_t key_type) {
+    SPS_ZONE_BEGIN(zone, "sps_sort_by_key");
+    uint64_t start = sps_stats_clock();
+    sps_sort_keys(set, key_offset, key_type);
+    sps_stats_sorted(set, start);
+    SPS_ZONE_END(zone);
+}
+
+static size_t sps_sort_match(sparse_set_t *target, const sparse_set_t *reference) {
+    if (target == NULL || reference == NULL) {
+        sps_error("invalid arguments");
+        return 0;
+    }
+
+    if (target->flags & SPS_OWNED) {
+        sps_error("cannot sort a set owned by a group");
+        return 0;
+    }
+
+    if (target->flags & SPS_READ_ONLY) {
+        sps_error("cannot sort a read-only set");
+        return 0;
+    }
+
+    sps_assert_unpartitioned(target);
+
+    if (target->tombstones > 0) {
+        sps_compact(target);
+    }
+
+    if (target == reference) {
+        return target->count;
+    }
+
+    // Old positions in their new order, followed by room for one component
+    size_t n           = target->count;
+    size_t index_bytes = sps_align_scratch(n * sizeof(uint32_t));
+
+    uint8_t *scratch = sps_workspace(target, index_bytes + target->component_size);
+    if (scratch == NULL) {
+        sps_error("failed to allocate sort workspace");
+        return 0;
+    }
+
+    uint32_t *order = (uint32_t *)(void *)scratch;
+    uint32_t shared = 0;
+    for (uint32_t i = 0; i < reference->count; i++) {
+        if (i + SPS_PREFETCH_DISTANCE < reference->count) {
+            sps_prefetch_slot(target, reference->dense[i + SPS_PREFETCH_DISTANCE]);
+        }
+
+        uint32_t index = reference->dense[i];
+        uint32_t pos   = index != SPS_TOMBSTONE ? sps_lookup(target, index) : SPARSE_SET_MAX;
+        if (pos != SPARSE_SET_MAX) {
+            order[shared++] = pos;
+        }
+    }
+
+    // Entities missing from reference keep their relative order behind the shared ones
+    uint32_t placed = shared;
+    for (uint32_t i = 0; i < n && placed < n; i++) {
+        if (sps_lookup(reference, target->dense[i]) == SPARSE_SET_MAX) {
+            order[placed++] = i;
+        }
+    }
+
+    sps_apply_order(target, order, scratch + index_bytes);
+    if (target->flags & SPS_TRACK_ORDER) {
+        target->flags |= SPS_ORDER_STALE;
+    }
+    return shared;
+}
+
+size_t sps_sort_as(sparse_set_t *target, const sparse_set_t *reference) {
+    SPS_ZONE_BEGIN(zone, "sps_sort_as");
+    uint64_t start = sps_stats_clock();
+    size_t shared  = sps_sort_match(target, reference);
+    sps_stats_sorted(target, start);
+    SPS_ZONE_END(zone);
+    return shared;
+}
+
+/**
+ * Sort distinct dense positions in ascending order with an LSD radix sort.
+ * Returns whichever of the two buffers holds the result.
+ */
+static uint32_t *sps_sort_positions(uint32_t *positions, uint32_t *temp, uint32_t n, uint32_t max) {
+    for (uint32_t shift = 0; shift < 32 && (max >> shift) != 0; shift += SPS_RADIX_BITS) {
+        uint32_t counts[SPS_RADIX_BUCKETS] = {0};
+        for (uint32_t i = 0; i < n; i++) {
+            counts[(positions[i] >> shift) & (SPS_RADIX_BUCKETS - 1)]++;
+        }
+
+        uint32_t offset = 0;
+        for (uint32_t bucket = 0; bucket < SPS_RADIX_BUCKETS; bucket++) {
+            uint32_t count = counts[bucket];
+            counts[bucket] = offset;
+            offset += count;
+        }
+
+        for (uint32_t i = 0; i < n; i++) {
+            temp[counts[(positions[i] >> shift) & (SPS_RADIX_BUCKETS - 1)]++] = positions[i];
+        }
+
+        uint32_t *swap = positions;
+        positions      = temp;
+        temp           = swap;
+    }
+
+    return positions;
+}
+
+/**
+ * Unchanged components keep their relative order around the holes left by
+ * the changed ones. The clean element of rank r lives at position r plus the
+ * number of holes before it, found by a binary search over the holes.
+ */
+static uint32_t sps_clean_position(const uint32_t *holes, uint32_t hole_count, uint32_t rank) {
+    uint32_t lo = 0;
+    uint32_t hi = hole_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (holes[mid] - mid <= rank) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return rank + lo;
+}
+
+/**
+ * Number of clean elements in front of the hole at dense_idx.
+ */
+static uint32_t sps_hole_rank(const uint32_t *holes, uint32_t hole_count, uint32_t dense_idx) {
+    uint32_t lo = 0;
+    uint32_t hi = hole_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (holes[mid] < dense_idx) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return dense_idx - lo;
+}
+
+/**
+ * Find the number of clean elements that sort before or equal to the changed
+ * component at dense_idx, searching [lo, hi) outwards from hint. Components
+ * whose key changed a little are found in a few comparisons.
+ */
+static uint32_t sps_insertion_rank(const sps_comparer_t *cmp,
+                                   const uint32_t *holes,
+                                   uint32_t hole_count,
+                                   uint32_t dense_idx,
+                                   uint32_t lo,
+                                   uint32_t hi,
+                                   uint32_t hint) {
+    if (hint < lo) hint = lo;
+    if (hint > hi) hint = hi;
+
+    // Gallop away from the hint until the answer is bracketed
+    uint32_t step = 1;
+    if (hint < hi &&
+        sps_compare_at(cmp, sps_clean_position(holes, hole_count, hint), dense_idx) <= 0) {
+        lo = hint + 1;
+        while (lo < hi) {
+            uint32_t probe = hi - lo > step ? lo + step : hi;
+            uint32_t pos   = sps_clean_position(holes, hole_count, probe - 1);
+            if (sps_compare_at(cmp, pos, dense_idx) > 0) {
+                hi = probe - 1;
+                break;
+            }
+            lo = probe;
+            step *= 2;
+        }
+    } else {
+        hi = hint;
+        while (lo < hi) {
+            uint32_t probe = hi - lo > step ? hi - step : lo;
+            uint32_t pos   = sps_clean_position(holes, hole_count, probe);
+            if (sps_compare_at(cmp, pos, dense_idx) <= 0) {
+                lo = probe + 1;
+                break;
+            }
+            hi = probe;
+            step *= 2;
+        }
+    }
+
+    // Upper bound inside the bracket
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        uint32_t pos = sps_clean_position(holes, hole_count, mid);
+        if (sps_compare_at(cmp, pos, dense_idx) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+typedef struct sps_segment {
+    uint32_t src; /**< First dense position of the run before the merge */
+    uint32_t dst; /**< First dense position of the run after the merge */
+    uint32_t len; /**< Number of elements in the run */
+} sps_segment_t;
+
+static void sps_move_segment(sparse_set_t *set, const sps_segment_t *segment) {
+    sps_move(set, segment->dst, segment->src, segment->len);
+    memmove(set->dense + segment->dst, set->dense + segment->src, segment->len * sizeof(*set->dense));
+    memmove(set->marks + segment->dst, set->marks + segment->src, segment->len * sizeof(*set->marks));
+
+    for (uint32_t i = segment->dst; i < segment->dst + segment->len; i++) {
+        sps_link(set, set->dense[i], i);
+    }
+}
+
+static void sps_sort_dirty(sparse_set_t *set, sps_sort_func_t compare, void *context) {
+    if (set == NULL || compare == NULL) {
+        sps_error("invalid arguments");
+        return;
+    }
+
+    if (set->flags & SPS_OWNED) {
+        sps_error("cannot sort a set owned by a group");
+        return;
+    }
+
+    if (set->flags & SPS_READ_ONLY) {
+        sps_error("cannot sort a read-only set");
+        return;
+    }
+
+    sps_assert_unpartitioned(set);
+
+    if (set->tombstones > 0) {
+        sps_compact(set);
+    }
+
+    if (!(set->flags & SPS_TRACK_ORDER)) {
+        if (!sps_alloc_marks(set)) {
+            sps_error("failed to allocate tracking state");
+            return;
+        }
+        set->flags |= SPS_TRACK_ORDER | SPS_ORDER_STALE;
+    }
+
+    // When much of the set changed a full sort does less work
+    uint32_t n = set->count;
+    if ((set->flags & SPS_ORDER_STALE) || set->dirty_count > n / 4) {
+        sps_sort_full(set, compare, context);
+        return;
+    }
+
+    if (set->dirty_count == 0) {
+        return;
+    }
+
+    // Positions, sorted positions, merge scratch and insertion ranks, then
+    // the merge segments, the held marks, the comparer's gather buffers and
+    // finally the held components
+    size_t k               = set->dirty_count;
+    size_t segment_bytes   = (2 * k + 1) * sizeof(sps_segment_t);
+    size_t index_bytes     = sps_align_scratch(4 * k * sizeof(uint32_t) + segment_bytes + k);
+    size_t component_bytes = sps_align_scratch(set->component_size);
+
+    uint8_t *scratch =
+        sps_workspace(set, index_bytes + 2 * component_bytes + k * set->component_size);
+    if (scratch == NULL) {
+        sps_error("failed to allocate sort workspace");
+        return;
+    }
+
+    uint32_t *holes       = (uint32_t *)(void *)scratch;
+    uint32_t *sorted      = holes + k;
+    uint32_t *temp        = sorted + k;
+    uint32_t *ranks       = temp + k;
+    sps_segment_t *moves  = (sps_segment_t *)(void *)(ranks + k);
+    uint8_t *held_marks   = (uint8_t *)(moves + 2 * k + 1);
+    uint8_t *held         = scratch + index_bytes + 2 * component_bytes;
+    uint32_t *held_dense  = temp;
+    sps_comparer_t cmp    = sps_comparer(set, compare, context, scratch + index_bytes);
+
+    // Collect each changed component once
+    uint32_t changed = 0;
+    for (uint32_t i = 0; i < set->dirty_count; i++) {
+        uint32_t dense_idx = sps_lookup(set, set->dirty[i]);
+        if (dense_idx == SPARSE_SET_MAX || !(set->marks[dense_idx] & SPS_MARK_UNSORTED)) {
+            continue;
+        }
+
+        set->marks[dense_idx] &= (uint8_t)~SPS_MARK_UNSORTED;
+        holes[changed++] = dense_idx;
+    }
+    set->dirty_count = 0;
+
+    if (changed == 0) {
+        return;
+    }
+
+    uint32_t *positions = sps_sort_positions(holes, sorted, changed, n - 1);
+    if (positions != holes) memcpy(holes, positions, changed * sizeof(*holes));
+
+    // Order the changed components among themselves, ties by position
+    memcpy(sorted, holes, changed * sizeof(*sorted));
+    positions = sps_sort_order(&cmp, sorted, temp, changed);
+    if (positions != sorted) memcpy(sorted, positions, changed * sizeof(*sorted));
+
+    // Insertion ranks are non-decreasing, so each search starts at the previous result
+    uint32_t clean = n - changed;
+    uint32_t lo    = 0;
+    for (uint32_t i = 0; i < changed; i++) {
+        uint32_t hint = sps_hole_rank(holes, changed, sorted[i]);
+        ranks[i]      = sps_insertion_rank(&cmp, holes, changed, sorted[i], lo, clean, hint);
+        lo = ranks[i];
+    }
+
+    // Split the clean elements into runs that move by the same distance
+    uint32_t segments = 0;
+    uint32_t rank     = 0;
+    uint32_t before   = 0;  // holes in front of the current rank
+    uint32_t inserted = 0;  // changed components merged in front of the current rank
+    while (rank < clean) {
+        while (before < changed && holes[before] - before <= rank) before++;
+        while (inserted < changed && ranks[inserted] <= rank) inserted++;
+
+        uint32_t end = clean;
+        if (before < changed && holes[before] - before < end) end = holes[before] - before;
+        if (inserted < changed && ranks[inserted] < end) end = ranks[inserted];
+
+        if (before != inserted) {
+            moves[segments++] = (sps_segment_t){
+                .src = rank + before,
+                .dst = rank + inserted,
+                .len = end - rank,
+            };
+        }
+        rank = end;
+    }
+
+    // Hold the changed components aside, in sorted order
+    for (uint32_t i = 0; i < changed; i++) {
+        sps_load(set, sorted[i], held + (size_t)i * set->component_size);
+        held_dense[i] = set->dense[sorted[i]];
+        held_marks[i] = set->marks[sorted[i]];
+    }
+
+    // Runs moving towards the front go first, front to back, then the runs
+    // moving towards the back, back to front, so no run overwrites another
+    for (uint32_t i = 0; i < segments; i++) {
+        if (moves[i].dst < moves[i].src) sps_move_segment(set, &moves[i]);
+    }
+
+    for (uint32_t i = segments; i > 0; i--) {
+        if (moves[i - 1].dst > moves[i - 1].src) sps_move_segment(set, &moves[i - 1]);
+    }
+
+    for (uint32_t i = 0; i < changed; i++) {
+        uint32_t dense_idx = ranks[i] + i;
+        sps_store(set, dense_idx, held + (size_t)i * set->component_size);
+        set->dense[dense_idx] = held_dense[i];
+        set->marks[dense_idx] = held_marks[i];
+        sps_link(set, held_dense[i], dense_idx);
+    }
+    SPS_STAT_ADD(set, bytes_moved, (size_t)changed * set->component_size);
+}
+
+void sps_sort_incremental(sparse_set_t *set, sps_sort_func_t compare, void *context) {
+    SPS_ZONE_BEGIN(zone, "sps_sort_incremental");
+    uint64_t start = sps_stats_clock();
+    sps_sort_dirty(set, compare, context);
+    sps_stats_sorted(set, start);
+    SPS_ZONE_END(zone);
+}
@@ -0,0 +1,169 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "sps.h"
+#include "sps_internal.h"
+
+sps_view_t sps_view_new(sparse_set_t *const *sets, size_t set_count) {
+    sps_view_t view = {0};
+    if (sets == NULL || set_count == 0 || set_count > SPS_VIEW_MAX_SETS) {
+        sps_error("invalid arguments");
+        return view;
+    }
+
+    for (size_t i = 0; i < set_count; i++) {
+        if (sets[i] == NULL) {
+            sps_error("sparse set is invalid");
+            return (sps_view_t){0};
+        }
+
+        view.sets[i] = sets[i];
+        if (sets[i]->count < sets[view.driver]->count) {
+            view.driver = (uint32_t)i;
+        }
+    }
+
+    view.set_count = (uint32_t)set_count;
+    return view;
+}
+
+static bool sps_view_probe(const sps_view_t *view, uint32_t entity, void **components) {
+    for (uint32_t s = 0; s < view->set_count; s++) {
+        if (s == view->driver) {
+            continue;
+        }
+
+        uint32_t dense_idx = sps_lookup(view->sets[s], entity);
+        if (dense_idx == SPARSE_SET_MAX) {
+            return false;
+        }
+
+        components[s] = sps_element(view->sets[s], dense_idx);
+    }
+
+    return true;
+}
+
+bool sps_view_next(sps_view_t *view, uint32_t *index, void **components) {
+    if (view == NULL || components == NULL) {
+        sps_error("invalid function paramaters");
+        return false;
+    }
+
+    if (view->set_count == 0) {
+        return false;
+    }
+
+    const sparse_set_t *driver = view->sets[view->driver];
+    while (view->position < driver->count) {
+        uint32_t pos = view->position++;
+
+        if (pos + SPS_PREFETCH_DISTANCE < driver->count) {
+            uint32_t ahead = driver->dense[pos + SPS_PREFETCH_DISTANCE];
+            for (uint32_t s = 0; s < view->set_count; s++) {
+                if (s != view->driver) sps_prefetch_slot(view->sets[s], ahead);
+            }
+        }
+
+        uint32_t entity = driver->dense[pos];
+        if (entity == SPS_TOMBSTONE || !sps_view_probe(view, entity, components)) {
+            continue;
+        }
+
+        components[view->driver] = sps_element(driver, pos);
+        if (index != NULL) {
+            *index = entity;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+bool sps_view_next_block(sps_view_t *view, sps_view_block_t *block) {
+    if (view == NULL || block == NULL) {
+        sps_error("invalid function paramaters");
+        return false;
+    }
+
+    block->count = 0;
+    if (view->set_count == 0) {
+        return false;
+    }
+
+    // Dense position of every surviving candidate in each set probed so far
+    uint32_t positions[SPS_VIEW_MAX_SETS][SPS_VIEW_BLOCK];
+    uint32_t probed[SPS_VIEW_MAX_SETS];
+    uint32_t *entities         = block->entities;
+    const sparse_set_t *driver = view->sets[view->driver];
+
+    while (block->count == 0 && view->position < driver->count) {
+        uint32_t begin = view->position;
+        uint32_t alive = driver->count - begin;
+        if (alive > SPS_VIEW_BLOCK) alive = SPS_VIEW_BLOCK;
+        view->position += alive;
+
+        memcpy(entities, driver->dense + begin, alive * sizeof(*entities));
+        for (uint32_t i = 0; i < alive; i++) {
+            positions[view->driver][i] = begin + i;
+        }
+
+        if (driver->tombstones > 0) {
+            uint32_t kept = 0;
+            for (uint32_t i = 0; i < alive; i++) {
+                if (entities[i] == SPS_TOMBSTONE) {
+                    continue;
+                }
+                entities[kept]                   = entities[i];
+                positions[view->driver][kept++] = begin + i;
+            }
+            alive = kept;
+        }
+        probed[0]          = view->driver;
+        uint32_t set_probed = 1;
+
+        // Filter the candidates one set at a time, compacting the survivors
+        for (uint32_t s = 0; s < view->set_count && alive > 0; s++) {
+            if (s == view->driver) {
+                continue;
+            }
+
+            const sparse_set_t *set = view->sets[s];
+            for (uint32_t i = 0; i < alive && i < SPS_PREFETCH_DISTANCE; i++) {
+                sps_prefetch_slot(set, entities[i]);
+            }
+
+            uint32_t kept = 0;
+            for (uint32_t i = 0; i < alive; i++) {
+                if (i + SPS_PREFETCH_DISTANCE < alive) {
+                    sps_prefetch_slot(set, entities[i + SPS_PREFETCH_DISTANCE]);
+                }
+
+                uint32_t dense_idx = sps_lookup(set, entities[i]);
+                if (dense_idx == SPARSE_SET_MAX) {
+                    continue;
+                }
+
+                if (kept != i) {
+                    entities[kept] = entities[i];
+                    for (uint32_t p = 0; p < set_probed; p++) {
+                        positions[probed[p]][kept] = positions[probed[p]][i];
+                    }
+                }
+                positions[s][kept++] = dense_idx;
+            }
+
+            probed[set_probed++] = s;
+            alive                = kept;
+        }
+
+        for (uint32_t s = 0; s < view->set_count; s++) {
+            for (uint32_t i = 0; i < alive; i++) {
+                block->components[s][i] = sps_element(view->sets[s], positions[s][i]);
+            }
+        }
+        block->count = alive;
+    }
+
+    return block->count > 0;
+}
@@ -1,8 +1,16 @@
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include <unity.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#define TEST_HAVE_THREADS 1
+#endif
+
 #include "sps.h"
+#include "sps_typed.h"
 #include "unity_internals.h"
 
 static sparse_set_t *set = NULL;
@@ -71,7 +79,7 @@ static void test_sps_iter(void) {
 
   // Test iteration
   sparse_set_iter_t iter = sps_iter_new(set);
-  uint16_t idx;
+  uint32_t idx;
   int count = 0;
   int found[3] = {0, 0, 0};
 
@@ -135,7 +143,7 @@ static void test_sps_sort(void) {
 
   // Verify components are sorted but indices are maintained
   sparse_set_iter_t iter = sps_iter_new(set);
-  uint16_t idx;
+  uint32_t idx;
   int prev_value = 0;
   int count = 0;
 
@@ -159,6 +167,1896 @@ static void test_sps_sort(void) {
   TEST_ASSERT_EQUAL(5, count);
 }
 
+static void test_sps_growth(void) {
+  sparse_set_t *grow_set = sps_new_ex(sizeof(int), 2, 100);
+  TEST_ASSERT_NOT_NULL(grow_set);
+  TEST_ASSERT_EQUAL(2, sps_capacity(grow_set));
+
+  // Grow past the initial capacity
+  for (uint16_t i = 0; i < 100; i++) {
+    int value = i * 3;
+    TEST_ASSERT_NOT_NULL(sps_add(grow_set, i, &value));
+  }
+  TEST_ASSERT_EQUAL(100, sps_count(grow_set));
+  TEST_ASSERT_EQUAL(100, sps_capacity(grow_set));
+
+  for (uint16_t i = 0; i < 100; i++) {
+    int *comp = sps_get(grow_set, i);
+    TEST_ASSERT_NOT_NULL(comp);
+    TEST_ASSERT_EQUAL(i * 3, *comp);
+  }
+
+  // The maximum capacity is a hard limit
+  TEST_ASSERT_NULL(sps_add(grow_set, 100, &(int){1}));
+  TEST_ASSERT_NULL(sps_add_or_replace(grow_set, 100, &(int){1}));
+  TEST_ASSERT_FALSE(sps_reserve(grow_set, 101));
+
+  sps_free(grow_set);
+}
+
+static void test_sps_reserve(void) {
+  sparse_set_t *lazy_set = sps_new_ex(sizeof(int), 0, SPARSE_SET_MAX);
+  TEST_ASSERT_NOT_NULL(lazy_set);
+  TEST_ASSERT_EQUAL(0, sps_capacity(lazy_set));
+
+  TEST_ASSERT_TRUE(sps_reserve(lazy_set, 1000));
+  TEST_ASSERT_EQUAL(1000, sps_capacity(lazy_set));
+
+  // Adding within the reserved capacity never moves the storage
+  int *first = sps_add(lazy_set, 0, &(int){7});
+  for (uint16_t i = 1; i < 1000; i++) {
+    sps_add(lazy_set, i, &(int){i});
+  }
+  TEST_ASSERT_EQUAL_PTR(first, sps_get(lazy_set, 0));
+  TEST_ASSERT_EQUAL(7, *first);
+
+  sps_free(lazy_set);
+
+  // Invalid capacity bounds
+  TEST_ASSERT_NULL(sps_new_ex(sizeof(int), 1, 0));
+  TEST_ASSERT_NULL(sps_new_ex(0, 1, 10));
+}
+
+static void test_sps_wide_indices(void) {
+  uint32_t indices[] = {0, 70000, 1u << 24, 4000000000u};
+
+  for (int i = 0; i < 4; i++) {
+    int value = i + 1;
+    TEST_ASSERT_NOT_NULL(sps_add(set, indices[i], &value));
+  }
+
+  for (int i = 0; i < 4; i++) {
+    int *comp = sps_get(set, indices[i]);
+    TEST_ASSERT_NOT_NULL(comp);
+    TEST_ASSERT_EQUAL(i + 1, *comp);
+  }
+
+  // Neighbours on touched pages and indices on untouched pages are empty
+  TEST_ASSERT_FALSE(sps_has(set, 70001));
+  TEST_ASSERT_FALSE(sps_has(set, 3000000000u));
+  TEST_ASSERT_FALSE(sps_has(set, SPARSE_SET_MAX - 1));
+  TEST_ASSERT_NULL(sps_get(set, 4000000001u));
+
+  // Only the four touched pages are allocated
+  TEST_ASSERT_EQUAL(4, set->pages_used);
+
+  sps_remove(set, 70000);
+  TEST_ASSERT_FALSE(sps_has(set, 70000));
+  TEST_ASSERT_EQUAL(3, sps_count(set));
+  TEST_ASSERT_EQUAL(4, *(int *)sps_get(set, 4000000000u));
+}
+
+static void test_sps_memory_usage(void) {
+  size_t empty = sps_memory_usage(set);
+
+  // A single distant index costs one page, not a table spanning the range
+  sps_add(set, 3000000000u, &(int){1});
+  size_t used = sps_memory_usage(set);
+  TEST_ASSERT_TRUE(used > empty);
+  TEST_ASSERT_TRUE(used - empty < 8 * 1024 * 1024);
+
+  // A second index on the same page allocates nothing new
+  sps_add(set, 3000000001u, &(int){2});
+  TEST_ASSERT_EQUAL(used, sps_memory_usage(set));
+}
+
+static void test_sps_handles(void) {
+  sps_handle_t first = sps_handle_make(12, 1);
+  int comp = 55;
+
+  TEST_ASSERT_NOT_NULL(sps_add_handle(set, first, &comp));
+  TEST_ASSERT_TRUE(sps_has_handle(set, first));
+  TEST_ASSERT_EQUAL(55, *(int *)sps_get_handle(set, first));
+  TEST_ASSERT_EQUAL_UINT64(first, sps_handle(set, 12));
+
+  // Plain index access ignores the generation
+  TEST_ASSERT_EQUAL(55, *(int *)sps_get(set, 12));
+
+  // Recycle the index under a new generation
+  sps_remove_handle(set, first);
+  TEST_ASSERT_FALSE(sps_has(set, 12));
+  TEST_ASSERT_EQUAL_UINT64(SPS_HANDLE_INVALID, sps_handle(set, 12));
+
+  sps_handle_t second = sps_handle_make(12, 2);
+  comp = 66;
+  sps_add_handle(set, second, &comp);
+
+  // The stale handle no longer reaches the component
+  TEST_ASSERT_FALSE(sps_has_handle(set, first));
+  TEST_ASSERT_NULL(sps_get_handle(set, first));
+  sps_remove_handle(set, first); // Should not remove the new owner
+  TEST_ASSERT_EQUAL(66, *(int *)sps_get_handle(set, second));
+
+  // Generations survive being moved by a swap removal
+  sps_add_handle(set, sps_handle_make(13, 9), &comp);
+  sps_remove(set, 12);
+  TEST_ASSERT_TRUE(sps_has_handle(set, sps_handle_make(13, 9)));
+  TEST_ASSERT_FALSE(sps_has_handle(set, sps_handle_make(13, 8)));
+
+  // Components added by index use generation 0
+  sps_add(set, 14, &comp);
+  TEST_ASSERT_TRUE(sps_has_handle(set, sps_handle_make(14, 0)));
+}
+
+typedef struct {
+  int key;
+  uint32_t seq;
+} keyed_t;
+
+static int compare_keyed(const void *a, const void *b, void *context) {
+  (void)context;
+  return ((const keyed_t *)a)->key - ((const keyed_t *)b)->key;
+}
+
+static void test_sps_sort_stable_large(void) {
+  sparse_set_t *keyed = sps_new(sizeof(keyed_t));
+  uint32_t n = 5000;
+
+  // Few distinct keys so that stability is observable
+  srand(1234);
+  for (uint32_t i = 0; i < n; i++) {
+    keyed_t value = {rand() % 50, i};
+    sps_add(keyed, i * 7, &value);
+  }
+
+  sps_sort(keyed, compare_keyed, NULL);
+  void *workspace = keyed->scratch;
+
+  for (uint32_t i = 0; i < n; i++) {
+    keyed_t *comp = sps_get(keyed, keyed->dense[i]);
+    TEST_ASSERT_EQUAL_PTR(keyed->components + i * sizeof(keyed_t), comp);
+    TEST_ASSERT_EQUAL(keyed->dense[i], comp->seq * 7);
+
+    if (i > 0) {
+      keyed_t *prev = sps_get(keyed, keyed->dense[i - 1]);
+      TEST_ASSERT_TRUE(prev->key <= comp->key);
+      if (prev->key == comp->key) {
+        TEST_ASSERT_TRUE(prev->seq < comp->seq);
+      }
+    }
+  }
+
+  // Sorting again reuses the workspace
+  sps_sort(keyed, compare_keyed, NULL);
+  TEST_ASSERT_EQUAL_PTR(workspace, keyed->scratch);
+
+  sps_free(keyed);
+}
+
+typedef struct {
+  uint32_t id;
+  float depth;
+  int32_t layer;
+} sprite_t;
+
+static int compare_depth(const void *a, const void *b, void *context) {
+  (void)context;
+  float da = ((const sprite_t *)a)->depth;
+  float db = ((const sprite_t *)b)->depth;
+  return (da > db) - (da < db);
+}
+
+static void test_sps_sort_by_key(void) {
+  sparse_set_t *by_key = sps_new(sizeof(sprite_t));
+  sparse_set_t *by_cmp = sps_new(sizeof(sprite_t));
+
+  srand(99);
+  for (uint32_t i = 0; i < 3000; i++) {
+    sprite_t sprite = {
+        .id = i,
+        .depth = (float)(rand() % 200 - 100) * 0.5f,
+        .layer = rand() % 7 - 3,
+    };
+    sps_add(by_key, i, &sprite);
+    sps_add(by_cmp, i, &sprite);
+  }
+
+  // Float keys match the stable comparator sort exactly
+  sps_sort_by_key(by_key, offsetof(sprite_t, depth), SPS_KEY_F32);
+  sps_sort(by_cmp, compare_depth, NULL);
+  TEST_ASSERT_EQUAL_MEMORY(by_cmp->dense, by_key->dense, 3000 * sizeof(uint32_t));
+  TEST_ASSERT_EQUAL_MEMORY(by_cmp->components, by_key->components,
+                           3000 * sizeof(sprite_t));
+
+  // Signed keys, stable with respect to the previous depth order
+  sps_sort_by_key(by_key, offsetof(sprite_t, layer), SPS_KEY_I32);
+  for (uint32_t i = 1; i < 3000; i++) {
+    sprite_t *prev = sps_get(by_key, by_key->dense[i - 1]);
+    sprite_t *cur = sps_get(by_key, by_key->dense[i]);
+    TEST_ASSERT_TRUE(prev->layer <= cur->layer);
+    if (prev->layer == cur->layer) {
+      TEST_ASSERT_TRUE(prev->depth <= cur->depth);
+    }
+  }
+
+  // Unsigned keys, every component still reachable by its index
+  sps_sort_by_key(by_key, offsetof(sprite_t, id), SPS_KEY_U32);
+  for (uint32_t i = 0; i < 3000; i++) {
+    TEST_ASSERT_EQUAL(i, by_key->dense[i]);
+    TEST_ASSERT_EQUAL(i, ((sprite_t *)sps_get(by_key, i))->id);
+  }
+
+  sps_free(by_key);
+  sps_free(by_cmp);
+}
+
+static int compare_calls = 0;
+
+static int compare_counted(const void *a, const void *b, void *context) {
+  (void)context;
+  compare_calls++;
+  return *(const int *)a - *(const int *)b;
+}
+
+static void assert_sorted_and_linked(sparse_set_t *s) {
+  for (uint32_t i = 0; i < s->count; i++) {
+    int *comp = sps_get(s, s->dense[i]);
+    TEST_ASSERT_EQUAL_PTR(s->components + i * sizeof(int), comp);
+    if (i > 0) {
+      TEST_ASSERT_TRUE(*(int *)sps_get(s, s->dense[i - 1]) <= *comp);
+    }
+  }
+}
+
+static void test_sps_sort_incremental(void) {
+  sparse_set_t *depth = sps_new(sizeof(int));
+  uint32_t n = 4000;
+
+  srand(7);
+  for (uint32_t i = 0; i < n; i++) {
+    sps_add(depth, i, &(int){rand() % 100000});
+  }
+
+  // The first call sorts everything and starts tracking
+  sps_sort_incremental(depth, compare_counted, NULL);
+  assert_sorted_and_linked(depth);
+  TEST_ASSERT_TRUE(depth->flags & SPS_TRACK_ORDER);
+
+  for (int frame = 0; frame < 20; frame++) {
+    // Nudge a few keys in place, replace one, churn a couple of entities
+    for (int j = 0; j < 5; j++) {
+      uint32_t index = (uint32_t)(rand() % (int)n);
+      int *comp = sps_get(depth, index);
+      if (comp != NULL) {
+        *comp += rand() % 2000 - 1000;
+        sps_mark_dirty(depth, index);
+      }
+    }
+
+    uint32_t victim = (uint32_t)(rand() % (int)n);
+    if (sps_has(depth, victim)) {
+      sps_remove(depth, victim);
+    }
+    sps_add_or_replace(depth, (uint32_t)(rand() % (int)n), &(int){rand() % 100000});
+    sps_add_or_replace(depth, n + (uint32_t)frame, &(int){rand() % 100000});
+
+    compare_calls = 0;
+    sps_sort_incremental(depth, compare_counted, NULL);
+    assert_sorted_and_linked(depth);
+
+    // Far fewer comparisons than the n log n of a full sort
+    TEST_ASSERT_TRUE(compare_calls < 1000);
+  }
+
+  // Nothing changed, nothing to compare
+  compare_calls = 0;
+  sps_sort_incremental(depth, compare_counted, NULL);
+  TEST_ASSERT_EQUAL(0, compare_calls);
+
+  // Large changes fall back to a full sort that is still correct
+  for (uint32_t i = 0; i < n; i += 2) {
+    int *comp = sps_get(depth, i);
+    if (comp != NULL) {
+      *comp = rand() % 100000;
+      sps_mark_dirty(depth, i);
+    }
+  }
+  sps_sort_incremental(depth, compare_counted, NULL);
+  assert_sorted_and_linked(depth);
+
+  sps_free(depth);
+}
+
+static void test_sps_add_many(void) {
+  uint32_t indices[256];
+  int values[256];
+  for (int i = 0; i < 256; i++) {
+    indices[i] = (uint32_t)(i * 5000);
+    values[i] = i * 2;
+  }
+
+  sps_add(set, 1, &(int){-1});
+  int *block = sps_add_many(set, indices, 256, values);
+  TEST_ASSERT_NOT_NULL(block);
+  TEST_ASSERT_EQUAL(257, sps_count(set));
+  TEST_ASSERT_EQUAL_INT_ARRAY(values, block, 256);
+
+  for (int i = 0; i < 256; i++) {
+    TEST_ASSERT_EQUAL_PTR(&block[i], sps_get(set, indices[i]));
+  }
+
+  // A batch that collides with the set or with itself changes nothing
+  uint32_t clash[] = {7, 8, 1};
+  uint32_t repeat[] = {7, 8, 7};
+  TEST_ASSERT_NULL(sps_add_many(set, clash, 3, values));
+  TEST_ASSERT_NULL(sps_add_many(set, repeat, 3, values));
+  TEST_ASSERT_EQUAL(257, sps_count(set));
+  TEST_ASSERT_FALSE(sps_has(set, 7));
+  TEST_ASSERT_FALSE(sps_has(set, 8));
+}
+
+static void test_sps_remove_many(void) {
+  for (uint32_t i = 0; i < 100; i++) {
+    sps_add(set, i, &(int){(int)i});
+  }
+
+  uint32_t evens[50];
+  for (uint32_t i = 0; i < 50; i++) {
+    evens[i] = i * 2;
+  }
+
+  TEST_ASSERT_EQUAL(50, sps_remove_many(set, evens, 50));
+  TEST_ASSERT_EQUAL(50, sps_count(set));
+  for (uint32_t i = 0; i < 100; i++) {
+    TEST_ASSERT_EQUAL(i % 2 == 1, sps_has(set, i));
+  }
+
+  // Already removed indices are skipped
+  TEST_ASSERT_EQUAL(0, sps_remove_many(set, evens, 50));
+}
+
+static void test_sps_get_many(void) {
+  for (uint32_t i = 0; i < 80; i++) {
+    sps_add(set, i * 3, &(int){(int)i});
+  }
+
+  uint32_t query[40];
+  for (uint32_t i = 0; i < 40; i++) {
+    query[i] = i * 6 + (i % 4 == 3); // every fourth index is missing
+  }
+
+  void *pointers[40];
+  TEST_ASSERT_EQUAL(30, sps_get_many(set, query, 40, pointers));
+
+  int copies[40];
+  TEST_ASSERT_EQUAL(30, sps_copy_many(set, query, 40, copies));
+
+  for (uint32_t i = 0; i < 40; i++) {
+    if (i % 4 == 3) {
+      TEST_ASSERT_NULL(pointers[i]);
+      TEST_ASSERT_EQUAL(0, copies[i]);
+    } else {
+      TEST_ASSERT_EQUAL_PTR(sps_get(set, query[i]), pointers[i]);
+      TEST_ASSERT_EQUAL((int)i * 2, copies[i]);
+    }
+  }
+}
+
+static void test_sps_spans(void) {
+  for (uint32_t i = 0; i < 10; i++) {
+    sps_add(set, i * 11, &(int){(int)i * 10});
+  }
+
+  sparse_set_span_t whole = sps_span(set);
+  TEST_ASSERT_EQUAL(10, whole.count);
+  TEST_ASSERT_EQUAL_PTR(set->dense, whole.entities);
+  TEST_ASSERT_EQUAL_PTR(set->components, whole.components);
+
+  // Chunks of four cover the set exactly once
+  sparse_set_iter_t iter = sps_iter_new(set);
+  sparse_set_span_t span;
+  size_t seen = 0;
+  int chunks = 0;
+  while (sps_iter_next_span(&iter, 4, &span)) {
+    TEST_ASSERT_EQUAL(seen, span.begin);
+    TEST_ASSERT_TRUE(span.count <= 4);
+
+    int *comps = span.components;
+    for (size_t i = 0; i < span.count; i++) {
+      TEST_ASSERT_EQUAL_PTR(sps_get(set, span.entities[i]), &comps[i]);
+    }
+
+    seen += span.count;
+    chunks++;
+  }
+  TEST_ASSERT_EQUAL(10, seen);
+  TEST_ASSERT_EQUAL(3, chunks);
+  TEST_ASSERT_EQUAL(0, span.count);
+
+  // Spans and single steps share the iterator position
+  iter = sps_iter_new(set);
+  TEST_ASSERT_NOT_NULL(sps_iter_next(&iter, NULL));
+  TEST_ASSERT_TRUE(sps_iter_next_span(&iter, 0, &span));
+  TEST_ASSERT_EQUAL(1, span.begin);
+  TEST_ASSERT_EQUAL(9, span.count);
+  TEST_ASSERT_NULL(sps_iter_next(&iter, NULL));
+}
+
+typedef struct {
+  float x, y, z, w;
+} vec4_t;
+
+SPS_DEFINE(vec4, vec4_t)
+
+static int compare_vec4_x(const vec4_t *a, const vec4_t *b, void *context) {
+  (void)context;
+  return (a->x > b->x) - (a->x < b->x);
+}
+
+static void test_sps_typed(void) {
+  sparse_set_t *vecs = vec4_sps_new();
+  TEST_ASSERT_EQUAL(sizeof(vec4_t), vecs->component_size);
+
+  for (uint32_t i = 0; i < 200; i++) {
+    vec4_t v = {(float)((i * 37) % 200), (float)i, 0.0f, 1.0f};
+    TEST_ASSERT_NOT_NULL(vec4_sps_add(vecs, i, &v));
+  }
+  TEST_ASSERT_NULL(vec4_sps_add(vecs, 5, &(vec4_t){0}));
+
+  vec4_t *v = vec4_sps_get(vecs, 10);
+  TEST_ASSERT_NOT_NULL(v);
+  TEST_ASSERT_EQUAL_FLOAT(10.0f, v->y);
+  TEST_ASSERT_EQUAL_PTR(sps_get(vecs, 10), v);
+  TEST_ASSERT_TRUE(vec4_sps_has(vecs, 199));
+  TEST_ASSERT_FALSE(vec4_sps_has(vecs, 200));
+  TEST_ASSERT_NULL(vec4_sps_get(vecs, 1u << 30));
+
+  // Typed removal keeps the generic view consistent
+  vec4_sps_remove(vecs, 0);
+  vec4_sps_remove(vecs, 199);
+  TEST_ASSERT_EQUAL(198, sps_count(vecs));
+  TEST_ASSERT_FALSE(sps_has(vecs, 0));
+  TEST_ASSERT_EQUAL_FLOAT(50.0f, ((vec4_t *)sps_get(vecs, 50))->y);
+
+  vec4_sps_sort(vecs, compare_vec4_x, NULL);
+  for (uint32_t i = 0; i < vecs->count; i++) {
+    vec4_t *cur = vec4_sps_get(vecs, vecs->dense[i]);
+    TEST_ASSERT_EQUAL_PTR((vec4_t *)(void *)vecs->components + i, cur);
+    TEST_ASSERT_EQUAL_FLOAT((float)vecs->dense[i], cur->y);
+    if (i > 0) {
+      TEST_ASSERT_TRUE(cur[-1].x <= cur->x);
+    }
+  }
+
+  // Tracked sets go through the generic path
+  sps_sort_incremental(vecs, vec4_sps_compare_, &(vec4_sps_sort_ctx_t){compare_vec4_x, NULL});
+  vec4_sps_remove(vecs, 20);
+  vec4_sps_sort(vecs, compare_vec4_x, NULL);
+  TEST_ASSERT_EQUAL(197, sps_count(vecs));
+  for (uint32_t i = 1; i < vecs->count; i++) {
+    TEST_ASSERT_TRUE(((vec4_t *)vec4_sps_get(vecs, vecs->dense[i - 1]))->x <=
+                     ((vec4_t *)vec4_sps_get(vecs, vecs->dense[i]))->x);
+  }
+
+  sps_free(vecs);
+}
+
+typedef struct {
+  float x, y, z;
+  uint32_t id;
+  uint8_t flags;
+} body_t;
+
+static const sps_field_t body_fields[] = {
+    {offsetof(body_t, x), sizeof(float)},
+    {offsetof(body_t, y), sizeof(float)},
+    {offsetof(body_t, z), sizeof(float)},
+    {offsetof(body_t, id), sizeof(uint32_t)},
+    {offsetof(body_t, flags), sizeof(uint8_t)},
+};
+
+static int compare_body_z(const void *a, const void *b, void *context) {
+  (void)context;
+  float za = ((const body_t *)a)->z;
+  float zb = ((const body_t *)b)->z;
+  return (za > zb) - (za < zb);
+}
+
+static void assert_body_columns(sparse_set_t *bodies) {
+  float *xs = sps_column(bodies, 0);
+  float *zs = sps_column(bodies, 2);
+  uint32_t *ids = sps_column(bodies, 3);
+  for (uint32_t i = 0; i < bodies->count; i++) {
+    uint32_t entity = bodies->dense[i];
+    TEST_ASSERT_EQUAL(entity, ids[i]);
+    TEST_ASSERT_EQUAL_FLOAT((float)entity, xs[i]);
+    TEST_ASSERT_EQUAL_FLOAT((float)((entity * 13) % 50), zs[i]);
+    TEST_ASSERT_EQUAL_PTR(&zs[i], sps_get_field(bodies, entity, 2));
+  }
+}
+
+static void test_sps_soa(void) {
+  sparse_set_t *bodies = sps_new_soa(sizeof(body_t), body_fields, 5);
+  TEST_ASSERT_NOT_NULL(bodies);
+  TEST_ASSERT_EQUAL(5, bodies->column_count);
+  TEST_ASSERT_NULL(sps_new_soa(sizeof(body_t), &(sps_field_t){sizeof(body_t) - 1, 4}, 1));
+
+  for (uint32_t i = 0; i < 300; i++) {
+    body_t b = {(float)i, 1.0f, (float)((i * 13) % 50), i, (uint8_t)i};
+    float *x = sps_add(bodies, i, &b);
+    TEST_ASSERT_EQUAL_PTR((float *)sps_column(bodies, 0) + i, x);
+  }
+  assert_body_columns(bodies);
+
+  // Removal swaps column elements only
+  for (uint32_t i = 0; i < 300; i += 3) {
+    sps_remove(bodies, i);
+  }
+  TEST_ASSERT_EQUAL(200, sps_count(bodies));
+  TEST_ASSERT_NULL(sps_get_field(bodies, 3, 0));
+  assert_body_columns(bodies);
+
+  body_t out;
+  TEST_ASSERT_EQUAL(1, sps_copy_many(bodies, (uint32_t[]){7}, 1, &out));
+  TEST_ASSERT_EQUAL(7, out.id);
+  TEST_ASSERT_EQUAL(7, out.flags);
+  TEST_ASSERT_EQUAL_FLOAT(1.0f, out.y);
+
+  // Both sorts see whole components and keep every column in lockstep
+  sps_sort(bodies, compare_body_z, NULL);
+  assert_body_columns(bodies);
+  float *zs = sps_column(bodies, 2);
+  for (uint32_t i = 1; i < bodies->count; i++) {
+    TEST_ASSERT_TRUE(zs[i - 1] <= zs[i]);
+  }
+
+  sps_sort_by_key(bodies, offsetof(body_t, id), SPS_KEY_U32);
+  assert_body_columns(bodies);
+  for (uint32_t i = 1; i < bodies->count; i++) {
+    TEST_ASSERT_TRUE(bodies->dense[i - 1] < bodies->dense[i]);
+  }
+
+  sps_sort_incremental(bodies, compare_body_z, NULL);
+  sps_add(bodies, 3, &(body_t){3.0f, 1.0f, 39.0f, 3, 3});
+  sps_remove(bodies, 100);
+  sps_sort_incremental(bodies, compare_body_z, NULL);
+  assert_body_columns(bodies);
+  zs = sps_column(bodies, 2);
+  for (uint32_t i = 1; i < bodies->count; i++) {
+    TEST_ASSERT_TRUE(zs[i - 1] <= zs[i]);
+  }
+
+  sparse_set_span_t span = sps_span(bodies);
+  TEST_ASSERT_NULL(span.components);
+  TEST_ASSERT_EQUAL(bodies->count, span.count);
+
+  sps_free(bodies);
+}
+
+static void test_sps_view(void) {
+  sparse_set_t *a = sps_new(sizeof(int));
+  sparse_set_t *b = sps_new(sizeof(int));
+  sparse_set_t *c = sps_new(sizeof(int));
+
+  // a holds every entity, b the even ones and c every third one
+  for (uint32_t i = 0; i < 1000; i++) {
+    sps_add(a, i, &(int){(int)i});
+    if (i % 2 == 0) sps_add(b, i, &(int){(int)i * 2});
+    if (i % 3 == 0) sps_add(c, i, &(int){(int)i * 3});
+  }
+
+  sparse_set_t *sets[] = {a, b, c};
+  sps_view_t view = sps_view_new(sets, 3);
+  TEST_ASSERT_EQUAL_PTR(c, view.sets[view.driver]);
+
+  uint32_t entity;
+  void *components[3];
+  uint32_t seen = 0;
+  while (sps_view_next(&view, &entity, components)) {
+    TEST_ASSERT_EQUAL(0, entity % 6);
+    TEST_ASSERT_EQUAL((int)entity, *(int *)components[0]);
+    TEST_ASSERT_EQUAL((int)entity * 2, *(int *)components[1]);
+    TEST_ASSERT_EQUAL((int)entity * 3, *(int *)components[2]);
+    seen++;
+  }
+  TEST_ASSERT_EQUAL(167, seen);
+
+  // Blocks produce the same entities in the same order
+  view = sps_view_new(sets, 3);
+  sps_view_block_t block;
+  uint32_t next = 0;
+  while (sps_view_next_block(&view, &block)) {
+    TEST_ASSERT_TRUE(block.count > 0 && block.count <= SPS_VIEW_BLOCK);
+    for (size_t i = 0; i < block.count; i++) {
+      TEST_ASSERT_EQUAL(next, block.entities[i]);
+      TEST_ASSERT_EQUAL_PTR(sps_get(a, next), block.components[0][i]);
+      TEST_ASSERT_EQUAL_PTR(sps_get(b, next), block.components[1][i]);
+      TEST_ASSERT_EQUAL_PTR(sps_get(c, next), block.components[2][i]);
+      next += 6;
+    }
+  }
+  TEST_ASSERT_EQUAL(1002, next);
+
+  // An empty member yields nothing
+  sparse_set_t *empty = sps_new(sizeof(int));
+  sparse_set_t *with_empty[] = {a, empty};
+  view = sps_view_new(with_empty, 2);
+  TEST_ASSERT_FALSE(sps_view_next(&view, NULL, components));
+  TEST_ASSERT_FALSE(sps_view_next_block(&view, &block));
+
+  sps_free(empty);
+  sps_free(c);
+  sps_free(b);
+  sps_free(a);
+}
+
+static void assert_group_consistent(sps_group_t *group) {
+  size_t shared = 0;
+  sparse_set_t *first = group->sets[0];
+  for (uint32_t i = 0; i < first->count; i++) {
+    uint32_t entity = first->dense[i];
+    bool everywhere = true;
+    for (uint32_t s = 1; s < group->set_count; s++) {
+      everywhere = everywhere && sps_has(group->sets[s], entity);
+    }
+    TEST_ASSERT_EQUAL(i < group->size, everywhere);
+    shared += everywhere;
+  }
+  TEST_ASSERT_EQUAL(shared, sps_group_size(group));
+
+  // The prefixes line up entity for entity
+  for (uint32_t s = 0; s < group->set_count; s++) {
+    sparse_set_span_t span = sps_group_span(group, s);
+    TEST_ASSERT_EQUAL(group->size, span.count);
+    for (size_t i = 0; i < span.count; i++) {
+      TEST_ASSERT_EQUAL(first->dense[i], span.entities[i]);
+      TEST_ASSERT_EQUAL((int)span.entities[i] + (int)s, ((int *)span.components)[i]);
+    }
+  }
+}
+
+static void test_sps_group(void) {
+  sparse_set_t *sets[3];
+  for (int s = 0; s < 3; s++) {
+    sets[s] = sps_new(sizeof(int));
+  }
+
+  for (uint32_t i = 0; i < 300; i++) {
+    sps_add(sets[0], i, &(int){(int)i});
+    if (i % 2 == 0) sps_add(sets[1], i, &(int){(int)i + 1});
+    if (i % 5 == 0) sps_add(sets[2], i, &(int){(int)i + 2});
+  }
+
+  sps_group_t *group = sps_group_new(sets, 3);
+  TEST_ASSERT_NOT_NULL(group);
+  TEST_ASSERT_NULL(sps_group_new(sets, 1));
+  TEST_ASSERT_EQUAL(30, sps_group_size(group));
+  assert_group_consistent(group);
+
+  // Adds and removes through any member keep the prefix exact
+  srand(7);
+  for (int step = 0; step < 2000; step++) {
+    int s = rand() % 3;
+    uint32_t entity = (uint32_t)(rand() % 400);
+    if (sps_has(sets[s], entity)) {
+      sps_remove(sets[s], entity);
+    } else if (rand() % 2) {
+      sps_add(sets[s], entity, &(int){(int)entity + s});
+    } else {
+      *(int *)sps_emplace(sets[s], entity) = (int)entity + s;
+    }
+  }
+  assert_group_consistent(group);
+
+  uint32_t batch[] = {1000, 1001, 1002};
+  int values[] = {1000, 1001, 1002};
+  for (int s = 0; s < 3; s++) {
+    for (int i = 0; i < 3; i++) values[i] = (int)batch[i] + s;
+    sps_add_many(sets[s], batch, 3, values);
+  }
+  assert_group_consistent(group);
+
+  // Owned sets cannot be reordered
+  sparse_set_t *owned = sets[1];
+  uint32_t before = owned->dense[0];
+  sps_sort_by_key(owned, 0, SPS_KEY_I32);
+  TEST_ASSERT_EQUAL(before, owned->dense[0]);
+
+  sps_group_free(group);
+  TEST_ASSERT_NULL(owned->group);
+  TEST_ASSERT_EQUAL(0, owned->flags & SPS_OWNED);
+
+  for (int s = 0; s < 3; s++) {
+    sps_free(sets[s]);
+  }
+}
+
+typedef struct {
+  size_t live_bytes;
+  size_t calls;
+} counting_arena_t;
+
+static void *counting_alloc(size_t size, size_t align, void *ctx) {
+  counting_arena_t *arena = ctx;
+  TEST_ASSERT_EQUAL(0, align & (align - 1));
+  arena->live_bytes += size;
+  arena->calls++;
+  return malloc(size);
+}
+
+static void counting_release(void *ptr, size_t size, void *ctx) {
+  counting_arena_t *arena = ctx;
+  TEST_ASSERT_TRUE(size <= arena->live_bytes);
+  arena->live_bytes -= size;
+  arena->calls++;
+  free(ptr);
+}
+
+static void test_sps_allocator(void) {
+  counting_arena_t arena = {0};
+  sps_allocator_t allocator = {counting_alloc, NULL, counting_release, &arena};
+  static _Alignas(max_align_t) uint8_t workspace[1 << 14];
+
+  sparse_set_t *keyed = sps_new_desc(&(sps_desc_t){
+      .component_size = sizeof(keyed_t),
+      .initial_capacity = 16,
+      .allocator = &allocator,
+      .workspace = workspace,
+      .workspace_size = sizeof(workspace),
+  });
+  TEST_ASSERT_NOT_NULL(keyed);
+  TEST_ASSERT_TRUE(arena.calls > 0);
+
+  // Growth goes through alloc and release when resize is not provided
+  for (uint32_t i = 0; i < 1000; i++) {
+    sps_add(keyed, i * 7919u % 100003u, &(keyed_t){(int)(i % 10), (int)i});
+  }
+
+  // Sorts that fit the attached workspace make no allocator calls
+  size_t calls = arena.calls;
+  sps_sort(keyed, compare_keyed, NULL);
+  sps_sort_by_key(keyed, offsetof(keyed_t, key), SPS_KEY_I32);
+  TEST_ASSERT_EQUAL(calls, arena.calls);
+  TEST_ASSERT_EQUAL_PTR(workspace, keyed->scratch);
+
+  // A larger sort falls back to the allocator instead of failing
+  sps_attach_workspace(keyed, workspace, 64);
+  sps_sort(keyed, compare_keyed, NULL);
+  TEST_ASSERT_TRUE(arena.calls > calls);
+  TEST_ASSERT_FALSE(keyed->scratch_borrowed);
+  for (uint32_t i = 1; i < keyed->count; i++) {
+    TEST_ASSERT_TRUE(((keyed_t *)sps_get(keyed, keyed->dense[i - 1]))->key <=
+                     ((keyed_t *)sps_get(keyed, keyed->dense[i]))->key);
+  }
+
+  sps_free(keyed);
+  TEST_ASSERT_EQUAL(0, arena.live_bytes);
+}
+
+static void test_sps_commands(void) {
+  sparse_set_t *deferred = sps_new(sizeof(int));
+  sparse_set_t *direct = sps_new(sizeof(int));
+  sps_commands_t *commands = sps_commands_new(deferred, 256);
+  TEST_ASSERT_NOT_NULL(commands);
+
+  // Removing while iterating is safe once the removal is deferred
+  for (uint32_t i = 0; i < 100; i++) {
+    sps_add(deferred, i, &(int){(int)i});
+  }
+  sparse_set_iter_t iter = sps_iter_new(deferred);
+  uint32_t entity;
+  int *value;
+  while ((value = sps_iter_next(&iter, &entity)) != NULL) {
+    if (*value % 2) TEST_ASSERT_TRUE(sps_defer_remove(commands, entity));
+  }
+  TEST_ASSERT_EQUAL(100, sps_count(deferred));
+  TEST_ASSERT_EQUAL(50, sps_flush(commands));
+  TEST_ASSERT_EQUAL(50, sps_count(deferred));
+  TEST_ASSERT_FALSE(sps_has(deferred, 7));
+
+  // An add cancelled by a later remove never reaches the set
+  sps_defer_add(commands, 500, &(int){1});
+  sps_defer_remove(commands, 500);
+  sps_flush(commands);
+  TEST_ASSERT_FALSE(sps_has(deferred, 500));
+
+  // A remove followed by an add of a present entity replaces it in place
+  sps_add(deferred, 600, &(int){1});
+  sps_add(deferred, 601, &(int){2});
+  uint32_t position = (uint32_t)(sps_count(deferred) - 2);
+  sps_defer_remove(commands, 600);
+  sps_defer_add(commands, 600, &(int){3});
+  sps_flush(commands);
+  TEST_ASSERT_EQUAL(600, deferred->dense[position]);
+  TEST_ASSERT_EQUAL(3, *(int *)sps_get(deferred, 600));
+  sps_remove(deferred, 600);
+  sps_remove(deferred, 601);
+
+  // Folded commands match applying them one at a time
+  for (uint32_t i = 0; i < 100; i += 2) {
+    sps_add(direct, i, &(int){(int)i});
+  }
+  srand(99);
+  for (int round = 0; round < 20; round++) {
+    for (int c = 0; c < 200; c++) {
+      uint32_t index = (uint32_t)(rand() % 120);
+      int v = rand();
+      switch (rand() % 3) {
+        case 0:
+          sps_defer_add(commands, index, &v);
+          sps_add(direct, index, &v);
+          break;
+        case 1:
+          sps_defer_add_or_replace(commands, index, &v);
+          sps_add_or_replace(direct, index, &v);
+          break;
+        default:
+          sps_defer_remove(commands, index);
+          if (sps_has(direct, index)) sps_remove(direct, index);
+          break;
+      }
+    }
+    TEST_ASSERT_EQUAL(200, sps_flush(commands));
+
+    TEST_ASSERT_EQUAL(sps_count(direct), sps_count(deferred));
+    for (uint32_t i = 0; i < direct->count; i++) {
+      int *expected = sps_get(direct, direct->dense[i]);
+      int *actual = sps_get(deferred, direct->dense[i]);
+      TEST_ASSERT_NOT_NULL(actual);
+      TEST_ASSERT_EQUAL(*expected, *actual);
+    }
+  }
+
+  // Recording past the capacity fails without losing earlier commands
+  for (uint32_t i = 0; i < 256; i++) {
+    TEST_ASSERT_TRUE(sps_defer_add_or_replace(commands, 1000 + i, &(int){0}));
+  }
+  TEST_ASSERT_FALSE(sps_defer_remove(commands, 1000));
+  TEST_ASSERT_EQUAL(256, sps_flush(commands));
+  TEST_ASSERT_TRUE(sps_has(deferred, 1255));
+
+  sps_commands_free(commands);
+  sps_free(direct);
+  sps_free(deferred);
+}
+
+static void test_sps_partition(void) {
+  for (uint32_t i = 0; i < 1000; i++) {
+    sps_add(set, i * 3, &(int){(int)i});
+  }
+
+  sparse_set_span_t ranges[7];
+  size_t produced = sps_partition(set, 7, ranges);
+  TEST_ASSERT_EQUAL(7, produced);
+  TEST_ASSERT_EQUAL(1, set->partitioned);
+
+  // Ranges tile the set in order, on whole cache lines of int components
+  size_t next = 0;
+  for (size_t r = 0; r < produced; r++) {
+    TEST_ASSERT_EQUAL(next, ranges[r].begin);
+    TEST_ASSERT_EQUAL(0, ranges[r].begin % 16);
+    TEST_ASSERT_EQUAL_PTR(set->dense + ranges[r].begin, ranges[r].entities);
+    int *comps = ranges[r].components;
+    for (size_t i = 0; i < ranges[r].count; i++) {
+      comps[i] += 1;
+    }
+    next += ranges[r].count;
+  }
+  TEST_ASSERT_EQUAL(1000, next);
+  sps_partition_end(set);
+  TEST_ASSERT_EQUAL(0, set->partitioned);
+  TEST_ASSERT_EQUAL(11, *(int *)sps_get(set, 30));
+
+  // More workers than elements leaves the extra ranges unused
+  sparse_set_t *small = sps_new(sizeof(int));
+  sps_add(small, 1, &(int){1});
+  sps_add(small, 2, &(int){2});
+  sparse_set_span_t window = sps_range(small, 1, 10);
+  TEST_ASSERT_EQUAL(1, window.count);
+  TEST_ASSERT_EQUAL(2, *(int *)window.components);
+  TEST_ASSERT_EQUAL(2, sps_partition(small, 4, ranges));
+  TEST_ASSERT_EQUAL(1, ranges[1].count);
+  sps_partition_end(small);
+  sps_free(small);
+}
+
+static void test_sps_shared(void) {
+  sps_shared_t *shared = sps_shared_new(&(sps_desc_t){.component_size = sizeof(int)}, 8);
+  TEST_ASSERT_NOT_NULL(shared);
+
+  for (uint32_t i = 0; i < 5; i++) {
+    TEST_ASSERT_TRUE(sps_shared_add(shared, i, &(int){(int)i * 10}));
+  }
+  TEST_ASSERT_FALSE(sps_shared_add(shared, 2, &(int){0}));
+
+  // Readers only see published changes
+  uint32_t token;
+  sparse_set_t *view = sps_read_begin(shared, &token);
+  TEST_ASSERT_EQUAL(0, sps_count(view));
+  sps_read_end(shared, token);
+
+  sps_shared_publish(shared);
+  view = sps_read_begin(shared, &token);
+  TEST_ASSERT_EQUAL(5, sps_count(view));
+  TEST_ASSERT_EQUAL(30, *(int *)sps_get(view, 3));
+  sps_read_end(shared, token);
+
+  // The retired instance is brought up to date by replaying the log
+  TEST_ASSERT_TRUE(sps_shared_remove(shared, 1));
+  TEST_ASSERT_FALSE(sps_shared_remove(shared, 1));
+  TEST_ASSERT_TRUE(sps_shared_add_or_replace(shared, 3, &(int){33}));
+  sps_shared_publish(shared);
+  view = sps_read_begin(shared, &token);
+  TEST_ASSERT_EQUAL(4, sps_count(view));
+  TEST_ASSERT_EQUAL(33, *(int *)sps_get(view, 3));
+  sps_read_end(shared, token);
+
+  // A full log is published on its own
+  for (uint32_t i = 100; i < 120; i++) {
+    TEST_ASSERT_TRUE(sps_shared_add(shared, i, &(int){(int)i}));
+  }
+  view = sps_read_begin(shared, &token);
+  TEST_ASSERT_TRUE(sps_count(view) > 4);
+  sps_read_end(shared, token);
+
+  sps_shared_publish(shared);
+  view = sps_read_begin(shared, &token);
+  TEST_ASSERT_EQUAL(24, sps_count(view));
+  sps_read_end(shared, token);
+
+  sps_shared_free(shared);
+}
+
+#define SHARED_READERS 4
+#define SHARED_READS 16384
+
+typedef struct {
+  sps_shared_t *shared;
+  uint32_t hits;
+} shared_reader_t;
+
+static void *shared_reader_main(void *arg) {
+  shared_reader_t *reader = arg;
+  uint32_t token;
+  sparse_set_t *view = sps_read_begin(reader->shared, &token);
+  uint64_t bits[1];
+  for (uint32_t i = 0; i < SHARED_READS; i++) {
+    // Entities 0 to 31 are present, entity 40 is not
+    reader->hits += sps_get(view, i % 64) != NULL;
+    reader->hits += (uint32_t)sps_has_many(view, (uint32_t[]){i % 64, 40}, 2, bits);
+  }
+  sps_read_end(reader->shared, token);
+  return NULL;
+}
+
+static void test_sps_shared_readers(void) {
+  sps_shared_t *shared = sps_shared_new(&(sps_desc_t){.component_size = sizeof(int)}, 8);
+  for (uint32_t i = 0; i < 32; i++) {
+    TEST_ASSERT_TRUE(sps_shared_add(shared, i, &(int){(int)i}));
+  }
+  sps_shared_publish(shared);
+
+  uint32_t token;
+  sparse_set_t *view = sps_read_begin(shared, &token);
+  sps_stats_reset(view);
+  sps_read_end(shared, token);
+
+  // Readers count their lookups into the instance they share
+  shared_reader_t readers[SHARED_READERS];
+  for (size_t r = 0; r < SHARED_READERS; r++) {
+    readers[r] = (shared_reader_t){.shared = shared};
+  }
+#if defined(TEST_HAVE_THREADS)
+  pthread_t threads[SHARED_READERS];
+  for (size_t r = 0; r < SHARED_READERS; r++) {
+    TEST_ASSERT_EQUAL(0, pthread_create(&threads[r], NULL, shared_reader_main, &readers[r]));
+  }
+  for (size_t r = 0; r < SHARED_READERS; r++) {
+    pthread_join(threads[r], NULL);
+  }
+#else
+  for (size_t r = 0; r < SHARED_READERS; r++) {
+    shared_reader_main(&readers[r]);
+  }
+#endif
+  for (size_t r = 0; r < SHARED_READERS; r++) {
+    TEST_ASSERT_EQUAL(SHARED_READS, readers[r].hits);
+  }
+
+  sps_stats_t stats;
+  view = sps_read_begin(shared, &token);
+  if (sps_stats(view, &stats)) {
+    TEST_ASSERT_EQUAL_UINT64(SHARED_READERS * SHARED_READS * 3, stats.gets);
+    TEST_ASSERT_EQUAL_UINT64(SHARED_READERS * SHARED_READS * 2, stats.misses);
+  }
+  sps_read_end(shared, token);
+  sps_shared_free(shared);
+}
+
+static void test_sps_changes(void) {
+  for (uint32_t i = 0; i < 10; i++) {
+    sps_add(set, i, &(int){(int)i});
+  }
+  TEST_ASSERT_TRUE(sps_track_changes(set, true));
+
+  // Nothing is recorded for components present when tracking started
+  sps_change_iter_t iter = sps_changes_iter(set);
+  TEST_ASSERT_NULL(sps_changes_next(&iter, NULL, NULL));
+
+  sps_add_or_replace(set, 3, &(int){33});
+  *(int *)sps_get(set, 4) = 44;
+  sps_mark_dirty(set, 4);
+  sps_mark_dirty(set, 3);
+  sps_add(set, 20, &(int){20});
+  sps_remove(set, 0);
+  sps_sort(set, compare_ints, NULL);
+
+  // Each changed entity is reported once, with its bits following the sort
+  uint32_t index;
+  uint32_t kind;
+  int *value;
+  uint32_t seen = 0;
+  iter = sps_changes_iter(set);
+  while ((value = sps_changes_next(&iter, &index, &kind)) != NULL) {
+    TEST_ASSERT_EQUAL_PTR(sps_get(set, index), value);
+    if (index == 20) {
+      TEST_ASSERT_EQUAL(SPS_CHANGE_ADDED, kind);
+    } else {
+      TEST_ASSERT_TRUE(index == 3 || index == 4);
+      TEST_ASSERT_EQUAL(SPS_CHANGE_MODIFIED, kind);
+    }
+    seen++;
+  }
+  TEST_ASSERT_EQUAL(3, seen);
+
+  const uint32_t *removed;
+  TEST_ASSERT_EQUAL(1, sps_changes_removed(set, &removed));
+  TEST_ASSERT_EQUAL(0, removed[0]);
+
+  // Added and removed again within a frame leaves no trace, added twice is reported once
+  sps_add(set, 30, &(int){30});
+  sps_remove(set, 30);
+  sps_remove(set, 20);
+  sps_add(set, 20, &(int){21});
+  sps_mark_dirty(set, 20);
+  TEST_ASSERT_EQUAL(1, sps_changes_removed(set, &removed));
+
+  seen = 0;
+  iter = sps_changes_iter(set);
+  while (sps_changes_next(&iter, &index, &kind) != NULL) {
+    if (index == 20) {
+      TEST_ASSERT_EQUAL(SPS_CHANGE_ADDED | SPS_CHANGE_MODIFIED, kind);
+    }
+    seen++;
+  }
+  TEST_ASSERT_EQUAL(3, seen);
+  TEST_ASSERT_EQUAL(3, set->changed_count);
+
+  sps_changes_clear(set);
+  iter = sps_changes_iter(set);
+  TEST_ASSERT_NULL(sps_changes_next(&iter, NULL, NULL));
+  TEST_ASSERT_EQUAL(0, sps_changes_removed(set, &removed));
+
+  // Entities present at the clear are reported as removed
+  sps_remove(set, 20);
+  TEST_ASSERT_EQUAL(1, sps_changes_removed(set, &removed));
+  TEST_ASSERT_EQUAL(20, removed[0]);
+
+  TEST_ASSERT_TRUE(sps_track_changes(set, false));
+  sps_add(set, 40, &(int){40});
+  iter = sps_changes_iter(set);
+  TEST_ASSERT_NULL(sps_changes_next(&iter, NULL, NULL));
+  TEST_ASSERT_EQUAL(0, sps_changes_removed(set, &removed));
+}
+
+static void test_sps_serialize(void) {
+  for (uint32_t i = 0; i < 5000; i++) {
+    sps_add_handle(set, sps_handle_make(i * 7, i % 3), &(int){(int)i});
+  }
+  for (uint32_t i = 0; i < 5000; i += 4) {
+    sps_remove(set, i * 7);
+  }
+
+  size_t size = sps_serialized_size(set);
+  uint8_t *buffer = malloc(size);
+  TEST_ASSERT_EQUAL(0, sps_serialize(set, buffer, size - 1));
+  TEST_ASSERT_EQUAL(size, sps_serialize(set, buffer, size));
+
+  // Dense order, components and generations all survive
+  sparse_set_t *copy = sps_deserialize(buffer, size, NULL);
+  TEST_ASSERT_NOT_NULL(copy);
+  TEST_ASSERT_EQUAL(sps_count(set), sps_count(copy));
+  TEST_ASSERT_EQUAL_UINT32_ARRAY(set->dense, copy->dense, set->count);
+  TEST_ASSERT_EQUAL_INT_ARRAY((int *)set->components, (int *)copy->components, set->count);
+  TEST_ASSERT_EQUAL(sps_handle(set, 35), sps_handle(copy, 35));
+  TEST_ASSERT_NOT_NULL(sps_add(copy, 1, &(int){1}));
+  sps_free(copy);
+
+  // Truncated or corrupted data is rejected
+  TEST_ASSERT_NULL(sps_deserialize(buffer, size - 1, NULL));
+  buffer[0] ^= 1;
+  TEST_ASSERT_NULL(sps_deserialize(buffer, size, NULL));
+  buffer[0] ^= 1;
+
+  FILE *file = fopen("test_sps_map.bin", "wb");
+  TEST_ASSERT_NOT_NULL(file);
+  TEST_ASSERT_EQUAL(size, fwrite(buffer, 1, size, file));
+  fclose(file);
+  free(buffer);
+
+  // A mapped set reads straight from the file and refuses changes
+  sparse_set_t *mapped = sps_map_file("test_sps_map.bin", NULL);
+  TEST_ASSERT_NOT_NULL(mapped);
+  TEST_ASSERT_TRUE(mapped->flags & SPS_READ_ONLY);
+  TEST_ASSERT_EQUAL(sps_count(set), sps_count(mapped));
+  TEST_ASSERT_EQUAL(0, (uintptr_t)mapped->components % SPS_FORMAT_ALIGN);
+  TEST_ASSERT_EQUAL(*(int *)sps_get(set, 42), *(int *)sps_get(mapped, 42));
+  TEST_ASSERT_NULL(sps_add(mapped, 1, &(int){1}));
+  TEST_ASSERT_NULL(sps_add_or_replace(mapped, 42, &(int){1}));
+  TEST_ASSERT_EQUAL(0, sps_remove_many(mapped, (uint32_t[]){42}, 1));
+  TEST_ASSERT_FALSE(sps_reserve(mapped, 100000));
+  TEST_ASSERT_TRUE(sps_has(mapped, 42));
+  sps_free(mapped);
+  remove("test_sps_map.bin");
+
+  // Columns of a SoA set are stored one after another
+  sparse_set_t *bodies = sps_new_soa(sizeof(body_t), body_fields, 5);
+  for (uint32_t i = 0; i < 100; i++) {
+    sps_add(bodies, i, &(body_t){(float)i, 1.0f, (float)((i * 13) % 50), i, (uint8_t)i});
+  }
+  buffer = malloc(sps_serialized_size(bodies));
+  size = sps_serialize(bodies, buffer, sps_serialized_size(bodies));
+  sparse_set_t *bodies_copy = sps_deserialize(buffer, size, NULL);
+  TEST_ASSERT_NOT_NULL(bodies_copy);
+  TEST_ASSERT_EQUAL(5, bodies_copy->column_count);
+  assert_body_columns(bodies_copy);
+  sps_free(bodies_copy);
+  sps_free(bodies);
+  free(buffer);
+}
+
+static void test_sps_snapshot(void) {
+  for (uint32_t i = 0; i < 1000; i++) {
+    sps_add_handle(set, sps_handle_make(i * 5, 1), &(int){(int)i});
+  }
+
+  size_t size = sps_snapshot_size(set);
+  TEST_ASSERT_TRUE(size < 1000 * 3 * sizeof(uint32_t) + 64);
+  uint8_t *frame0 = malloc(size);
+  TEST_ASSERT_EQUAL(0, sps_snapshot(set, frame0, size - 1));
+  TEST_ASSERT_EQUAL(size, sps_snapshot(set, frame0, size));
+
+  // One tick changes a handful of entities
+  *(int *)sps_get(set, 50) = -1;
+  sps_remove(set, 100);
+  sps_add(set, 7, &(int){7});
+  size_t size1 = sps_snapshot_size(set);
+  uint8_t *frame1 = malloc(size1);
+  TEST_ASSERT_EQUAL(size1, sps_snapshot(set, frame1, size1));
+
+  // The delta only pays for what differs
+  uint8_t *delta = malloc(sps_delta_bound(size1));
+  size_t delta_size = sps_delta_encode(frame0, size, frame1, size1, delta, sps_delta_bound(size1));
+  TEST_ASSERT_TRUE(delta_size > 0);
+  TEST_ASSERT_TRUE(delta_size < size1 / 10);
+
+  uint8_t *decoded = malloc(size1);
+  TEST_ASSERT_EQUAL(size1, sps_delta_decode(frame0, size, delta, delta_size, decoded, size1));
+  TEST_ASSERT_EQUAL_MEMORY(frame1, decoded, size1);
+  TEST_ASSERT_EQUAL(0, sps_delta_decode(frame0, size, delta, delta_size - 1, decoded, size1));
+
+  // Rolling back restores contents, order and generations
+  TEST_ASSERT_TRUE(sps_restore(set, frame0, size));
+  TEST_ASSERT_EQUAL(1000, sps_count(set));
+  TEST_ASSERT_FALSE(sps_has(set, 7));
+  TEST_ASSERT_EQUAL(10, *(int *)sps_get(set, 50));
+  TEST_ASSERT_EQUAL(20, *(int *)sps_get(set, 100));
+  TEST_ASSERT_EQUAL(sps_handle_make(100, 1), sps_handle(set, 100));
+  for (uint32_t i = 0; i < 1000; i++) {
+    TEST_ASSERT_EQUAL(i * 5, set->dense[i]);
+  }
+
+  // And forward again from the decoded frame
+  TEST_ASSERT_TRUE(sps_restore(set, decoded, size1));
+  TEST_ASSERT_TRUE(sps_has(set, 7));
+  TEST_ASSERT_FALSE(sps_has(set, 100));
+  TEST_ASSERT_EQUAL(-1, *(int *)sps_get(set, 50));
+
+  // Snapshots of another layout are refused
+  sparse_set_t *wide = sps_new(sizeof(double));
+  TEST_ASSERT_FALSE(sps_restore(wide, frame0, size));
+  TEST_ASSERT_EQUAL(0, sps_count(wide));
+  sps_free(wide);
+
+  free(frame0);
+  free(frame1);
+  free(delta);
+  free(decoded);
+}
+
+static void test_sps_stats(void) {
+  sps_stats_t stats;
+#ifndef SPS_ENABLE_STATS
+  sps_add(set, 1, &(int){1});
+  TEST_ASSERT_FALSE(sps_stats(set, &stats));
+  TEST_ASSERT_EQUAL_UINT64(0, stats.adds);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.peak_count);
+#else
+  for (int i = 0; i < 10; i++) {
+    sps_add(set, (uint32_t)i, &(int){10 - i});
+  }
+  sps_add_many(set, (uint32_t[]){20, 21}, 2, (int[]){0, 0});
+  sps_remove(set, 3);
+  sps_remove(set, 4);
+  TEST_ASSERT_NOT_NULL(sps_get(set, 5));
+  TEST_ASSERT_NULL(sps_get(set, 4));
+  TEST_ASSERT_FALSE(sps_has(set, 3));
+
+  void *out[3];
+  TEST_ASSERT_EQUAL(2, sps_get_many(set, (uint32_t[]){0, 1, 99}, 3, out));
+
+  compare_calls = 0;
+  sps_sort(set, compare_counted, NULL);
+
+  TEST_ASSERT_TRUE(sps_stats(set, &stats));
+  TEST_ASSERT_EQUAL_UINT64(12, stats.adds);
+  TEST_ASSERT_EQUAL_UINT64(2, stats.removes);
+  TEST_ASSERT_EQUAL_UINT64(6, stats.gets);
+  TEST_ASSERT_EQUAL_UINT64(3, stats.misses);
+  TEST_ASSERT_EQUAL_UINT32(12, stats.peak_count);
+  TEST_ASSERT_EQUAL_UINT64(1, stats.sorts);
+  TEST_ASSERT_EQUAL_UINT64((uint64_t)compare_calls, stats.comparisons);
+  TEST_ASSERT_TRUE(stats.bytes_moved >= 2 * sizeof(int));
+
+  sps_stats_reset(set);
+  TEST_ASSERT_TRUE(sps_stats(set, &stats));
+  TEST_ASSERT_EQUAL_UINT64(0, stats.adds);
+  TEST_ASSERT_EQUAL_UINT32(10, stats.peak_count);
+#endif
+}
+
+typedef struct mat4 {
+  _Alignas(64) float m[16];
+} mat4_t;
+
+static void test_sps_aligned(void) {
+  TEST_ASSERT_NULL(sps_new_aligned(sizeof(mat4_t), 48));
+  TEST_ASSERT_NULL(sps_new_aligned(24, 16));
+  TEST_ASSERT_NULL(sps_new_aligned(sizeof(mat4_t), 2 * SPS_ALIGN_MAX));
+
+  sparse_set_t *mats = sps_new_aligned(sizeof(mat4_t), 64);
+  TEST_ASSERT_NOT_NULL(mats);
+
+  // The set itself starts on a cache line, its lookup fields are on that line
+  TEST_ASSERT_EQUAL(0, (uintptr_t)set % 64);
+  TEST_ASSERT_EQUAL(0, (uintptr_t)mats % 64);
+
+  // Every component stays aligned while the storage grows
+  for (uint32_t i = 0; i < 1000; i++) {
+    mat4_t m = {{(float)i}};
+    mat4_t *stored = sps_add(mats, i * 3, &m);
+    TEST_ASSERT_NOT_NULL(stored);
+    TEST_ASSERT_EQUAL(0, (uintptr_t)stored % 64);
+  }
+  TEST_ASSERT_EQUAL(0, (uintptr_t)mats->components % 64);
+
+  sparse_set_iter_t iter = sps_iter_new(mats);
+  sparse_set_span_t span;
+  while (sps_iter_next_span(&iter, 100, &span)) {
+    TEST_ASSERT_EQUAL(0, (uintptr_t)span.components % 64);
+  }
+
+  sps_remove(mats, 0);
+  TEST_ASSERT_EQUAL_FLOAT(999.0f, ((mat4_t *)mats->components)[0].m[0]);
+  TEST_ASSERT_EQUAL_FLOAT(1.0f, ((mat4_t *)sps_get(mats, 3))->m[0]);
+  sps_free(mats);
+
+  // Columns of a SoA set start aligned even when the fields are narrower
+  sparse_set_t *bodies = sps_new_desc(&(sps_desc_t){
+      .component_size = sizeof(body_t),
+      .initial_capacity = 3,
+      .fields = body_fields,
+      .field_count = sizeof(body_fields) / sizeof(body_fields[0]),
+      .alignment = 32,
+  });
+  TEST_ASSERT_NOT_NULL(bodies);
+  for (uint32_t i = 0; i < 100; i++) {
+    sps_add(bodies, i, &(body_t){0});
+  }
+  for (size_t f = 0; f < bodies->column_count; f++) {
+    TEST_ASSERT_EQUAL(0, (uintptr_t)sps_column(bodies, f) % 32);
+  }
+  sps_free(bodies);
+}
+
+static void test_sps_advise(void) {
+  TEST_ASSERT_FALSE(sps_advise(NULL, SPS_ADVICE_SEQUENTIAL));
+  TEST_ASSERT_FALSE(sps_advise(set, (sps_advice_t)42));
+  TEST_ASSERT_EQUAL(SPS_ADVICE_NORMAL, set->advice);
+
+#if defined(__unix__) || defined(__APPLE__)
+  TEST_ASSERT_TRUE(sps_reserve(set, 1 << 16));
+  TEST_ASSERT_TRUE(sps_advise(set, SPS_ADVICE_SEQUENTIAL));
+  TEST_ASSERT_EQUAL(SPS_ADVICE_SEQUENTIAL, set->advice);
+
+  // The hint follows the storage when it grows
+  for (uint32_t i = 0; i < (1 << 17); i++) {
+    sps_add(set, i, &(int){(int)i});
+  }
+  TEST_ASSERT_EQUAL(SPS_ADVICE_SEQUENTIAL, set->advice);
+  TEST_ASSERT_EQUAL(77, *(int *)sps_get(set, 77));
+  TEST_ASSERT_TRUE(sps_advise(set, SPS_ADVICE_NORMAL));
+#endif
+}
+
+static void test_sps_has_many(void) {
+  sparse_set_t *other = sps_new(sizeof(int));
+  srand(11);
+  for (uint32_t i = 0; i < 3000; i++) {
+    uint32_t index = (uint32_t)rand() % 20000u;
+    if (!sps_has(set, index)) sps_add(set, index, &(int){0});
+    if (i % 2 == 0 && !sps_has(other, index * 3)) sps_add(other, index * 3, &(int){0});
+  }
+
+  // Indices past the page directory and ragged batch sizes take every lane path
+  uint32_t ids[203];
+  for (size_t i = 0; i < 203; i++) ids[i] = (uint32_t)rand() % 100000u;
+  ids[5] = SPARSE_SET_MAX;
+  ids[6] = set->dense[0];
+
+  for (size_t n = 0; n <= 203; n += 29) {
+    uint64_t bits[4];
+    memset(bits, 0xFF, sizeof(bits));
+    size_t expected = 0;
+    size_t found = sps_has_many(set, ids, n, bits);
+    for (size_t i = 0; i < n; i++) {
+      bool present = sps_has(set, ids[i]);
+      expected += present;
+      TEST_ASSERT_EQUAL(present, (bits[i / 64] >> (i % 64)) & 1);
+    }
+    if (n % 64 != 0) TEST_ASSERT_EQUAL_UINT64(0, bits[n / 64] >> (n % 64));
+    TEST_ASSERT_EQUAL(expected, found);
+  }
+
+  // Intersect through the bitmaps and compare with per-entity lookups
+  size_t words = sps_bitmap_words(other);
+  TEST_ASSERT_TRUE(words * 64 > 60000);
+  uint64_t *a = calloc(words, sizeof(uint64_t));
+  uint64_t *b = calloc(words, sizeof(uint64_t));
+  TEST_ASSERT_EQUAL(sps_count(set), sps_bitmap_export(set, a, words));
+  TEST_ASSERT_EQUAL(sps_count(other), sps_bitmap_export(other, b, words));
+
+  size_t both = sps_bitmap_and(a, b, words);
+  uint32_t *common = malloc((both + 1) * sizeof(uint32_t));
+  TEST_ASSERT_EQUAL(both, sps_bitmap_indices(a, words, common));
+
+  size_t expected = 0;
+  for (uint32_t i = 0; i < other->count; i++) {
+    expected += sps_has(set, other->dense[i]);
+  }
+  TEST_ASSERT_EQUAL(expected, both);
+  for (size_t i = 0; i < both; i++) {
+    TEST_ASSERT_TRUE(sps_has(set, common[i]) && sps_has(other, common[i]));
+    if (i > 0) TEST_ASSERT_TRUE(common[i - 1] < common[i]);
+  }
+
+  // Entities past the bitmap are left out
+  TEST_ASSERT_TRUE(sps_bitmap_export(set, a, 2) < sps_count(set));
+
+  free(a);
+  free(b);
+  free(common);
+  sps_free(other);
+}
+
+static void test_sps_clear(void) {
+  for (uint32_t i = 0; i < 100; i++) {
+    sps_add(set, i * 1000, &(int){(int)i});
+  }
+  size_t usage = sps_memory_usage(set);
+
+  sps_clear(set);
+  TEST_ASSERT_EQUAL(0, sps_count(set));
+  TEST_ASSERT_FALSE(sps_has(set, 0));
+  TEST_ASSERT_FALSE(sps_has(set, 99000));
+  TEST_ASSERT_EQUAL(usage, sps_memory_usage(set));
+
+  // The storage is reused and handles start over
+  sps_add(set, 5000, &(int){7});
+  TEST_ASSERT_EQUAL(7, *(int *)sps_get(set, 5000));
+  TEST_ASSERT_EQUAL(0, sps_handle_generation(sps_handle(set, 5000)));
+  TEST_ASSERT_EQUAL(usage, sps_memory_usage(set));
+  sps_clear(set);
+  sps_clear(set);
+
+  // Only entities seen at the last clear are reported as removed
+  sparse_set_t *tracked = sps_new(sizeof(int));
+  TEST_ASSERT_TRUE(sps_track_changes(tracked, true));
+  sps_add(tracked, 1, &(int){1});
+  sps_add(tracked, 2, &(int){2});
+  sps_changes_clear(tracked);
+  sps_add(tracked, 3, &(int){3});
+  sps_mark_dirty(tracked, 2);
+  sps_clear(tracked);
+
+  const uint32_t *removed = NULL;
+  TEST_ASSERT_EQUAL(2, sps_changes_removed(tracked, &removed));
+  TEST_ASSERT_TRUE((removed[0] == 1 && removed[1] == 2) || (removed[0] == 2 && removed[1] == 1));
+  sps_change_iter_t changes = sps_changes_iter(tracked);
+  TEST_ASSERT_NULL(sps_changes_next(&changes, NULL, NULL));
+  sps_free(tracked);
+
+  // Clearing a group member empties the group
+  sparse_set_t *a = sps_new(sizeof(int));
+  sparse_set_t *b = sps_new(sizeof(int));
+  sparse_set_t *members[] = {a, b};
+  sps_group_t *group = sps_group_new(members, 2);
+  for (uint32_t i = 0; i < 10; i++) {
+    sps_add(a, i, &(int){0});
+    sps_add(b, i, &(int){0});
+  }
+  TEST_ASSERT_EQUAL(10, sps_group_size(group));
+  sps_clear(a);
+  TEST_ASSERT_EQUAL(0, sps_group_size(group));
+  sps_add(a, 4, &(int){0});
+  TEST_ASSERT_EQUAL(1, sps_group_size(group));
+  TEST_ASSERT_EQUAL(4, b->dense[0]);
+  sps_group_free(group);
+  sps_free(a);
+  sps_free(b);
+}
+
+static void test_sps_stable_remove(void) {
+  TEST_ASSERT_TRUE(sps_stable_remove(set, true));
+  for (uint32_t i = 0; i < 8; i++) {
+    sps_add(set, i, &(int){(int)i * 10});
+  }
+
+  // Removals leave the rest of the order untouched
+  sps_remove(set, 1);
+  sps_remove(set, 4);
+  sps_remove(set, 5);
+  TEST_ASSERT_EQUAL(5, sps_count(set));
+  TEST_ASSERT_EQUAL(8, set->count);
+  TEST_ASSERT_EQUAL(3, set->tombstones);
+  TEST_ASSERT_FALSE(sps_has(set, 4));
+  TEST_ASSERT_EQUAL(60, *(int *)sps_get(set, 6));
+
+  uint32_t expected[] = {0, 2, 3, 6, 7};
+  uint32_t index = 0;
+  size_t seen = 0;
+  sparse_set_iter_t iter = sps_iter_new(set);
+  while (sps_iter_next(&iter, &index) != NULL) {
+    TEST_ASSERT_EQUAL(expected[seen++], index);
+  }
+  TEST_ASSERT_EQUAL(5, seen);
+
+  // Spans stop at tombstones and never contain one
+  sparse_set_span_t span;
+  iter = sps_iter_new(set);
+  TEST_ASSERT_TRUE(sps_iter_next_span(&iter, 0, &span));
+  TEST_ASSERT_EQUAL(1, span.count);
+  TEST_ASSERT_TRUE(sps_iter_next_span(&iter, 0, &span));
+  TEST_ASSERT_EQUAL(2, span.begin);
+  TEST_ASSERT_EQUAL(2, span.count);
+  TEST_ASSERT_TRUE(sps_iter_next_span(&iter, 0, &span));
+  TEST_ASSERT_EQUAL(6, span.begin);
+  TEST_ASSERT_EQUAL(2, span.count);
+  TEST_ASSERT_FALSE(sps_iter_next_span(&iter, 0, &span));
+
+  // Tombstones at the end go at once
+  sps_remove(set, 7);
+  TEST_ASSERT_EQUAL(7, set->count);
+
+  sps_compact(set);
+  TEST_ASSERT_EQUAL(4, set->count);
+  TEST_ASSERT_EQUAL(0, set->tombstones);
+  for (uint32_t i = 0; i < 4; i++) {
+    TEST_ASSERT_EQUAL(expected[i], set->dense[i]);
+    TEST_ASSERT_EQUAL((int)expected[i] * 10, *(int *)sps_get(set, expected[i]));
+  }
+
+  // A sort compacts first
+  sps_remove(set, 2);
+  sps_add(set, 1, &(int){10});
+  sps_sort(set, compare_ints, NULL);
+  TEST_ASSERT_EQUAL(4, set->count);
+  TEST_ASSERT_EQUAL(0, set->tombstones);
+  TEST_ASSERT_EQUAL(1, set->dense[1]);
+
+  // Adding to a full set reclaims tombstones instead of growing
+  size_t capacity = sps_capacity(set);
+  for (uint32_t i = 100; set->count < capacity; i++) {
+    sps_add(set, i, &(int){0});
+  }
+  sps_remove(set, 0);
+  sps_add(set, 50, &(int){5});
+  TEST_ASSERT_EQUAL(capacity, sps_capacity(set));
+  TEST_ASSERT_EQUAL(1, set->dense[0]);
+
+  // A batch into a set at its maximum fits once the tombstones are gone
+  sparse_set_t *bounded = sps_new_ex(sizeof(int), 4, 4);
+  TEST_ASSERT_TRUE(sps_stable_remove(bounded, true));
+  TEST_ASSERT_NOT_NULL(sps_add_many(bounded, (uint32_t[]){0, 1, 2, 3}, 4, (int[]){0, 1, 2, 3}));
+  sps_remove(bounded, 0);
+  sps_remove(bounded, 1);
+  TEST_ASSERT_NOT_NULL(sps_add_many(bounded, (uint32_t[]){4, 5}, 2, (int[]){4, 5}));
+  TEST_ASSERT_EQUAL(4, sps_count(bounded));
+  TEST_ASSERT_EQUAL(2, bounded->dense[0]);
+  TEST_ASSERT_EQUAL(5, *(int *)sps_get(bounded, 5));
+  sps_free(bounded);
+
+  // Removals reach the change lists and disabling compacts
+  sparse_set_t *tracked = sps_new(sizeof(int));
+  TEST_ASSERT_TRUE(sps_stable_remove(tracked, true));
+  TEST_ASSERT_TRUE(sps_track_changes(tracked, true));
+  sps_add(tracked, 1, &(int){1});
+  sps_add(tracked, 2, &(int){2});
+  sps_changes_clear(tracked);
+  sps_remove(tracked, 1);
+
+  const uint32_t *removed = NULL;
+  TEST_ASSERT_EQUAL(1, sps_changes_removed(tracked, &removed));
+  TEST_ASSERT_EQUAL(1, removed[0]);
+  size_t tracked_size = sps_snapshot_size(tracked);
+  TEST_ASSERT_TRUE(sps_stable_remove(tracked, false));
+  TEST_ASSERT_EQUAL(1, tracked->count);
+  TEST_ASSERT_EQUAL(2, tracked->dense[0]);
+  TEST_ASSERT_EQUAL(tracked_size, sps_snapshot_size(tracked));
+  sps_clear(tracked);
+  sps_free(tracked);
+}
+
+static void test_sps_stable_remove_formats(void) {
+  TEST_ASSERT_TRUE(sps_stable_remove(set, true));
+  for (uint32_t i = 0; i < 100; i++) {
+    sps_add_handle(set, sps_handle_make(i * 3, i % 2), &(int){(int)i});
+  }
+  for (uint32_t i = 0; i < 100; i += 7) {
+    sps_remove(set, i * 3);
+  }
+  TEST_ASSERT_TRUE(set->tombstones > 0);
+
+  // Tombstones are left out, the live entities keep their order
+  size_t size = sps_serialized_size(set);
+  uint8_t *buffer = malloc(size);
+  TEST_ASSERT_EQUAL(size, sps_serialize(set, buffer, size));
+  sparse_set_t *copy = sps_deserialize(buffer, size, NULL);
+  TEST_ASSERT_NOT_NULL(copy);
+  TEST_ASSERT_EQUAL(sps_count(set), copy->count);
+
+  uint32_t at = 0;
+  for (uint32_t i = 0; i < set->count; i++) {
+    if (set->dense[i] == SPS_TOMBSTONE) continue;
+    TEST_ASSERT_EQUAL(set->dense[i], copy->dense[at]);
+    TEST_ASSERT_EQUAL(*(int *)sps_get(set, set->dense[i]), ((int *)copy->components)[at]);
+    TEST_ASSERT_EQUAL(sps_handle(set, set->dense[i]), sps_handle(copy, copy->dense[at]));
+    at++;
+  }
+  sps_free(copy);
+
+  // Snapshots and deltas between them follow the live entities too
+  size_t size0 = sps_snapshot_size(set);
+  uint8_t *frame0 = malloc(size0);
+  TEST_ASSERT_EQUAL(size0, sps_snapshot(set, frame0, size0));
+
+  sps_remove(set, 3);
+  *(int *)sps_get(set, 30) = -10;
+  size_t size1 = sps_snapshot_size(set);
+  uint8_t *frame1 = malloc(size1);
+  TEST_ASSERT_EQUAL(size1, sps_snapshot(set, frame1, size1));
+
+  uint8_t *delta = malloc(sps_delta_bound(size1));
+  size_t delta_size = sps_delta_encode(frame0, size0, frame1, size1, delta, sps_delta_bound(size1));
+  TEST_ASSERT_TRUE(delta_size > 0);
+  uint8_t *decoded = malloc(size1);
+  TEST_ASSERT_EQUAL(size1, sps_delta_decode(frame0, size0, delta, delta_size, decoded, size1));
+  TEST_ASSERT_EQUAL_MEMORY(frame1, decoded, size1);
+
+  sparse_set_t *restored = sps_new(sizeof(int));
+  TEST_ASSERT_TRUE(sps_restore(restored, decoded, size1));
+  TEST_ASSERT_EQUAL(sps_count(set), sps_count(restored));
+  TEST_ASSERT_FALSE(sps_has(restored, 3));
+  TEST_ASSERT_EQUAL(-10, *(int *)sps_get(restored, 30));
+  TEST_ASSERT_EQUAL(sps_handle(set, 33), sps_handle(restored, 33));
+  sps_free(restored);
+
+  // Both match what the compacted set writes
+  sps_compact(set);
+  TEST_ASSERT_EQUAL(size1, sps_snapshot_size(set));
+  TEST_ASSERT_EQUAL(size1, sps_snapshot(set, decoded, size1));
+  TEST_ASSERT_EQUAL_MEMORY(frame1, decoded, size1);
+
+  sps_remove(set, 3 * 50);
+  sps_remove(set, 3 * 51);
+  size = sps_serialized_size(set);
+  uint8_t *stable = malloc(size);
+  TEST_ASSERT_EQUAL(size, sps_serialize(set, stable, size));
+  sps_compact(set);
+  TEST_ASSERT_EQUAL(size, sps_serialized_size(set));
+  TEST_ASSERT_EQUAL(size, sps_serialize(set, buffer, size));
+  TEST_ASSERT_EQUAL_MEMORY(buffer, stable, size);
+
+  // Columns and blocks are copied run by run
+  sparse_set_t *bodies = sps_new_soa(sizeof(body_t), body_fields, 5);
+  TEST_ASSERT_TRUE(sps_stable_remove(bodies, true));
+  for (uint32_t i = 0; i < 40; i++) {
+    sps_add(bodies, i, &(body_t){(float)i, 1.0f, (float)((i * 13) % 50), i, (uint8_t)i});
+  }
+  for (uint32_t i = 0; i < 40; i += 5) {
+    sps_remove(bodies, i);
+  }
+  uint8_t *columns = malloc(sps_serialized_size(bodies));
+  size = sps_serialize(bodies, columns, sps_serialized_size(bodies));
+  sparse_set_t *bodies_copy = sps_deserialize(columns, size, NULL);
+  TEST_ASSERT_NOT_NULL(bodies_copy);
+  TEST_ASSERT_EQUAL(32, bodies_copy->count);
+  assert_body_columns(bodies_copy);
+  sps_free(bodies_copy);
+  sps_free(bodies);
+
+  sparse_set_t *paged = sps_new_paged(sizeof(int), 4);
+  TEST_ASSERT_TRUE(sps_stable_remove(paged, true));
+  for (uint32_t i = 0; i < 10; i++) {
+    sps_add(paged, i, &(int){(int)i * 10});
+  }
+  sps_remove(paged, 2);
+  sps_remove(paged, 3);
+  sps_remove(paged, 5);
+  uint8_t *blocks = malloc(sps_snapshot_size(paged));
+  size = sps_snapshot(paged, blocks, sps_snapshot_size(paged));
+  sparse_set_t *paged_copy = sps_new_paged(sizeof(int), 4);
+  TEST_ASSERT_TRUE(sps_restore(paged_copy, blocks, size));
+  TEST_ASSERT_EQUAL(7, sps_count(paged_copy));
+  uint32_t live[] = {0, 1, 4, 6, 7, 8, 9};
+  for (uint32_t i = 0; i < 7; i++) {
+    TEST_ASSERT_EQUAL(live[i], paged_copy->dense[i]);
+    TEST_ASSERT_EQUAL((int)live[i] * 10, *(int *)sps_get(paged_copy, live[i]));
+  }
+  sps_free(paged_copy);
+  sps_free(paged);
+
+  free(buffer);
+  free(stable);
+  free(frame0);
+  free(frame1);
+  free(delta);
+  free(decoded);
+  free(columns);
+  free(blocks);
+}
+
+static void test_sps_paged(void) {
+  sparse_set_t *paged = sps_new_paged(sizeof(int), 4);
+  TEST_ASSERT_NOT_NULL(paged);
+  TEST_ASSERT_NULL(sps_new_paged(sizeof(int), 3));
+
+  // Pointers handed out survive growth
+  int *first = sps_add(paged, 0, &(int){0});
+  for (uint32_t i = 1; i < 100; i++) {
+    sps_add(paged, i, &(int){(int)i});
+  }
+  TEST_ASSERT_EQUAL_PTR(first, sps_get(paged, 0));
+  TEST_ASSERT_EQUAL(0, sps_capacity(paged) % 4);
+  TEST_ASSERT_NULL(sps_span(paged).components);
+
+  // Spans end at block boundaries
+  sparse_set_span_t span;
+  size_t total = 0;
+  sparse_set_iter_t iter = sps_iter_new(paged);
+  while (sps_iter_next_span(&iter, 0, &span)) {
+    TEST_ASSERT_EQUAL(0, span.begin % 4);
+    TEST_ASSERT_TRUE(span.count <= 4);
+    for (size_t i = 0; i < span.count; i++) {
+      TEST_ASSERT_EQUAL((int)span.entities[i], ((int *)span.components)[i]);
+    }
+    total += span.count;
+  }
+  TEST_ASSERT_EQUAL(100, total);
+
+  // Removal, batches and sorts reach across blocks
+  sps_remove(paged, 1);
+  TEST_ASSERT_EQUAL(99, *(int *)sps_get(paged, 99));
+  TEST_ASSERT_EQUAL_PTR(sps_get(paged, 99), (int *)first + 1);
+  uint32_t indices[] = {200, 201, 202, 203, 204, 205};
+  int values[] = {-1, -2, -3, -4, -5, -6};
+  sps_add_many(paged, indices, 6, values);
+  TEST_ASSERT_EQUAL(-6, *(int *)sps_get(paged, 205));
+
+  sps_sort(paged, compare_ints, NULL);
+  TEST_ASSERT_EQUAL(205, paged->dense[0]);
+  TEST_ASSERT_EQUAL(99, paged->dense[sps_count(paged) - 1]);
+  sps_sort_by_key(paged, 0, SPS_KEY_I32);
+  int previous = -100;
+  iter = sps_iter_new(paged);
+  for (int *value; (value = sps_iter_next(&iter, NULL)) != NULL; previous = *value) {
+    TEST_ASSERT_TRUE(previous < *value);
+  }
+
+  // Snapshots and serialization see the components in dense order
+  size_t size = sps_snapshot_size(paged);
+  void *snapshot = malloc(size);
+  TEST_ASSERT_EQUAL(size, sps_snapshot(paged, snapshot, size));
+  sps_remove(paged, 50);
+  sps_add(paged, 50, &(int){5000});
+  TEST_ASSERT_TRUE(sps_restore(paged, snapshot, size));
+  TEST_ASSERT_EQUAL(50, *(int *)sps_get(paged, 50));
+  free(snapshot);
+
+  size = sps_serialized_size(paged);
+  void *data = malloc(size);
+  TEST_ASSERT_EQUAL(size, sps_serialize(paged, data, size));
+  sparse_set_t *copy = sps_deserialize(data, size, NULL);
+  TEST_ASSERT_NOT_NULL(copy);
+  TEST_ASSERT_EQUAL(sps_count(paged), sps_count(copy));
+  TEST_ASSERT_EQUAL(-3, *(int *)sps_get(copy, 202));
+  TEST_ASSERT_EQUAL(77, *(int *)sps_get(copy, 77));
+  sps_free(copy);
+  free(data);
+
+  // A paged member of a group hands out no component base either
+  sparse_set_t *plain = sps_new(sizeof(int));
+  for (uint32_t i = 0; i < 100; i += 2) {
+    sps_add(plain, i, &(int){(int)i});
+  }
+  sps_group_t *group = sps_group_new((sparse_set_t *[]){plain, paged}, 2);
+  TEST_ASSERT_NOT_NULL(group);
+  TEST_ASSERT_EQUAL(50, sps_group_size(group));
+  sparse_set_span_t members[] = {sps_group_span(group, 0), sps_group_span(group, 1)};
+  TEST_ASSERT_NOT_NULL(members[0].components);
+  TEST_ASSERT_NULL(members[1].components);
+  TEST_ASSERT_EQUAL(50, members[1].count);
+  for (size_t i = 0; i < members[1].count; i++) {
+    TEST_ASSERT_EQUAL(members[0].entities[i], members[1].entities[i]);
+    TEST_ASSERT_EQUAL((int)members[1].entities[i], *(int *)sps_get(paged, members[1].entities[i]));
+  }
+
+  total = 0;
+  iter = sps_iter_new(paged);
+  while (total < sps_group_size(group) &&
+         sps_iter_next_span(&iter, sps_group_size(group) - total, &span)) {
+    for (size_t i = 0; i < span.count; i++) {
+      TEST_ASSERT_EQUAL(members[0].entities[span.begin + i], span.entities[i]);
+      TEST_ASSERT_EQUAL((int)span.entities[i], ((int *)span.components)[i]);
+    }
+    total += span.count;
+  }
+  TEST_ASSERT_EQUAL(50, total);
+  sps_group_free(group);
+  sps_free(plain);
+  sps_free(paged);
+}
+
+// Runs the tasks of a batch one after another, last one first
+static void run_reversed(sps_task_func_t func, void *task, size_t count, void *ctx) {
+  size_t *batches = ctx;
+  (*batches)++;
+  while (count-- > 0) {
+    func(task, count);
+  }
+}
+
+static void test_sps_sort_parallel(void) {
+  sps_field_t fields[] = {
+      {offsetof(sprite_t, id), sizeof(uint32_t)},
+      {offsetof(sprite_t, depth), sizeof(float)},
+  };
+  sparse_set_t *sets[] = {
+      sps_new(sizeof(sprite_t)),
+      sps_new(sizeof(sprite_t)),
+      sps_new_soa(sizeof(sprite_t), fields, 2),
+  };
+  TEST_ASSERT_TRUE(sps_track_changes(sets[1], true));
+
+  // Few distinct depths, so stability decides most of the order
+  for (uint32_t i = 0; i < 40000; i++) {
+    sprite_t sprite = {.id = i, .depth = (float)((i * 7919U) % 97U)};
+    for (size_t s = 0; s < 3; s++) {
+      sps_add(sets[s], i * 3, &sprite);
+    }
+  }
+
+  size_t batches = 0;
+  sps_scheduler_t scheduler = {.run = run_reversed, .workers = 7, .ctx = &batches};
+  sps_sort(sets[0], compare_depth, NULL);
+  sps_sort_parallel(sets[1], compare_depth, NULL, &scheduler);
+  TEST_ASSERT_TRUE(batches > 3);
+  sps_sort_parallel(sets[2], compare_depth, NULL, &scheduler);
+
+  for (uint32_t i = 0; i < 40000; i++) {
+    uint32_t index = sets[0]->dense[i];
+    TEST_ASSERT_EQUAL(index, sets[1]->dense[i]);
+    TEST_ASSERT_EQUAL(index, sets[2]->dense[i]);
+    TEST_ASSERT_EQUAL(index / 3, ((sprite_t *)sps_get(sets[1], index))->id);
+    TEST_ASSERT_EQUAL(index / 3, *(uint32_t *)sps_get_field(sets[2], index, 0));
+  }
+
+  // Small sets are sorted on the calling thread
+  sparse_set_t *small = sps_new(sizeof(sprite_t));
+  sps_add(small, 1, &(sprite_t){.depth = 2.0f});
+  sps_add(small, 2, &(sprite_t){.depth = 1.0f});
+  batches = 0;
+  sps_sort_parallel(small, compare_depth, NULL, &scheduler);
+  TEST_ASSERT_EQUAL(0, batches);
+  TEST_ASSERT_EQUAL(2, small->dense[0]);
+  sps_sort_parallel(small, compare_depth, NULL, NULL);
+  sps_free(small);
+
+  for (size_t s = 0; s < 3; s++) {
+    sps_free(sets[s]);
+  }
+}
+
+static void test_sps_sort_as(void) {
+  sparse_set_t *reference = sps_new(sizeof(int));
+  uint32_t order[] = {9, 3, 20, 5, 1};
+  for (size_t i = 0; i < 5; i++) {
+    sps_add(reference, order[i], &(int){0});
+  }
+  for (uint32_t i = 10; i > 0; i--) {
+    sps_add(set, i, &(int){(int)i * 10});
+  }
+
+  TEST_ASSERT_EQUAL(4, sps_sort_as(set, reference));
+  uint32_t expected[] = {9, 3, 5, 1, 10, 8, 7, 6, 4, 2};
+  for (uint32_t i = 0; i < 10; i++) {
+    TEST_ASSERT_EQUAL(expected[i], set->dense[i]);
+    TEST_ASSERT_EQUAL((int)expected[i] * 10, *(int *)sps_get(set, expected[i]));
+  }
+
+  // Tombstones of either set are left out
+  TEST_ASSERT_TRUE(sps_stable_remove(reference, true));
+  sps_remove(reference, 9);
+  sps_remove(set, 5);
+  TEST_ASSERT_EQUAL(2, sps_sort_as(set, reference));
+  TEST_ASSERT_EQUAL(3, set->dense[0]);
+  TEST_ASSERT_EQUAL(1, set->dense[1]);
+  TEST_ASSERT_EQUAL(9, set->dense[2]);
+  TEST_ASSERT_EQUAL(9, sps_count(set));
+  TEST_ASSERT_EQUAL(9, sps_sort_as(set, set));
+  sps_free(reference);
+}
+
+static void test_sps_unchecked(void) {
+  for (uint32_t i = 0; i < 50; i++) {
+    TEST_ASSERT_NOT_NULL(sps_add_unchecked(set, i * 7, &(int){(int)i}));
+  }
+  TEST_ASSERT_EQUAL(50, sps_count(set));
+  TEST_ASSERT_TRUE(sps_has_unchecked(set, 343));
+  TEST_ASSERT_FALSE(sps_has_unchecked(set, 344));
+  TEST_ASSERT_FALSE(sps_has_unchecked(set, 1U << 30));
+  TEST_ASSERT_FALSE(sps_has_unchecked(set, SPARSE_SET_MAX));
+  TEST_ASSERT_NULL(sps_get_unchecked(set, 8));
+  TEST_ASSERT_EQUAL_PTR(sps_get(set, 49), sps_get_unchecked(set, 49));
+  TEST_ASSERT_EQUAL(7, *(int *)sps_get_unchecked(set, 49));
+
+  // Every storage layout is addressed like the checked accessor does
+  sparse_set_t *paged = sps_new_paged(sizeof(int), 8);
+  sparse_set_t *soa = sps_new_soa(sizeof(sprite_t), &(sps_field_t){offsetof(sprite_t, depth), 4}, 1);
+  for (uint32_t i = 0; i < 40; i++) {
+    sps_add_unchecked(paged, i, &(int){(int)i});
+    sps_add_unchecked(soa, i, &(sprite_t){.depth = (float)i});
+  }
+  for (uint32_t i = 0; i < 40; i++) {
+    TEST_ASSERT_EQUAL_PTR(sps_get(paged, i), sps_get_unchecked(paged, i));
+    TEST_ASSERT_EQUAL_PTR(sps_get(soa, i), sps_get_unchecked(soa, i));
+  }
+  TEST_ASSERT_EQUAL(33, *(int *)sps_get_unchecked(paged, 33));
+  TEST_ASSERT_EQUAL_FLOAT(33.0f, *(float *)sps_get_unchecked(soa, 33));
+  sps_free(paged);
+  sps_free(soa);
+}
+
 // Test behavior with modifications during iteration
 static void test_sps_iter_with_modifications(void) {
   int values[] = {100, 200, 300, 400};
@@ -170,7 +2068,7 @@ static void test_sps_iter_with_modifications(void) {
 
   // Start iteration
   sparse_set_iter_t iter = sps_iter_new(set);
-  uint16_t idx;
+  uint32_t idx;
   int count = 0;
 
   // Remove an element during iteration
@@ -220,6 +2118,41 @@ int main(int argc, char *argv[]) {
   RUN_TEST(test_sps_iter);
   RUN_TEST(test_sps_full);
   RUN_TEST(test_sps_sort);
+  RUN_TEST(test_sps_growth);
+  RUN_TEST(test_sps_reserve);
+  RUN_TEST(test_sps_wide_indices);
+  RUN_TEST(test_sps_memory_usage);
+  RUN_TEST(test_sps_handles);
+  RUN_TEST(test_sps_sort_stable_large);
+  RUN_TEST(test_sps_sort_by_key);
+  RUN_TEST(test_sps_sort_incremental);
+  RUN_TEST(test_sps_add_many);
+  RUN_TEST(test_sps_remove_many);
+  RUN_TEST(test_sps_get_many);
+  RUN_TEST(test_sps_spans);
+  RUN_TEST(test_sps_typed);
+  RUN_TEST(test_sps_soa);
+  RUN_TEST(test_sps_view);
+  RUN_TEST(test_sps_group);
+  RUN_TEST(test_sps_allocator);
+  RUN_TEST(test_sps_commands);
+  RUN_TEST(test_sps_partition);
+  RUN_TEST(test_sps_shared);
+  RUN_TEST(test_sps_shared_readers);
+  RUN_TEST(test_sps_changes);
+  RUN_TEST(test_sps_serialize);
+  RUN_TEST(test_sps_snapshot);
+  RUN_TEST(test_sps_stats);
+  RUN_TEST(test_sps_aligned);
+  RUN_TEST(test_sps_advise);
+  RUN_TEST(test_sps_has_many);
+  RUN_TEST(test_sps_clear);
+  RUN_TEST(test_sps_stable_remove);
+  RUN_TEST(test_sps_stable_remove_formats);
+  RUN_TEST(test_sps_paged);
+  RUN_TEST(test_sps_sort_parallel);
+  RUN_TEST(test_sps_sort_as);
+  RUN_TEST(test_sps_unchecked);
   RUN_TEST(test_sps_iter_with_modifications);
   RUN_TEST(test_sps_edge_cases);
 